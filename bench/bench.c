@@ -0,0 +1,465 @@
+// make bench BUILD=native [BENCH_ARGS="-s 2 -f sym/ -o results.json"]
+// every input comes from gen.c, so runs on different machines or versions measure the same bytes.  results go out as JSON, in the same order with the same keys every time.
+#include "gen.h"
+#include "../cc.h"
+#include "../find.h"
+#include "../kmem.h"
+#include "../mach-o/binary.h"
+#include "../mach-o/link.h"
+#include "../mach-o/inject.h"
+#include "../dyldcache/binary.h"
+#include <time.h>
+
+static uint32_t scale = 1;
+static double budget = 0.5; // seconds per benchmark
+static const char *filter;
+static FILE *out;
+static bool first_result = true;
+
+#define MAX_SAMPLES 1000
+
+struct timer {
+    uint64_t samples[MAX_SAMPLES];
+    uint32_t n;
+    uint64_t total, started;
+};
+
+static uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static void timer_init(struct timer *t) {
+    t->n = 0;
+    t->total = 0;
+}
+
+// at least 3 runs, then as many as fit in the budget
+static bool timer_more(const struct timer *t) {
+    return t->n < 3 || (t->total < budget * 1e9 && t->n < MAX_SAMPLES);
+}
+
+static inline void timer_start(struct timer *t) {
+    t->started = now();
+}
+
+static inline void timer_stop(struct timer *t) {
+    uint64_t elapsed = now() - t->started;
+    t->samples[t->n++] = elapsed;
+    t->total += elapsed;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// -f takes a prefix: "find" is every find benchmark, "find/bmh" just the one.  groups ask with their own prefix, so they can skip generating inputs nobody wants
+static bool wanted(const char *name) {
+    return !filter || !strncmp(name, filter, strlen(filter)) || !strncmp(name, filter, strlen(name));
+}
+
+// bytes and items are per run; either can be 0
+static void report(const char *name, struct timer *t, uint64_t bytes, uint64_t items) {
+    qsort(t->samples, t->n, sizeof(*t->samples), compare_u64);
+    uint64_t median = t->samples[t->n / 2], min = t->samples[0];
+    fprintf(out, "%s\n    {\"name\": \"%s\", \"runs\": %u, \"median_ns\": %llu, \"min_ns\": %llu, \"bytes\": %llu, \"items\": %llu, \"gb_per_s\": %.3f, \"ns_per_item\": %.1f}",
+            first_result ? "" : ",", name, t->n, (unsigned long long) median, (unsigned long long) min, (unsigned long long) bytes, (unsigned long long) items,
+            bytes ? (double) bytes / (double) median : 0.0, items ? (double) median / (double) items : 0.0);
+    first_result = false;
+    fprintf(stderr, "%-28s %12.3f ms", name, median / 1e6);
+    if(bytes) fprintf(stderr, " %9.3f GB/s", (double) bytes / (double) median);
+    if(items) fprintf(stderr, " %9.1f ns/item", (double) median / (double) items);
+    fprintf(stderr, "\n");
+}
+
+// runs body (between timer_start and timer_stop) until the timer has enough, then reports
+#define BENCH(name, bytes, items, body...) \
+    if(wanted(name)) { \
+        struct timer t; \
+        for(timer_init(&t); timer_more(&t);) { \
+            body \
+        } \
+        report(name, &t, bytes, items); \
+    }
+
+static prange_t copy_prange(prange_t pr) {
+    void *p = malloc(pr.size);
+    memcpy(p, pr.start, pr.size);
+    return (prange_t) {p, pr.size};
+}
+
+static void load_copy(struct binary *b, prange_t work, prange_t orig) {
+    memcpy(work.start, orig.start, orig.size);
+    b_init(b);
+    b_prange_load_macho(b, work, 0, "<bench>");
+}
+
+// find
+
+static void bench_find() {
+    if(!wanted("find")) return;
+    struct gen_macho_options o = {.nsyms = 1000, .text_size = (32 << 20) * scale, .base = 0x80000000, .seed = 1};
+    prange_t pr = gen_macho(&o);
+    prange_t text = {(char *) pr.start + 0x1000, o.text_size};
+    char **patterns = gen_plant_patterns(text, 16, 12, 2);
+    // a second set near the start, for timing the DFA build on a range too small to matter
+    prange_t head = {text.start, 0x10000};
+    char **head_patterns = gen_plant_patterns(head, 16, 12, 3);
+    const uint32_t needle = 0xfeedf00d;
+    memcpy((char *) text.start + text.size - 4, &needle, 4);
+
+    struct binary b;
+    b_init(&b);
+    b_prange_load_macho(&b, pr, 0, "<bench>");
+    range_t range = b_macho_sectrange(&b, "__TEXT", "__text");
+    range_t head_range = {&b, range.start, head.size};
+
+    // "aa bb .. dd": the wildcard caps every shift at 2
+    char *wild = strdup(patterns[1]);
+    memcpy(wild + 6, "..", 2);
+
+    BENCH("find/bmh", range.size, 0,
+        timer_start(&t);
+        find_data(range, patterns[0], 0, MUST_FIND);
+        timer_stop(&t);
+    )
+    BENCH("find/bmh_wildcard", range.size, 0,
+        timer_start(&t);
+        find_data(range, wild, 0, MUST_FIND);
+        timer_stop(&t);
+    )
+    BENCH("find/int32", range.size, 0,
+        timer_start(&t);
+        addr_t found = find_int32(range, needle, MUST_FIND);
+        timer_stop(&t);
+        if(found != range.start + range.size - 4) die("%08x turned up early; pick another needle", needle);
+    )
+    BENCH("findmany/build", 0, 16,
+        addr_t results[16];
+        timer_start(&t);
+        struct findmany *fm = findmany_init(head_range);
+        for(int i = 0; i < 16; i++) findmany_add(&results[i], fm, head_patterns[i]);
+        findmany_go(fm);
+        timer_stop(&t);
+    )
+    BENCH("findmany/scan", range.size, 16,
+        addr_t results[16];
+        timer_start(&t);
+        struct findmany *fm = findmany_init(range);
+        for(int i = 0; i < 16; i++) findmany_add(&results[i], fm, patterns[i]);
+        findmany_go(fm);
+        timer_stop(&t);
+    )
+    free(wild);
+}
+
+// symbols
+
+static void bench_syms() {
+    if(!wanted("sym")) return;
+    struct gen_macho_options o32 = {.nsyms = 20000 * scale, .nlocals = 20000 * scale, .nimports = 2000 * scale, .text_size = 1 << 20, .base = 0x80000000, .seed = 4};
+    struct gen_macho_options o64 = o32;
+    o64.is64 = true;
+    o64.base = 0xfffffff007004000;
+    o64.seed = 5;
+    prange_t pr32 = gen_macho(&o32), pr64 = gen_macho(&o64);
+    struct binary b32, b64;
+    b_init(&b32);
+    b_prange_load_macho(&b32, pr32, 0, "<bench>");
+    b_init(&b64);
+    b_prange_load_macho(&b64, pr64, 0, "<bench>");
+
+    uint32_t nexports, nlocals, nimports, nexports64;
+    char **exports = gen_symbol_names(&o32, GEN_EXPORTS, &nexports);
+    char **locals = gen_symbol_names(&o32, GEN_LOCALS, &nlocals);
+    char **imports = gen_symbol_names(&o32, GEN_IMPORTS, &nimports);
+    char **exports64 = gen_symbol_names(&o64, GEN_EXPORTS, &nexports64);
+
+    BENCH("sym/nlist", 0, nexports,
+        timer_start(&t);
+        for(uint32_t i = 0; i < nexports; i++) b_sym(&b32, exports[i], MUST_FIND);
+        timer_stop(&t);
+    )
+    BENCH("sym/private", 0, nlocals,
+        timer_start(&t);
+        for(uint32_t i = 0; i < nlocals; i++) b_sym(&b32, locals[i], MUST_FIND | PRIVATE_SYM);
+        timer_stop(&t);
+    )
+    BENCH("sym/imported", 0, nimports,
+        timer_start(&t);
+        for(uint32_t i = 0; i < nimports; i++) b_sym(&b32, imports[i], IMPORTED_SYM);
+        timer_stop(&t);
+    )
+
+    // a few lookups walk the trie; after that it gets flattened
+    const uint32_t few = 31;
+    BENCH("sym/trie_walk", 0, few,
+        b_macho_forget_caches(&b64);
+        timer_start(&t);
+        for(uint32_t i = 0; i < few; i++) b_sym(&b64, exports64[i * (nexports64 / few)], MUST_FIND);
+        timer_stop(&t);
+    )
+    const char **batch = malloc(few * sizeof(*batch));
+    addr_t *results = malloc(few * sizeof(*results));
+    for(uint32_t i = 0; i < few; i++) batch[i] = exports64[i * (nexports64 / few)];
+    BENCH("sym/trie_batch", 0, few,
+        b_macho_forget_caches(&b64);
+        timer_start(&t);
+        b_sym_many(&b64, batch, results, few, MUST_FIND);
+        timer_stop(&t);
+    )
+    BENCH("sym/export_table_build", 0, nexports64,
+        b_macho_forget_caches(&b64);
+        timer_start(&t);
+        b_macho_export_table(&b64);
+        timer_stop(&t);
+    )
+    BENCH("sym/export_table", 0, nexports64,
+        timer_start(&t);
+        for(uint32_t i = 0; i < nexports64; i++) b_sym(&b64, exports64[i], MUST_FIND);
+        timer_stop(&t);
+    )
+
+    free(batch);
+    free(results);
+    gen_free_names(exports, nexports);
+    gen_free_names(locals, nlocals);
+    gen_free_names(imports, nimports);
+    gen_free_names(exports64, nexports64);
+}
+
+static void bench_dyldcache() {
+    if(!wanted("dyldcache")) return;
+    struct gen_dyldcache_options o = {.nimages = 64 * scale, .nsyms = 500, .text_size = 0x4000, .seed = 6};
+    prange_t pr = gen_dyldcache(&o);
+
+    BENCH("dyldcache/load_images", 0, o.nimages,
+        struct binary cache;
+        b_init(&cache);
+        timer_start(&t);
+        b_prange_load_dyldcache(&cache, pr, "<bench>");
+        for(uint32_t i = 0; i < o.nimages; i++) {
+            struct binary image;
+            b_dyldcache_load_macho(&cache, b_dyldcache_image_path(&cache, i), &image);
+        }
+        timer_stop(&t);
+    )
+
+    struct binary cache;
+    b_init(&cache);
+    b_prange_load_dyldcache(&cache, pr, "<bench>");
+    struct dyldcache_symtab symtab;
+    BENCH("dyldcache/symtab_build", 0, o.nimages * o.nsyms,
+        timer_start(&t);
+        b_dyldcache_build_symtab(&cache, &symtab);
+        timer_stop(&t);
+        b_dyldcache_free_symtab(&symtab);
+        // so every run flattens the tries again
+        for(uint32_t i = 0; i < o.nimages; i++) {
+            b_macho_forget_caches(cache.dyld->images[i]);
+        }
+    )
+
+    b_dyldcache_build_symtab(&cache, &symtab);
+    char ***names = malloc(o.nimages * sizeof(*names));
+    uint32_t count;
+    for(uint32_t i = 0; i < o.nimages; i++) {
+        char prefix[16];
+        snprintf(prefix, sizeof(prefix), "lib%u", i);
+        struct gen_macho_options mo = {.nsyms = o.nsyms, .prefix = prefix, .seed = o.seed + i};
+        names[i] = gen_symbol_names(&mo, GEN_EXPORTS, &count);
+    }
+    BENCH("dyldcache/symtab_lookup", 0, o.nimages * o.nsyms,
+        timer_start(&t);
+        for(uint32_t i = 0; i < o.nimages; i++) {
+            for(uint32_t j = 0; j < o.nsyms; j++) {
+                if(!b_dyldcache_symtab_lookup(&symtab, names[i][j])) die("lost %s", names[i][j]);
+            }
+        }
+        timer_stop(&t);
+    )
+    for(uint32_t i = 0; i < o.nimages; i++) gen_free_names(names[i], count);
+    free(names);
+    b_dyldcache_free_symtab(&symtab);
+}
+
+// unpack
+
+static void bench_unpack() {
+    if(!wanted("unpack")) return;
+    struct gen_macho_options o = {.nsyms = 20000, .nrelocs = 20000, .text_size = (16 << 20) * scale, .base = 0x80000000, .seed = 7};
+    prange_t kernel = gen_macho(&o);
+    prange_t packed = gen_complzss(kernel);
+    BENCH("unpack/complzss", kernel.size, 0,
+        timer_start(&t);
+#ifdef IMG3_SUPPORT
+        prange_t unpacked = unpack(packed, NULL, NULL);
+#else
+        prange_t unpacked = decompress_complzss(packed);
+#endif
+        timer_stop(&t);
+        if(unpacked.size != kernel.size) die("unpacked to %zu bytes, not %zu", unpacked.size, kernel.size);
+        // decompress_complzss mmaps this much
+        munmap(unpacked.start, (unpacked.size + 0x1fff) & ~0xfff);
+    )
+    free(kernel.start);
+    free(packed.start);
+}
+
+// relocate
+
+static addr_t bench_lookup(__unused void *context, const char *name) {
+    uint32_t hash = 5381;
+    while(*name) hash = hash * 33 + (uint8_t) *name++;
+    return 0xc0000000 | (hash & 0x0ffffffc);
+}
+
+static void bench_relocate_one(const char *name, const char *plan_name, bool is64) {
+    if(!wanted(name) && !wanted(plan_name)) return;
+    struct gen_macho_options o = {.is64 = is64, .nsyms = 1000, .nimports = 2000 * scale, .nrelocs = 200000 * scale, .text_size = 1 << 20, .base = 0x80000000, .seed = 8};
+    prange_t orig = gen_macho(&o);
+    prange_t work = copy_prange(orig);
+    uint32_t items = o.nrelocs + o.nimports;
+    struct binary b;
+    BENCH(name, 0, items,
+        load_copy(&b, work, orig);
+        timer_start(&t);
+        b_relocate(&b, NULL, RELOC_DEFAULT, bench_lookup, NULL, 0x100000);
+        timer_stop(&t);
+    )
+    load_copy(&b, work, orig);
+    struct reloc_plan plan;
+    b_relocation_plan(&plan, &b, RELOC_DEFAULT, bench_lookup, NULL, 0);
+    BENCH(plan_name, 0, items,
+        load_copy(&b, work, orig);
+        timer_start(&t);
+        b_apply_relocation_plan(&plan, &b, 0x100000);
+        timer_stop(&t);
+    )
+    b_free_relocation_plan(&plan);
+    free(orig.start);
+    free(work.start);
+}
+
+static void bench_relocate() {
+    bench_relocate_one("relocate/reloc32", "relocate/apply_plan32", false);
+    bench_relocate_one("relocate/dyld_info64", "relocate/apply_plan64", true);
+}
+
+// inject
+
+static void bench_inject() {
+    if(!wanted("inject")) return;
+    struct gen_macho_options to = {.nsyms = 20000, .nlocals = 20000, .nimports = 100, .nrelocs = 1000, .text_size = (8 << 20) * scale, .base = 0x80000000, .seed = 9};
+    struct gen_macho_options po = {.nsyms = 1000, .nimports = 100, .nrelocs = 1000, .text_size = 256 << 10, .base = 0xd0000000, .seed = 10};
+    prange_t target = gen_macho(&to), payload_pr = gen_macho(&po);
+    prange_t work = copy_prange(target);
+    struct binary payload;
+    b_init(&payload);
+    b_prange_load_macho(&payload, payload_pr, 0, "<payload>");
+    for(int userland = 0; userland < 2; userland++) {
+        BENCH(userland ? "inject/userland" : "inject/kernel", target.size + payload_pr.size, 0,
+            struct binary b;
+            load_copy(&b, work, target);
+            timer_start(&t);
+            b_inject_macho_binary(&b, &payload, NULL, userland);
+            timer_stop(&t);
+            // it's pdup's mapping
+            munmap(b.valid_range.start, b.valid_range.size);
+        )
+    }
+    free(target.start);
+    free(payload_pr.start);
+    free(work.start);
+}
+
+// kmem, against a temporary file standing in for kernel memory
+
+static void bench_kmem() {
+    if(!wanted("kmem")) return;
+    struct gen_macho_options o = {.nsyms = 1000, .nrelocs = 1000, .text_size = (8 << 20) * scale, .base = 0x80000000, .seed = 11};
+    prange_t pr = gen_macho(&o);
+    struct binary b;
+    b_init(&b);
+    b_prange_load_macho(&b, pr, 0, "<bench>");
+    addr_t end = b_allocate_vmaddr(&b);
+    FILE *fp = tmpfile();
+    if(!fp) edie("could not create a temporary file");
+    struct kmem mem;
+    kmem_init_fd(&mem, fileno(fp), o.base);
+    if(kmem_allocate(&mem, o.base, end - o.base)) die("could not allocate");
+
+    // what b_inject_into_running_kernel does with each segment
+    BENCH("kmem/load_segments", pr.size, 0,
+        timer_start(&t);
+        CMD_ITERATE(b_mach_hdr(&b), cmd) {
+            if(cmd->cmd != LC_SEGMENT) continue;
+            struct segment_command *seg = (void *) cmd;
+            uint32_t fs = seg->vmsize < seg->filesize ? seg->vmsize : seg->filesize;
+            kmem_write(&mem, seg->vmaddr, rangeconv_off((range_t) {&b, seg->fileoff, seg->filesize}, MUST_FIND).start, fs);
+            kmem_protect(&mem, seg->vmaddr, seg->vmsize, true, seg->maxprot);
+            kmem_protect(&mem, seg->vmaddr, seg->vmsize, false, seg->initprot);
+            kmem_flush_cache(&mem, seg->vmaddr, seg->vmsize);
+        }
+        kmem_sync(&mem);
+        timer_stop(&t);
+    )
+
+    // words scattered over four times as many pages as the cache holds
+    const uint32_t nreads = 100000;
+    BENCH("kmem/read_words", 0, nreads,
+        uint64_t state = 12;
+        kmem_invalidate(&mem);
+        timer_start(&t);
+        for(uint32_t i = 0; i < nreads; i++) {
+            addr_t addr = o.base + (gen_random(&state) % (KMEM_PAGE_SIZE * KMEM_CACHE_PAGES)) * 4;
+            uint32_t word;
+            kmem_read(&mem, addr, &word, sizeof(word));
+        }
+        timer_stop(&t);
+    )
+
+    kmem_free(&mem);
+    fclose(fp);
+    free(pr.start);
+}
+
+static void usage() {
+    fprintf(stderr, "usage: bench [-s scale] [-t seconds-per-benchmark] [-f name-prefix] [-o output.json]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    const char *output = NULL;
+    int c;
+    while((c = getopt(argc, argv, "s:t:f:o:")) != -1) {
+        switch(c) {
+        case 's': scale = (uint32_t) atoi(optarg); if(scale < 1) usage(); break;
+        case 't': budget = atof(optarg); break;
+        case 'f': filter = optarg; break;
+        case 'o': output = optarg; break;
+        default: usage();
+        }
+    }
+    out = output ? fopen(output, "w") : stdout;
+    if(!out) edie("could not open %s", output);
+
+#ifdef PROFILING
+    const bool profiling = true;
+#else
+    const bool profiling = false;
+#endif
+    fprintf(out, "{\"format\": 1, \"scale\": %u, \"budget_s\": %.3f, \"threads\": %u, \"profiling\": %s, \"benchmarks\": [", scale, budget, parallel_threads(), profiling ? "true" : "false");
+    bench_find();
+    bench_syms();
+    bench_dyldcache();
+    bench_unpack();
+    bench_relocate();
+    bench_inject();
+    bench_kmem();
+    fprintf(out, "\n]}\n");
+    if(out != stdout) fclose(out);
+    return 0;
+}
@@ -0,0 +1,498 @@
+#include "gen.h"
+#include "../cc.h"
+#include "../find.h"
+#include "../lzss.h"
+#include "../mach-o/binary.h"
+#include "../mach-o/headers/loader.h"
+#include "../mach-o/headers/nlist.h"
+#include "../mach-o/headers/reloc.h"
+#include "../dyldcache/headers/dyld_cache_format.h"
+
+uint64_t gen_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static const char *const stems[] = {
+    "IOService", "IOMemoryDescriptor", "OSObject", "OSDictionary", "OSArray", "vm_map", "vm_page", "vm_object",
+    "kalloc", "zalloc", "ipc_port", "ipc_kmsg", "thread", "task", "proc", "vnode",
+    "mbuf", "sysctl", "lck_mtx", "pmap", "kext", "mac_policy", "cs_blob", "ubc",
+};
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+char **gen_symbol_names(const struct gen_macho_options *o, enum gen_sym_kind kind, uint32_t *count) {
+    *count = kind == GEN_EXPORTS ? o->nsyms : kind == GEN_LOCALS ? o->nlocals : o->nimports;
+    const char *prefix = o->prefix ? o->prefix : "";
+    uint64_t state = o->seed * 131 + kind;
+    char **names = malloc(*count * sizeof(*names));
+    for(uint32_t i = 0; i < *count; i++) {
+        const char *stem = stems[gen_random(&state) % (sizeof(stems) / sizeof(*stems))];
+        size_t size = strlen(prefix) + strlen(stem) + 16;
+        names[i] = malloc(size);
+        snprintf(names[i], size, "_%s%s_%c%u", prefix, stem, (char) kind, i);
+    }
+    qsort(names, *count, sizeof(*names), compare_names);
+    return names;
+}
+
+void gen_free_names(char **names, uint32_t count) {
+    for(uint32_t i = 0; i < count; i++) free(names[i]);
+    free(names);
+}
+
+void gen_text(void *buf, size_t size, uint64_t seed) {
+    uint64_t state = seed;
+    uint32_t dict[256];
+    for(int i = 0; i < 256; i++) {
+        dict[i] = (uint32_t) gen_random(&state);
+    }
+    uint32_t *p = buf;
+    for(size_t i = 0; i < size / 4; i++) {
+        uint64_t r = gen_random(&state);
+        p[i] = dict[r & 0xff] ^ (uint32_t) ((r >> 8) & 0x0f0f);
+    }
+}
+
+char **gen_plant_patterns(prange_t text, uint32_t count, uint32_t len, uint64_t seed) {
+    uint64_t state = seed;
+    char **patterns = malloc(count * sizeof(*patterns));
+    for(uint32_t i = 0; i < count; i++) {
+        uint8_t *p = (uint8_t *) text.start + ((text.size / (count + 1) * (i + 1)) & ~3);
+        char *hex = patterns[i] = malloc(len * 3);
+        for(uint32_t j = 0; j < len; j++) {
+            p[j] = (uint8_t) gen_random(&state);
+            hex += sprintf(hex, j ? " %02x" : "%02x", p[j]);
+        }
+    }
+    return patterns;
+}
+
+// a growing buffer
+struct gen_buf {
+    uint8_t *start;
+    size_t size, capacity;
+};
+
+static void *gb_add(struct gen_buf *gb, size_t size) {
+    if(gb->size + size > gb->capacity) {
+        gb->capacity = max(gb->capacity * 2, gb->size + size + 256);
+        gb->start = realloc(gb->start, gb->capacity);
+    }
+    void *p = gb->start + gb->size;
+    memset(p, 0, size);
+    gb->size += size;
+    return p;
+}
+
+static void gb_byte(struct gen_buf *gb, uint8_t byte) {
+    *(uint8_t *) gb_add(gb, 1) = byte;
+}
+
+static void gb_uleb(struct gen_buf *gb, uint64_t value) {
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        gb_byte(gb, value ? byte | 0x80 : byte);
+    } while(value);
+}
+
+static void gb_string(struct gen_buf *gb, const char *s) {
+    memcpy(gb_add(gb, strlen(s) + 1), s, strlen(s) + 1);
+}
+
+static void gb_align(struct gen_buf *gb, size_t align) {
+    gb_add(gb, (align - gb->size % align) % align);
+}
+
+static uint32_t uleb_size(uint64_t value) {
+    uint32_t size = 1;
+    while(value >>= 7) size++;
+    return size;
+}
+
+// export tries
+
+struct trie_node {
+    uint32_t lo, hi; // the names under this node
+    uint32_t depth; // how much of them the path to here spells out
+    uint32_t first_child, nchildren; // children are contiguous, since the nodes are built breadth first
+    bool terminal;
+    uint32_t offset, size;
+};
+
+static void gen_export_trie(struct gen_buf *gb, char **names, const addr_t *values, uint32_t count, addr_t baseaddr) {
+    struct trie_node *nodes = malloc(sizeof(*nodes) * (2 * count + 1));
+    uint32_t nnodes = 1;
+    nodes[0] = (struct trie_node) {0, count, 0, 0, 0, false, 0, 0};
+    for(uint32_t n = 0; n < nnodes; n++) {
+        struct trie_node *node = &nodes[n];
+        uint32_t a = node->lo;
+        node->terminal = a < node->hi && names[a][node->depth] == 0;
+        if(node->terminal) a++;
+        node->first_child = nnodes;
+        while(a < node->hi) {
+            // the names that go down this edge share the next character; the edge is as long as all of them agree
+            uint32_t b = a + 1;
+            char c = names[a][node->depth];
+            while(b < node->hi && names[b][node->depth] == c) b++;
+            uint32_t depth = node->depth + 1;
+            while(names[a][depth] && names[a][depth] == names[b - 1][depth]) depth++;
+            nodes[nnodes++] = (struct trie_node) {a, b, depth, 0, 0, false, 0, 0};
+            node->nchildren++;
+            a = b;
+        }
+        if(node->nchildren > 255) die("too many children in export trie");
+    }
+
+    // children come after their parents, so offsets can only grow; go until they settle
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        uint32_t offset = 0;
+        for(uint32_t n = 0; n < nnodes; n++) {
+            struct trie_node *node = &nodes[n];
+            uint32_t size = 1;
+            if(node->terminal) {
+                addr_t address = values[node->lo] - baseaddr;
+                uint32_t info = uleb_size(0) + uleb_size(address);
+                size += uleb_size(info) + info;
+            } else {
+                size++;
+            }
+            for(uint32_t c = node->first_child; c < node->first_child + node->nchildren; c++) {
+                size += nodes[c].depth - node->depth + 1 + uleb_size(nodes[c].offset);
+            }
+            if(node->offset != offset || node->size != size) changed = true;
+            node->offset = offset;
+            node->size = size;
+            offset += size;
+        }
+    }
+
+    for(uint32_t n = 0; n < nnodes; n++) {
+        const struct trie_node *node = &nodes[n];
+        if(node->terminal) {
+            addr_t address = values[node->lo] - baseaddr;
+            gb_uleb(gb, uleb_size(0) + uleb_size(address));
+            gb_uleb(gb, 0);
+            gb_uleb(gb, address);
+        } else {
+            gb_byte(gb, 0);
+        }
+        gb_byte(gb, (uint8_t) node->nchildren);
+        for(uint32_t c = node->first_child; c < node->first_child + node->nchildren; c++) {
+            uint32_t len = nodes[c].depth - node->depth;
+            memcpy(gb_add(gb, len), names[nodes[c].lo] + node->depth, len);
+            gb_byte(gb, 0);
+            gb_uleb(gb, nodes[c].offset);
+        }
+    }
+    free(nodes);
+}
+
+// Mach-O
+
+#define round_page(x) (((x) + 0xfff) & ~(size_t) 0xfff)
+
+prange_t gen_macho(const struct gen_macho_options *o) {
+    bool dyld_info = o->dyld_info || o->is64;
+    uint32_t ps = o->is64 ? 8 : 4;
+    uint64_t state = o->seed;
+
+    uint32_t nexports, nlocals, nimports;
+    char **exports = gen_symbol_names(o, GEN_EXPORTS, &nexports);
+    char **locals = gen_symbol_names(o, GEN_LOCALS, &nlocals);
+    char **imports = gen_symbol_names(o, GEN_IMPORTS, &nimports);
+
+    // __TEXT is the header page and then __text; __DATA is the import slots and then __data; __LINKEDIT is everything else
+    size_t text_size = round_page(max(o->text_size, 0x1000));
+    size_t text_seg_size = 0x1000 + text_size;
+    addr_t text_vm = o->base, text_sect_vm = text_vm + 0x1000;
+    uint32_t slots_size = nimports * ps, ptrs_size = o->nrelocs * ps;
+    size_t data_seg_size = round_page(max(slots_size + ptrs_size, 1));
+    addr_t data_vm = text_vm + text_seg_size, ptrs_vm = data_vm + slots_size;
+    size_t data_off = text_seg_size, link_off = text_seg_size + data_seg_size;
+    addr_t link_vm = data_vm + data_seg_size;
+
+    uint8_t *data = calloc(1, data_seg_size);
+    addr_t *export_values = malloc(nexports * sizeof(*export_values));
+    for(uint32_t i = 0; i < nexports; i++) {
+        export_values[i] = text_sect_vm + (gen_random(&state) % text_size & ~3);
+    }
+
+    struct gen_buf link = {NULL, 0, 0};
+    uint32_t iundef = nlocals + nexports;
+    #define is_extern(k) (nimports && (k) % 8 == 5)
+    #define extern_symbol(k) ((k) / 8 % nimports)
+
+    for(uint32_t k = 0; k < o->nrelocs; k++) {
+        if(!is_extern(k)) {
+            write_pointer(data + slots_size + k * ps, text_sect_vm + (gen_random(&state) % text_size & ~3), ps);
+        }
+    }
+
+    uint32_t reloff = 0, nlocrel = 0, extreloff = 0, nextrel = 0;
+    uint32_t rebase_off = 0, rebase_size = 0, bind_off = 0, bind_size = 0, export_off = 0, export_size = 0;
+    if(!dyld_info) {
+        // local relocations first, then external ones
+        for(int ext = 0; ext < 2; ext++) {
+            if(ext) extreloff = (uint32_t) link.size;
+            else reloff = (uint32_t) link.size;
+            for(uint32_t k = 0; k < o->nrelocs; k++) {
+                if(is_extern(k) != ext) continue;
+                struct relocation_info *ri = gb_add(&link, sizeof(*ri));
+                ri->r_address = (int32_t) (ptrs_vm + k * ps - text_vm);
+                ri->r_symbolnum = ext ? iundef + extern_symbol(k) : 1;
+                ri->r_length = 2;
+                ri->r_extern = ext;
+                if(ext) nextrel++;
+                else nlocrel++;
+            }
+        }
+    } else {
+        // a run of rebases for each stretch between imports
+        rebase_off = (uint32_t) link.size;
+        gb_byte(&link, REBASE_OPCODE_SET_TYPE_IMM | REBASE_TYPE_POINTER);
+        gb_byte(&link, REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 1);
+        gb_uleb(&link, slots_size);
+        for(uint32_t k = 0; k < o->nrelocs;) {
+            uint32_t run = 0;
+            while(k + run < o->nrelocs && !is_extern(k + run)) run++;
+            if(run) {
+                gb_byte(&link, REBASE_OPCODE_DO_REBASE_ULEB_TIMES);
+                gb_uleb(&link, run);
+                k += run;
+            } else {
+                gb_byte(&link, REBASE_OPCODE_ADD_ADDR_IMM_SCALED | 1);
+                k++;
+            }
+        }
+        gb_byte(&link, REBASE_OPCODE_DONE);
+        rebase_size = (uint32_t) link.size - rebase_off;
+
+        bind_off = (uint32_t) link.size;
+        gb_byte(&link, BIND_OPCODE_SET_DYLIB_ORDINAL_IMM | 1);
+        gb_byte(&link, BIND_OPCODE_SET_TYPE_IMM | BIND_TYPE_POINTER);
+        for(uint32_t i = 0; i < nimports; i++) {
+            gb_byte(&link, BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM);
+            gb_string(&link, imports[i]);
+            gb_byte(&link, BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 1);
+            gb_uleb(&link, i * ps);
+            gb_byte(&link, BIND_OPCODE_DO_BIND);
+        }
+        for(uint32_t k = 0; k < o->nrelocs; k++) {
+            if(!is_extern(k)) continue;
+            gb_byte(&link, BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM);
+            gb_string(&link, imports[extern_symbol(k)]);
+            gb_byte(&link, BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 1);
+            gb_uleb(&link, slots_size + k * ps);
+            gb_byte(&link, BIND_OPCODE_DO_BIND);
+        }
+        gb_byte(&link, BIND_OPCODE_DONE);
+        bind_size = (uint32_t) link.size - bind_off;
+
+        gb_align(&link, 8);
+        export_off = (uint32_t) link.size;
+        gen_export_trie(&link, exports, export_values, nexports, text_vm);
+        export_size = (uint32_t) link.size - export_off;
+    }
+    #undef is_extern
+    #undef extern_symbol
+
+    // strings, then the symbols that point at them
+    struct gen_buf strings = {NULL, 0, 0};
+    gb_byte(&strings, 0);
+    uint32_t nsyms = nlocals + nexports + nimports;
+    uint32_t *strx = malloc(nsyms * sizeof(*strx));
+    for(uint32_t i = 0; i < nsyms; i++) {
+        strx[i] = (uint32_t) strings.size;
+        gb_string(&strings, i < nlocals ? locals[i] : i < iundef ? exports[i - nlocals] : imports[i - iundef]);
+    }
+    gb_align(&strings, ps);
+
+    gb_align(&link, 8);
+    uint32_t symoff = (uint32_t) link.size;
+    if(o->is64) _MACHO_SPECIALIZE_64(
+        nlist_x *nl = gb_add(&link, nsyms * sizeof(*nl));
+        for(uint32_t i = 0; i < nsyms; i++, nl++) {
+            nl->n_un.n_strx = strx[i];
+            if(i < iundef) {
+                nl->n_type = i < nlocals ? N_SECT : N_SECT | N_EXT;
+                nl->n_sect = 1;
+                nl->n_value = i < nlocals ? text_sect_vm + (gen_random(&state) % text_size & ~3) : export_values[i - nlocals];
+            } else {
+                nl->n_type = N_UNDF | N_EXT;
+                SET_LIBRARY_ORDINAL(nl->n_desc, 1);
+            }
+        }
+    ) else _MACHO_SPECIALIZE_32(
+        nlist_x *nl = gb_add(&link, nsyms * sizeof(*nl));
+        for(uint32_t i = 0; i < nsyms; i++, nl++) {
+            nl->n_un.n_strx = strx[i];
+            if(i < iundef) {
+                nl->n_type = i < nlocals ? N_SECT : N_SECT | N_EXT;
+                nl->n_sect = 1;
+                nl->n_value = (uint32_t) (i < nlocals ? text_sect_vm + (gen_random(&state) % text_size & ~3) : export_values[i - nlocals]);
+            } else {
+                nl->n_type = N_UNDF | N_EXT;
+                SET_LIBRARY_ORDINAL(nl->n_desc, 1);
+            }
+        }
+    )
+    uint32_t indirectoff = (uint32_t) link.size;
+    uint32_t *indirect = gb_add(&link, nimports * sizeof(uint32_t));
+    for(uint32_t i = 0; i < nimports; i++) {
+        indirect[i] = iundef + i;
+    }
+    uint32_t stroff = (uint32_t) link.size;
+    memcpy(gb_add(&link, strings.size), strings.start, strings.size);
+    size_t link_size = round_page(link.size);
+
+    prange_t out = {calloc(1, link_off + link_size), link_off + link_size};
+    gen_text((char *) out.start + 0x1000, text_size, o->seed ^ 0x7e47);
+    memcpy((char *) out.start + data_off, data, data_seg_size);
+    memcpy((char *) out.start + link_off, link.start, link.size);
+
+    // the load commands
+    addr_t fo = o->file_offset;
+    struct mach_header *hdr = out.start;
+    hdr->magic = o->is64 ? MH_MAGIC_64 : MH_MAGIC;
+    hdr->cputype = o->is64 ? CPU_TYPE_ARM | CPU_ARCH_ABI64 : CPU_TYPE_ARM;
+    hdr->cpusubtype = o->is64 ? 0 : CPU_SUBTYPE_ARM_V7;
+    hdr->filetype = o->filetype ? o->filetype : MH_EXECUTE;
+    char *cmd = (char *) out.start + (o->is64 ? sizeof(struct mach_header_64) : sizeof(struct mach_header));
+    // sections are part of their segment's command
+    #define add_space(type, var) type *var = (void *) cmd; cmd += sizeof(*var);
+    #define add_cmd(type, var) add_space(type, var) hdr->ncmds++;
+    #define add_segment(name, vm_, vmsize_, off_, filesize_, prot_, nsects_) \
+        add_cmd(segment_command_x, seg) \
+        seg->cmd = LC_SEGMENT_X; \
+        seg->cmdsize = sizeof(*seg) + (nsects_) * sizeof(section_x); \
+        strncpy(seg->segname, name, 16); \
+        seg->vmaddr = vm_; seg->vmsize = vmsize_; seg->fileoff = off_; seg->filesize = filesize_; \
+        seg->maxprot = seg->initprot = prot_; \
+        seg->nsects = nsects_;
+    #define add_section(sectname_, segname_, vm_, size_, off_, flags_) { \
+        add_space(section_x, sect) \
+        strncpy(sect->sectname, sectname_, 16); strncpy(sect->segname, segname_, 16); \
+        sect->addr = vm_; sect->size = size_; sect->offset = (uint32_t) (off_); sect->align = ps == 8 ? 3 : 2; \
+        sect->flags = flags_; \
+    }
+    #define segments() { \
+        { add_segment("__TEXT", text_vm, text_seg_size, fo, text_seg_size, PROT_READ | PROT_EXEC, 1) } \
+        add_section("__text", "__TEXT", text_sect_vm, text_size, fo + 0x1000, S_REGULAR | S_ATTR_PURE_INSTRUCTIONS | S_ATTR_SOME_INSTRUCTIONS) \
+        { add_segment("__DATA", data_vm, data_seg_size, fo + data_off, data_seg_size, PROT_READ | PROT_WRITE, 2) } \
+        add_section("__nl_symbol_ptr", "__DATA", data_vm, slots_size, fo + data_off, S_NON_LAZY_SYMBOL_POINTERS) \
+        add_section("__data", "__DATA", ptrs_vm, ptrs_size, fo + data_off + slots_size, S_REGULAR) \
+        { add_segment("__LINKEDIT", link_vm, link_size, fo + link_off, link_size, PROT_READ, 0) } \
+    }
+    if(o->is64) _MACHO_SPECIALIZE_64(segments()) else _MACHO_SPECIALIZE_32(segments())
+    #define lo(off) ((uint32_t) (fo + link_off + (off)))
+    add_cmd(struct symtab_command, symtab)
+    *symtab = (struct symtab_command) {LC_SYMTAB, sizeof(*symtab), lo(symoff), nsyms, lo(stroff), (uint32_t) strings.size};
+    add_cmd(struct dysymtab_command, dysymtab)
+    *dysymtab = (struct dysymtab_command) {
+        .cmd = LC_DYSYMTAB, .cmdsize = sizeof(*dysymtab),
+        .ilocalsym = 0, .nlocalsym = nlocals,
+        .iextdefsym = nlocals, .nextdefsym = nexports,
+        .iundefsym = iundef, .nundefsym = nimports,
+        .indirectsymoff = nimports ? lo(indirectoff) : 0, .nindirectsyms = nimports,
+        .extreloff = nextrel ? lo(extreloff) : 0, .nextrel = nextrel,
+        .locreloff = nlocrel ? lo(reloff) : 0, .nlocrel = nlocrel,
+    };
+    if(dyld_info) {
+        add_cmd(struct dyld_info_command, di)
+        *di = (struct dyld_info_command) {
+            .cmd = LC_DYLD_INFO_ONLY, .cmdsize = sizeof(*di),
+            .rebase_off = lo(rebase_off), .rebase_size = rebase_size,
+            .bind_off = lo(bind_off), .bind_size = bind_size,
+            .export_off = lo(export_off), .export_size = export_size,
+        };
+    }
+    hdr->sizeofcmds = (uint32_t) (cmd - (char *) (hdr + 1)) - (o->is64 ? 4 : 0);
+    #undef lo
+    #undef segments
+    #undef add_section
+    #undef add_segment
+    #undef add_cmd
+    #undef add_space
+
+    free(strx);
+    free(strings.start);
+    free(link.start);
+    free(export_values);
+    free(data);
+    gen_free_names(exports, nexports);
+    gen_free_names(locals, nlocals);
+    gen_free_names(imports, nimports);
+    return out;
+}
+
+prange_t gen_dyldcache(const struct gen_dyldcache_options *o) {
+    const addr_t base = 0x30000000;
+    uint32_t info_off = 0x40 + sizeof(struct shared_file_mapping_np);
+    struct gen_buf header = {NULL, 0, 0};
+    gb_add(&header, info_off + o->nimages * sizeof(struct dyld_cache_image_info));
+    char path[64];
+    for(uint32_t i = 0; i < o->nimages; i++) {
+        ((struct dyld_cache_image_info *) (header.start + info_off))[i].pathFileOffset = (uint32_t) header.size;
+        snprintf(path, sizeof(path), "/usr/lib/libgen%u.dylib", i);
+        gb_string(&header, path);
+    }
+
+    struct gen_buf out = {NULL, 0, 0};
+    memcpy(gb_add(&out, round_page(header.size)), header.start, header.size);
+    free(header.start);
+    for(uint32_t i = 0; i < o->nimages; i++) {
+        char prefix[16];
+        snprintf(prefix, sizeof(prefix), "lib%u", i);
+        struct gen_macho_options mo = {
+            .nsyms = o->nsyms,
+            .text_size = o->text_size,
+            .base = base + out.size,
+            .filetype = MH_DYLIB,
+            .file_offset = out.size,
+            .prefix = prefix,
+            .seed = o->seed + i,
+        };
+        prange_t image = gen_macho(&mo);
+        struct dyld_cache_image_info *info = (void *) (out.start + info_off) + i * sizeof(*info);
+        info->address = mo.base;
+        memcpy(gb_add(&out, image.size), image.start, image.size);
+        free(image.start);
+    }
+
+    struct dyld_cache_header *hdr = (void *) out.start;
+    memcpy(hdr->magic, "dyld_v1   armv7", 16);
+    hdr->mappingOffset = 0x40;
+    hdr->mappingCount = 1;
+    hdr->imagesOffset = info_off;
+    hdr->imagesCount = o->nimages;
+    struct shared_file_mapping_np *sfm = (void *) (out.start + 0x40);
+    sfm->sfm_address = base;
+    sfm->sfm_size = out.size;
+    sfm->sfm_file_offset = 0;
+    sfm->sfm_max_prot = sfm->sfm_init_prot = PROT_READ | PROT_EXEC;
+    return (prange_t) {out.start, out.size};
+}
+
+prange_t gen_complzss(prange_t payload) {
+    uint32_t capacity = (uint32_t) (payload.size + payload.size / 8 + 16);
+    prange_t out = {malloc(sizeof(struct comp_header) + capacity), 0};
+    struct comp_header *ch = out.start;
+    memset(ch, 0, sizeof(*ch));
+    uint32_t length = compress_lzss((uint8_t *) (ch + 1), capacity, payload.start, (uint32_t) payload.size);
+    if(!length) die("compress_lzss ran out of room");
+    memcpy(&ch->signature, "comp", 4);
+    memcpy(&ch->compression_type, "lzss", 4);
+    ch->checksum = swap32(lzadler32(payload.start, (int32_t) payload.size));
+    ch->length_uncompressed = swap32((uint32_t) payload.size);
+    ch->length_compressed = swap32(length);
+    out.size = sizeof(*ch) + length;
+    return out;
+}
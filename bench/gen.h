@@ -0,0 +1,55 @@
+#pragma once
+#include "../common.h"
+
+// synthetic inputs for the benchmarks.  everything is a pure function of its options (seed included), so the same options always give the same bytes.
+
+struct gen_macho_options {
+    bool is64;              // arm64 instead of armv7
+    bool dyld_info;         // rebase/bind opcodes and an export trie instead of relocation entries; 64-bit images always have it
+    uint32_t nsyms;         // exported, all in __text
+    uint32_t nlocals;
+    uint32_t nimports;      // each gets a slot in __nl_symbol_ptr
+    uint32_t nrelocs;       // pointers in __data to fix up; every 8th is to an import
+    uint32_t text_size;     // rounded up to a page
+    addr_t base;            // vmaddr of __TEXT
+    uint32_t filetype;      // MH_EXECUTE if 0
+    size_t file_offset;     // where in a bigger file (like a dyld cache) the image will go; the load commands' offsets are relative to that file
+    const char *prefix;     // goes after the _ of every symbol name, so images can avoid exporting the same names
+    uint64_t seed;
+};
+
+enum gen_sym_kind {
+    GEN_EXPORTS = 'e',
+    GEN_LOCALS = 'l',
+    GEN_IMPORTS = 'i',
+};
+
+struct gen_dyldcache_options {
+    uint32_t nimages;
+    uint32_t nsyms;         // exported by each image
+    uint32_t text_size;     // of each image
+    uint64_t seed;
+};
+
+__BEGIN_DECLS
+
+// splitmix64
+uint64_t gen_random(uint64_t *state);
+
+// the names gen_macho gives symbols of that kind, sorted; free them with gen_free_names
+char **gen_symbol_names(const struct gen_macho_options *o, enum gen_sym_kind kind, uint32_t *count);
+void gen_free_names(char **names, uint32_t count);
+
+// instruction-like words: a couple hundred distinct ones with a little noise, so the byte frequencies are skewed like real code
+void gen_text(void *buf, size_t size, uint64_t seed);
+// writes count random len-byte patterns into text, evenly spaced, and returns them in find_data syntax
+char **gen_plant_patterns(prange_t text, uint32_t count, uint32_t len, uint64_t seed);
+
+// the results are malloced
+prange_t gen_macho(const struct gen_macho_options *o);
+// armv7 images /usr/lib/libgenN.dylib, each exporting nsyms symbols named like gen_macho's with prefix "libN"
+prange_t gen_dyldcache(const struct gen_dyldcache_options *o);
+// compressed the way a kernelcache is, so decompress_complzss takes it back out
+prange_t gen_complzss(prange_t payload);
+
+__END_DECLS
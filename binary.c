@@ -1,6 +1,7 @@
 #include "common.h"
 #include "binary.h"
 #include "find.h"
+#include "trace.h"
 #include <stddef.h>
 
 static inline bool prange_check(const struct binary *binary, prange_t range);
@@ -10,18 +11,21 @@ void b_init(struct binary *binary) {
 }
 
 static inline bool rangeconv_stuff(const struct binary *binary, addr_t addr, bool is_off, addr_t *out_address, addr_t *out_offset, size_t *out_size) {
-    uint32_t ls = binary->last_seg, ns = binary->nsegments, i = ls;
+    // last_seg is only a hint, but b_sym can get here from several threads (see b_macho_prepare_concurrent_sym)
+    uint32_t ls = __atomic_load_n(&binary->last_seg, __ATOMIC_RELAXED), ns = binary->nsegments, i = ls;
+    TRACE_COUNT(TRACE_RANGECONV, 1);
     #define STUFF \
         const struct data_segment *seg = &binary->segments[i]; \
         addr_t diff = addr - (is_off ? seg->file_range : seg->vm_range).start; \
         if(diff < seg->file_range.size) { \
-            ((struct binary *) binary)->last_seg = i; \
+            __atomic_store_n(&((struct binary *) binary)->last_seg, i, __ATOMIC_RELAXED); \
             *out_address = seg->vm_range.start + diff; \
             *out_offset = seg->file_range.start + diff; \
             *out_size = seg->file_range.size - diff; \
             return true; \
         }
     STUFF
+    TRACE_COUNT(TRACE_RANGECONV_MISS, 1);
     for(i = 0; i < ns; i++) {
         STUFF
     }
@@ -45,12 +49,27 @@ inline prange_t rangeconv(range_t range, int flags) {
 
 inline prange_t rangeconv_off(range_t range, int flags) {
     prange_t pr;
+    TRACE_COUNT(TRACE_RANGECONV_OFF, 1);
     if(range.start == 0 && range.binary->header_offset) {
         // dyld caches are weird.
         range.start = range.binary->header_offset;
     }
     pr.start = (char *) range.binary->valid_range.start + range.start;
     pr.size = range.size;
+    if(__builtin_expect(range.binary->_map_range != NULL, 0)) {
+        size_t avail = range.binary->_map_range(range.binary, range.start, range.size);
+        if(range.size > avail) {
+            if(flags & MUST_FIND) {
+                die("offset range (%08x, %zx) not valid", range.start, range.size);
+            } else {
+                return (prange_t) {NULL, 0};
+            }
+        }
+        if(flags & EXTEND_RANGE) {
+            pr.size = avail;
+        }
+        return pr;
+    }
     if(!prange_check(range.binary, pr)) {
         if(flags & MUST_FIND) {
             die("offset range (%08x, %zx) not valid", range.start, range.size);
@@ -96,6 +115,21 @@ addr_t b_sym(const struct binary *binary, const char *name, int options) {
     return result;
 }
 
+void b_sym_many(const struct binary *binary, const char **names, addr_t *results, uint32_t count, int options) {
+    if(binary->_sym_many) {
+        binary->_sym_many(binary, names, results, count, options);
+    } else {
+        for(uint32_t i = 0; i < count; i++) {
+            results[i] = b_sym(binary, names[i], options & ~MUST_FIND);
+        }
+    }
+    if(options & MUST_FIND) {
+        for(uint32_t i = 0; i < count; i++) {
+            if(!results[i]) die("symbol %s not found", names[i]);
+        }
+    }
+}
+
 void b_copy_syms(const struct binary *binary, struct data_sym **syms, uint32_t *nsyms, int options) {
     if(!binary->_copy_syms) {
         *syms = NULL;
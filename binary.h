@@ -53,7 +53,10 @@ struct binary {
     struct dyldcache_binary *dyld;
 
     addr_t (*_sym)(const struct binary *binary, const char *name, int options);
+    void (*_sym_many)(const struct binary *binary, const char **names, addr_t *results, uint32_t count, int options);
     void (*_copy_syms)(const struct binary *binary, struct data_sym **syms, uint32_t *nsyms, int options);
+    // if set, rangeconv_off calls this to make sure [offset, offset+size) is mapped; it returns how many bytes starting at offset are valid
+    size_t (*_map_range)(const struct binary *binary, addr_t offset, size_t size);
 };
 
 __BEGIN_DECLS
@@ -71,6 +74,8 @@ void b_init(struct binary *binary);
 
 // return value is |1 if to_execute is set and it is a thumb symbol
 addr_t b_sym(const struct binary *binary, const char *name, int options);
+// like calling b_sym on each name, but names that are sorted (by strcmp) can be looked up together
+void b_sym_many(const struct binary *binary, const char **names, addr_t *results, uint32_t count, int options);
 void b_copy_syms(const struct binary *binary, struct data_sym **syms, uint32_t *nsyms, int options);
 
 void b_store(struct binary *binary, const char *path);
@@ -1,13 +1,15 @@
-#ifdef IMG3_SUPPORT
 #include <stdint.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <sys/mman.h>
 #include <unistd.h>
-#include <CommonCrypto/CommonCryptor.h>
-#include <mach-o/fat.h>
 #include "common.h"
+#include "cc.h"
 #include "lzss.h"
+#include "trace.h"
+#ifdef IMG3_SUPPORT
+#include <CommonCrypto/CommonCryptor.h>
+#include <mach-o/fat.h>
 
 // this is sort of irrelevant, but I'd like to use it for OS X kernelcaches which are sometimes compressed within fat
 
@@ -146,16 +148,10 @@ static prange_t decrypt(uint32_t key_bits, prange_t key, prange_t iv, prange_t b
     return (prange_t) {outbuf, outbuf_len};
 }
 
-struct comp_header {
-    uint32_t signature;
-    uint32_t compression_type;
-    uint32_t checksum;
-    uint32_t length_uncompressed;
-    uint32_t length_compressed;
-    uint8_t  padding[0x16C];
-} __attribute__((packed));
+#endif
 
-static prange_t decompress(prange_t buffer) {
+prange_t decompress_complzss(prange_t buffer) {
+    TRACE_SCOPE("decompress_complzss");
     // is it really compressed?
     if(buffer.size < sizeof(struct comp_header)) return buffer;
     struct comp_header *ch = buffer.start;
@@ -191,6 +187,8 @@ static prange_t decompress(prange_t buffer) {
     return (prange_t) {decbuf, actual_length_uncompressed};
 }
 
+#ifdef IMG3_SUPPORT
+
 struct img3_header {
     uint32_t magic;
     uint32_t size;
@@ -263,9 +261,10 @@ static prange_t parse_img3(prange_t img3, const char *key, const char *iv) {
 }
 
 prange_t unpack(prange_t input, const char *key, const char *iv) {
+    TRACE_SCOPE("unpack");
     input = parse_img3(input, key, iv); 
     input = parse_fat(input, key);
-    input = decompress(input);
+    input = decompress_complzss(input);
     return input;
 }
 #endif
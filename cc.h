@@ -1,5 +1,19 @@
+#pragma once
 #include "common.h"
+
+// big endian, except signature and compression_type are 'comp' and 'lzss' in file order
+struct comp_header {
+    uint32_t signature;
+    uint32_t compression_type;
+    uint32_t checksum;
+    uint32_t length_uncompressed;
+    uint32_t length_compressed;
+    uint8_t  padding[0x16C];
+} __attribute__((packed));
+
 __BEGIN_DECLS
+// returns buffer itself if it isn't complzss
+prange_t decompress_complzss(prange_t buffer);
 #ifdef IMG3_SUPPORT
 prange_t unpack(prange_t input, const char *key, const char *iv);
 #endif
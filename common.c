@@ -1,4 +1,5 @@
 #include "common.h"
+#include "trace.h"
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -77,6 +78,7 @@ uint32_t parse_hex_uint32(const char *string) {
 
 prange_t load_file(const char *filename, bool rw, mode_t *mode) {
 #define _arg filename
+    TRACE_SCOPE("load_file");
     int fd = open(filename, O_RDONLY);
     if(fd == -1) {
         edie("could not open");
@@ -179,3 +181,48 @@ void _die(const char *fmt, ...) {
 }
 #endif
 
+
+#include <pthread.h>
+
+struct parallel_ctx {
+    void (*func)(void *context, size_t i);
+    void *context;
+    size_t count;
+    size_t next;
+};
+
+static void *parallel_worker(void *ctx_) {
+    struct parallel_ctx *ctx = ctx_;
+    size_t i;
+    while((i = __sync_fetch_and_add(&ctx->next, 1)) < ctx->count) {
+        ctx->func(ctx->context, i);
+    }
+    return NULL;
+}
+
+unsigned int parallel_threads() {
+    const char *env = getenv("DATA_THREADS");
+    long n = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    if(n < 1) n = 1;
+    if(n > 64) n = 64;
+    return (unsigned int) n;
+}
+
+void parallel_for(size_t count, void (*func)(void *context, size_t i), void *context) {
+    struct parallel_ctx ctx = {func, context, count, 0};
+    size_t nthreads = parallel_threads();
+    if(nthreads > count) nthreads = count;
+#ifdef EXCEPTION_SUPPORT
+    // die() longjmps back to data_call, which only works on the calling thread
+    if(call_going) nthreads = 1;
+#endif
+    pthread_t threads[64];
+    size_t started = 0;
+    while(started + 1 < nthreads && !pthread_create(&threads[started], NULL, parallel_worker, &ctx)) {
+        started++;
+    }
+    parallel_worker(&ctx);
+    for(size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
@@ -69,6 +69,10 @@ uint32_t parse_hex_uint32(const char *string);
 
 __attribute__((noreturn)) void _die(const char *fmt, ...);
 
+// calls func(context, i) for every i in [0, count), spread over a few threads (DATA_THREADS overrides the number of CPUs), in no particular order.  a die() in func takes down the whole process.
+unsigned int parallel_threads();
+void parallel_for(size_t count, void (*func)(void *context, size_t i), void *context);
+
 #if defined(__APPLE__) && __DARWIN_C_LEVEL < 200809L
 static inline size_t strnlen(const char *s, size_t n) {
   const char *p = (const char *) memchr(s, 0, n);
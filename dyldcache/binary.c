@@ -1,11 +1,17 @@
 #include "binary.h"
+#include "slide.h"
 #include "../mach-o/headers/loader.h"
+#include "../mach-o/headers/nlist.h"
 #include "headers/dyld_cache_format.h"
+#include "../trace.h"
+#include <pthread.h>
+#include <sys/stat.h>
 
 #define downcast(val, typ) ({ typeof(val) v = (val); typ t = (typ) v; if(t != v) die("out of range %s", #val); t; })
 
 void b_prange_load_dyldcache(struct binary *binary, prange_t pr, const char *name) {
 #define _arg name
+    TRACE_SCOPE("b_prange_load_dyldcache");
 
     binary->valid = true;
     binary->pointer_size = 4;
@@ -27,6 +33,14 @@ void b_prange_load_dyldcache(struct binary *binary, prange_t pr, const char *nam
     } else if(!memcmp(thing, " armv6", 7)) {
         binary->cputype = CPU_TYPE_ARM;
         binary->cpusubtype = CPU_SUBTYPE_ARM_V6;
+    } else if(!memcmp(thing, " arm64", 7)) {
+        binary->cputype = CPU_TYPE_ARM64;
+        binary->cpusubtype = CPU_SUBTYPE_ARM64_ALL;
+        binary->pointer_size = 8;
+    } else if(!memcmp(thing, "arm64e", 7)) {
+        binary->cputype = CPU_TYPE_ARM64;
+        binary->cpusubtype = CPU_SUBTYPE_ARM64E;
+        binary->pointer_size = 8;
     } else {
         die("unknown processor in magic: %.6s", thing);
     }
@@ -56,47 +70,560 @@ void b_prange_load_dyldcache(struct binary *binary, prange_t pr, const char *nam
 #undef _arg
 }
 
-void b_dyldcache_load_macho(const struct binary *binary, const char *filename, struct binary *out) {
-    if(binary == out) {
-        die("uck");
+static const char *image_path(const struct binary *binary, const struct dyld_cache_image_info *info) {
+    prange_t pr = rangeconv_off((range_t) {binary, info->pathFileOffset, 1}, MUST_FIND | EXTEND_RANGE);
+    if(strnlen(pr.start, pr.size) == pr.size) {
+        die("image path runs off the end of the cache");
     }
+    return pr.start;
+}
 
-    if(binary->dyld->hdr->imagesCount > 1000) {
+static const struct dyld_cache_image_info *image_info(const struct binary *binary, uint32_t i) {
+    if(i >= binary->dyld->hdr->imagesCount) {
+        die("no image %u", i);
+    }
+    return rangeconv_off((range_t) {binary, binary->dyld->hdr->imagesOffset + (addr_t) i * sizeof(struct dyld_cache_image_info), sizeof(struct dyld_cache_image_info)}, MUST_FIND).start;
+}
+
+static void build_image_index(const struct binary *binary) {
+    struct dyldcache_binary *dyld = binary->dyld;
+    uint32_t count = dyld->hdr->imagesCount;
+    if(count > MAX_ARRAY(struct dyld_cache_image_info) || count > MAX_ARRAY(struct binary *)) {
         die("insane images count");
     }
+    struct dyld_cache_image_info *info = rangeconv_off((range_t) {binary, dyld->hdr->imagesOffset, count * sizeof(*info)}, MUST_FIND).start;
+    strhash_init(&dyld->image_index, count);
+    dyld->images = calloc(count ? count : 1, sizeof(*dyld->images));
+    dyld->loading = calloc(count ? count : 1, sizeof(*dyld->loading));
+    for(uint32_t i = 0; i < count; i++) {
+        const char *path = image_path(binary, &info[i]);
+        // the first one wins, like it did when we searched linearly
+        strhash_insert(&dyld->image_index, path, strlen(path), i);
+    }
+}
+
+static pthread_mutex_t subcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct dyldcache_subcache *find_subcache(const struct dyldcache_binary *dyld, addr_t offset) {
+    for(uint32_t i = 0; i < dyld->nsubcaches; i++) {
+        struct dyldcache_subcache *sc = &dyld->subcaches[i];
+        if(offset - sc->offset < sc->size) return sc;
+    }
+    return NULL;
+}
 
-    struct dyld_cache_image_info *info = rangeconv_off((range_t) {binary, binary->dyld->hdr->imagesOffset, binary->dyld->hdr->imagesCount * sizeof(*info)}, MUST_FIND).start;
-    for(unsigned int i = 0; i < binary->dyld->hdr->imagesCount; i++) {
-        char *name = rangeconv_off((range_t) {binary, info[i].pathFileOffset, 128}, MUST_FIND).start;
+static void map_subcache(const struct binary *binary, struct dyldcache_subcache *sc) {
+#define _arg sc->path
+    if(sc->mapped) return;
+    pthread_mutex_lock(&subcache_lock);
+    if(!sc->mapped) {
+        int fd = open(sc->path, O_RDONLY);
+        void *p = fd == -1 ? MAP_FAILED : mmap((char *) binary->valid_range.start + sc->offset, sc->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+        if(fd != -1) close(fd);
+        if(p == MAP_FAILED) {
+            pthread_mutex_unlock(&subcache_lock);
+            edie("could not map subcache");
+        }
+        __sync_synchronize();
+        sc->mapped = true;
+    }
+    pthread_mutex_unlock(&subcache_lock);
+#undef _arg
+}
 
-        if(strncmp(name, filename, 128)) {
-            continue;
+size_t b_dyldcache_map_range(const struct binary *binary, addr_t offset, size_t size) {
+    struct dyldcache_binary *dyld = binary->dyld;
+    if(offset < dyld->main_size) {
+        if(dyld->slide) {
+            b_dyldcache_slide_range(binary, offset, size);
         }
-        // we found it
-        b_prange_load_macho(out, binary->valid_range,range_to_off_range((range_t) {binary, (uint32_t) info[i].address, 0}, MUST_FIND).start, filename);
-        
-        // look for reexports (maybe blowing the stack)
-        int count = 0;
+        return dyld->main_size - offset;
+    }
+    struct dyldcache_subcache *sc = find_subcache(dyld, offset);
+    if(!sc) return 0;
+    map_subcache(binary, sc);
+    return sc->size - (offset - sc->offset);
+}
+
+static int compare_local_entries(const void *a_, const void *b_) {
+    const struct dyld_cache_local_symbols_entry *a = a_, *b = b_;
+    return a->dylibOffset < b->dylibOffset ? -1 : a->dylibOffset > b->dylibOffset;
+}
+
+// they're either in the main cache (old caches) or at the start of the .symbols file
+static void find_local_symbols(const struct binary *binary) {
+    struct dyldcache_binary *dyld = binary->dyld;
+    dyld->looked_for_local_symbols = true;
+    const struct dyld_cache_header *hdr = dyld->hdr;
+    addr_t base = 0;
+    for(uint32_t i = 0; i < dyld->nsubcaches; i++) {
+        if(dyld->subcaches[i].symbols) {
+            hdr = dyld->subcaches[i].hdr;
+            base = dyld->subcaches[i].offset;
+        }
+    }
+    if(!DYLD_CACHE_HAS(hdr, localSymbolsSize) || !hdr->localSymbolsOffset || !hdr->localSymbolsSize) {
+        return;
+    }
+    prange_t pr = rangeconv_off((range_t) {binary, base + hdr->localSymbolsOffset, hdr->localSymbolsSize}, MUST_FIND);
+    if(pr.size < sizeof(struct dyld_cache_local_symbols_info)) {
+        die("truncated local symbols info");
+    }
+    const struct dyld_cache_local_symbols_info *info = pr.start;
+    size_t nlist_size = b_pointer_size(binary) == 8 ? sizeof(struct nlist_64) : sizeof(struct nlist);
+#define check(off, count, elsize) \
+    if((off) > pr.size || (count) > (pr.size - (off)) / (elsize)) die("local symbols table out of range (" #off ")");
+    check(info->nlistOffset, info->nlistCount, nlist_size)
+    check(info->stringsOffset, info->stringsSize, 1)
+    check(info->entriesOffset, info->entriesCount, sizeof(struct dyld_cache_local_symbols_entry))
+#undef check
+    dyld->local_nlists = (char *) pr.start + info->nlistOffset;
+    dyld->local_nlist_count = info->nlistCount;
+    dyld->local_strings = (char *) pr.start + info->stringsOffset;
+    dyld->local_strings_size = info->stringsSize;
+    dyld->local_nentries = info->entriesCount;
+    dyld->local_entries = malloc(sizeof(*dyld->local_entries) * (info->entriesCount ? info->entriesCount : 1));
+    memcpy(dyld->local_entries, (char *) pr.start + info->entriesOffset, sizeof(*dyld->local_entries) * info->entriesCount);
+    qsort(dyld->local_entries, dyld->local_nentries, sizeof(*dyld->local_entries), compare_local_entries);
+}
+
+static void attach_local_symbols(const struct binary *binary, struct binary *image, addr_t cache_offset) {
+    struct dyldcache_binary *dyld = binary->dyld;
+    if(!dyld->looked_for_local_symbols) {
+        find_local_symbols(binary);
+    }
+    uint32_t lo = 0, hi = dyld->local_nentries;
+    while(lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if(dyld->local_entries[mid].dylibOffset < cache_offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if(lo == dyld->local_nentries || dyld->local_entries[lo].dylibOffset != cache_offset) {
+        return;
+    }
+    const struct dyld_cache_local_symbols_entry *e = &dyld->local_entries[lo];
+    if(e->nlistStartIndex > dyld->local_nlist_count || e->nlistCount > dyld->local_nlist_count - e->nlistStartIndex) {
+        die("local symbols for image at %x out of range", (int) cache_offset);
+    }
+    size_t nlist_size = b_pointer_size(image) == 8 ? sizeof(struct nlist_64) : sizeof(struct nlist);
+    b_macho_attach_local_symbols(image, (const char *) dyld->local_nlists + e->nlistStartIndex * nlist_size, e->nlistCount, dyld->local_strings, dyld->local_strings_size);
+}
+
+static const struct binary *load_image(const struct binary *binary, uint32_t i, const char *filename) {
+    struct dyldcache_binary *dyld = binary->dyld;
+    if(dyld->images[i]) {
+        return dyld->images[i];
+    }
+    const struct dyld_cache_image_info *info = image_info(binary, i);
+    struct binary *out = dyld->images[i] = malloc(sizeof(*out));
+    b_init(out);
+    dyld->loading[i] = true;
+    // in a split cache, the offsets in an image's load commands are relative to the file it lives in
+    prange_t pr = binary->valid_range;
+    addr_t offset = range_to_off_range((range_t) {binary, downcast(info->address, addr_t), 0}, MUST_FIND).start;
+    addr_t cache_offset = offset;
+    if(dyld->nsubcaches && offset >= dyld->main_size) {
+        struct dyldcache_subcache *sc = find_subcache(dyld, offset);
+        if(!sc) die("image %u isn't in any file", i);
+        map_subcache(binary, sc);
+        pr = (prange_t) {(char *) pr.start + sc->offset, sc->size};
+        offset -= sc->offset;
+    } else if(dyld->nsubcaches) {
+        pr.size = dyld->main_size;
+    }
+    b_prange_load_macho(out, pr, offset, filename);
+    if(dyld->slide) {
+        b_dyldcache_slide_image(binary, out);
+    }
+    attach_local_symbols(binary, out, cache_offset);
+
+    // look for reexports; since out is already in images, a cycle ends up with a copy that doesn't have its reexports filled in yet, rather than blowing the stack.  such copies are patched below, once they are
+    int count = 0;
+    CMD_ITERATE(b_mach_hdr(out), cmd) {
+        if(cmd->cmd == LC_REEXPORT_DYLIB) count++;
+    }
+    if(count > 0 && count < 1000) {
+        struct binary *p = malloc(count * sizeof(struct binary));
         CMD_ITERATE(b_mach_hdr(out), cmd) {
-            if(cmd->cmd == LC_REEXPORT_DYLIB) count++;
-        }
-        if(count > 0 && count < 1000) {
-            out->nreexports = (unsigned int) count;
-            struct binary *p = out->reexports = malloc(out->nreexports * sizeof(struct binary));
-            CMD_ITERATE(b_mach_hdr(out), cmd) {
-                if(cmd->cmd == LC_REEXPORT_DYLIB) {
-                    const char *name = convert_lc_str(cmd, ((struct dylib_command *) cmd)->dylib.name.offset);
-                    b_dyldcache_load_macho(binary, name, p);
-                    p++;
+            if(cmd->cmd == LC_REEXPORT_DYLIB) {
+                const char *name = convert_lc_str(cmd, ((struct dylib_command *) cmd)->dylib.name.offset);
+                const struct strhash_entry *e = strhash_get(&dyld->image_index, name);
+                if(!e) {
+                    die("couldn't find %s in dyld cache", name);
                 }
+                uint32_t j = (uint32_t) e->value;
+                *p = *load_image(binary, j, name);
+                if(dyld->loading[j]) {
+                    dyld->early_copies = realloc(dyld->early_copies, (dyld->nearly_copies + 1) * sizeof(*dyld->early_copies));
+                    dyld->early_copies[dyld->nearly_copies++] = (struct dyldcache_early_copy) {j, p};
+                }
+                p++;
             }
         }
+        out->reexports = p - count;
+        out->nreexports = (unsigned int) count;
+    }
+
+    dyld->loading[i] = false;
+    for(uint32_t k = 0; k < dyld->nearly_copies;) {
+        struct dyldcache_early_copy *ec = &dyld->early_copies[k];
+        if(ec->image != i) {
+            k++;
+            continue;
+        }
+        ec->copy->reexports = out->reexports;
+        ec->copy->nreexports = out->nreexports;
+        *ec = dyld->early_copies[--dyld->nearly_copies];
+    }
+    return out;
+}
 
-        return;
+void b_dyldcache_load_macho(const struct binary *binary, const char *filename, struct binary *out) {
+    if(binary == out) {
+        die("uck");
     }
-    die("couldn't find %s in dyld cache", filename);
+
+    if(!binary->dyld->images) {
+        build_image_index(binary);
+    }
+
+    const struct strhash_entry *e = strhash_get(&binary->dyld->image_index, filename);
+    if(!e) {
+        die("couldn't find %s in dyld cache", filename);
+    }
+    *out = *load_image(binary, (uint32_t) e->value, filename);
+}
+
+static char *subcache_path(const char *filename, const char *fmt, unsigned int i) {
+    size_t len = strlen(filename) + 16;
+    char *path = malloc(len);
+    snprintf(path, len, fmt, filename, i);
+    if(access(path, F_OK)) {
+        free(path);
+        return NULL;
+    }
+    return path;
+}
+
+static size_t open_subcache(const struct binary *binary, struct dyldcache_subcache *sc) {
+#define _arg sc->path
+    int fd = open(sc->path, O_RDONLY);
+    if(fd == -1) {
+        edie("could not open");
+    }
+    off_t end = lseek(fd, 0, SEEK_END);
+    if(end < (off_t) sizeof(*sc->hdr) || (sizeof(off_t) > sizeof(size_t) && end > (off_t) SIZE_MAX)) {
+        die("bad size");
+    }
+    sc->size = (size_t) end;
+    sc->hdr = malloc(sizeof(*sc->hdr));
+    if(pread(fd, sc->hdr, sizeof(*sc->hdr), 0) != (ssize_t) sizeof(*sc->hdr)) {
+        edie("could not read header");
+    }
+    if(memcmp(sc->hdr->magic, binary->dyld->hdr->magic, sizeof(sc->hdr->magic))) {
+        die("magic doesn't match the main cache");
+    }
+    uint32_t n = sc->symbols ? 0 : sc->hdr->mappingCount;
+    if(n > 1000) {
+        die("insane mapping count: %u", n);
+    }
+    sc->mappings = malloc(n * sizeof(*sc->mappings) + 1);
+    if(pread(fd, sc->mappings, n * sizeof(*sc->mappings), sc->hdr->mappingOffset) != (ssize_t) (n * sizeof(*sc->mappings))) {
+        edie("could not read mappings");
+    }
+    for(uint32_t i = 0; i < n; i++) {
+        if(sc->mappings[i].sfm_file_offset >= sc->size || sc->mappings[i].sfm_size > sc->size - sc->mappings[i].sfm_file_offset) {
+            die("truncated (no room for dyld cache mapping %u)", i);
+        }
+    }
+    close(fd);
+    return n;
+#undef _arg
 }
 
 void b_load_dyldcache(struct binary *binary, const char *filename) {
-    return b_prange_load_dyldcache(binary, load_file(filename, true, NULL), filename);
+#define _arg filename
+    struct dyldcache_subcache *scs = NULL;
+    uint32_t nsc = 0;
+    char *path;
+    for(unsigned int i = 1; (path = subcache_path(filename, "%s.%u", i)) || (path = subcache_path(filename, "%s.%02u", i)); i++) {
+        scs = realloc(scs, ++nsc * sizeof(*scs));
+        scs[nsc - 1] = (struct dyldcache_subcache) {.path = path};
+    }
+    if((path = subcache_path(filename, "%s.symbols", 0))) {
+        scs = realloc(scs, ++nsc * sizeof(*scs));
+        scs[nsc - 1] = (struct dyldcache_subcache) {.path = path, .symbols = true};
+    }
+    if(!nsc) {
+        return b_prange_load_dyldcache(binary, load_file(filename, true, NULL), filename);
+    }
+
+    // reserve room for all the files, but only map the main one for now
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1) {
+        edie("could not open");
+    }
+    off_t end = lseek(fd, 0, SEEK_END);
+    if(sizeof(off_t) > sizeof(size_t) && end > (off_t) SIZE_MAX) {
+        die("too big: %lld", (long long) end);
+    }
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t main_size = (size_t) end, total = (main_size + page - 1) & ~(page - 1);
+    for(uint32_t i = 0; i < nsc; i++) {
+        struct stat st;
+        if(stat(scs[i].path, &st)) {
+            edie("could not stat %s", scs[i].path);
+        }
+        scs[i].offset = total;
+        if((size_t) st.st_size > SIZE_MAX - total - page) {
+            die("too big");
+        }
+        total += ((size_t) st.st_size + page - 1) & ~(page - 1);
+    }
+    char *base = mmap(NULL, total, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+    if(base == MAP_FAILED) {
+        edie("could not reserve %zu bytes", total);
+    }
+    if(main_size && mmap(base, main_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        edie("could not mmap");
+    }
+    close(fd);
+
+    b_prange_load_dyldcache(binary, (prange_t) {base, main_size}, filename);
+    struct dyldcache_binary *dyld = binary->dyld;
+    dyld->main_size = main_size;
+    dyld->subcaches = scs;
+    dyld->nsubcaches = nsc;
+
+    // the subcaches' mappings become more segments
+    for(uint32_t i = 0; i < nsc; i++) {
+        size_t n = open_subcache(binary, &scs[i]);
+        if(scs[i].size > (size_t) ((i + 1 < nsc ? scs[i + 1].offset : total) - scs[i].offset)) {
+            die("%s changed size", scs[i].path);
+        }
+        binary->segments = realloc(binary->segments, (binary->nsegments + n) * sizeof(*binary->segments));
+        for(size_t j = 0; j < n; j++) {
+            struct shared_file_mapping_np *m = &scs[i].mappings[j];
+            struct data_segment *seg = &binary->segments[binary->nsegments++];
+            seg->vm_range.binary = seg->file_range.binary = binary;
+            seg->native_segment = m;
+            seg->vm_range.start = downcast(m->sfm_address, addr_t);
+            seg->file_range.start = scs[i].offset + downcast(m->sfm_file_offset, addr_t);
+            seg->file_range.size = seg->vm_range.size = downcast(m->sfm_size, size_t);
+        }
+    }
+
+    binary->valid_range = (prange_t) {base, total};
+    binary->_map_range = b_dyldcache_map_range;
+#undef _arg
+}
+
+uint32_t b_dyldcache_image_count(const struct binary *binary) {
+    return binary->dyld->hdr->imagesCount;
+}
+
+const char *b_dyldcache_image_path(const struct binary *binary, uint32_t image) {
+    return image_path(binary, image_info(binary, image));
+}
+
+// the UUID with the size mixed in, or for headers too old to have a UUID, a hash of everything that describes the layout
+static void cache_key(const struct binary *binary, uint8_t key[16]) {
+    const struct dyld_cache_header *hdr = binary->dyld->hdr;
+    if(DYLD_CACHE_HAS(hdr, uuid)) {
+        uint64_t k[2];
+        memcpy(k, hdr->uuid, 16);
+        k[1] ^= binary->valid_range.size;
+        memcpy(key, k, 16);
+        return;
+    }
+    prange_t parts[] = {
+        {(void *) hdr, sizeof(*hdr)},
+        rangeconv_off((range_t) {binary, hdr->mappingOffset, hdr->mappingCount * sizeof(struct shared_file_mapping_np)}, MUST_FIND),
+        rangeconv_off((range_t) {binary, hdr->imagesOffset, hdr->imagesCount * sizeof(struct dyld_cache_image_info)}, MUST_FIND),
+    };
+    uint64_t h[2] = {14695981039346656037ull, binary->valid_range.size};
+    for(size_t i = 0; i < sizeof(parts) / sizeof(*parts); i++) {
+        const uint8_t *p = parts[i].start;
+        for(size_t j = 0; j < parts[i].size; j++) {
+            h[0] = (h[0] ^ p[j]) * 1099511628211ull;
+            h[1] = (h[1] ^ p[j]) * 1099511628211ull + j;
+        }
+    }
+    memcpy(key, h, 16);
+}
+
+struct image_exports {
+    struct data_sym *syms;
+    uint32_t nsyms;
+};
+
+struct collect_ctx {
+    const struct binary *binary;
+    struct image_exports *images;
+};
+
+static bool append_export(void *context, const struct data_sym *sym) {
+    struct data_sym **s = context;
+    *(*s)++ = *sym;
+    return true;
+}
+
+static void collect_exports(void *ctx_, size_t i) {
+    struct collect_ctx *ctx = ctx_;
+    // each image is only touched by one thread, and we never follow reexports, so the lazily built caches are safe
+    const struct binary *image = ctx->binary->dyld->images[i];
+    struct image_exports *ie = &ctx->images[i];
+    if(image->mach->export_trie.start) {
+        const struct export_table *et = b_macho_export_table(image);
+        struct data_sym *s = ie->syms = malloc(sizeof(*s) * (et->nexports ? et->nexports : 1));
+        for(uint32_t j = 0; j < et->nexports; j++) {
+            const struct macho_export *ex = &et->exports[j];
+            // reexports get picked up from the image that defines them; resolvers have no address
+            if(ex->flags & (EXPORT_SYMBOL_FLAGS_INDIRECT_DEFINITION | 0x10)) continue;
+            *s++ = (struct data_sym) {ex->name, ex->address};
+        }
+        ie->nsyms = s - ie->syms;
+    } else {
+        struct data_sym *s = ie->syms = malloc(sizeof(*s) * (image->mach->ext_nsyms ? image->mach->ext_nsyms : 1));
+        struct data_sym *p = s;
+        b_macho_each_sym(image, TO_EXECUTE, append_export, &p);
+        ie->nsyms = p - s;
+    }
+}
+
+static void set_symtab_pointers(struct dyldcache_symtab *symtab) {
+    const struct dyldcache_symtab_header *hdr = symtab->hdr = symtab->storage.start;
+    symtab->slots = (const void *) (hdr + 1);
+    symtab->entries = (const void *) (symtab->slots + hdr->nslots);
+    symtab->strings = (const void *) (symtab->entries + hdr->nentries);
+}
+
+void b_dyldcache_build_symtab(const struct binary *binary, struct dyldcache_symtab *symtab) {
+    uint32_t count = b_dyldcache_image_count(binary);
+    struct binary tmp;
+    for(uint32_t i = 0; i < count; i++) {
+        if(!binary->dyld->images || !binary->dyld->images[i]) {
+            b_dyldcache_load_macho(binary, b_dyldcache_image_path(binary, i), &tmp);
+        }
+    }
+
+    struct collect_ctx ctx = {binary, calloc(count ? count : 1, sizeof(struct image_exports))};
+    parallel_for(count, collect_exports, &ctx);
+
+    // dedupe, lowest image first
+    struct strhash names;
+    uint32_t total = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        if(ctx.images[i].nsyms > UINT32_MAX / 2 - total) die("too many symbols");
+        total += ctx.images[i].nsyms;
+    }
+    strhash_init(&names, total);
+    size_t strings_size = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        for(uint32_t j = 0; j < ctx.images[i].nsyms; j++) {
+            const struct data_sym *ds = &ctx.images[i].syms[j];
+            size_t len = strlen(ds->name);
+            if(strhash_insert(&names, ds->name, len, (uint64_t) i << 32 | j)) {
+                strings_size += len + 1;
+            }
+        }
+    }
+    if(strings_size > UINT32_MAX) die("too many strings");
+
+    uint32_t nentries = names.count;
+    uint32_t nslots = 16;
+    while(nslots / 2 < nentries) nslots *= 2;
+    size_t size = sizeof(struct dyldcache_symtab_header) + nslots * sizeof(uint32_t) + nentries * sizeof(struct dyldcache_symtab_entry) + strings_size;
+    symtab->storage = (prange_t) {calloc(1, size), size};
+    symtab->mapped = false;
+    struct dyldcache_symtab_header *hdr = symtab->storage.start;
+    memcpy(hdr->magic, "dcsymtb1", 8);
+    cache_key(binary, hdr->key);
+    hdr->nentries = nentries;
+    hdr->nslots = nslots;
+    hdr->strings_size = (uint32_t) strings_size;
+    set_symtab_pointers(symtab);
+
+    uint32_t *slots = (uint32_t *) symtab->slots;
+    struct dyldcache_symtab_entry *entry = (struct dyldcache_symtab_entry *) symtab->entries;
+    char *strings = (char *) symtab->strings, *str = strings;
+    for(uint32_t k = 0; k <= names.mask; k++) {
+        const struct strhash_entry *e = &names.entries[k];
+        if(!e->key) continue;
+        uint32_t i = e->value >> 32, j = (uint32_t) e->value;
+        memcpy(str, e->key, e->len + 1);
+        *entry = (struct dyldcache_symtab_entry) {(uint32_t) (str - strings), e->hash, i, 0, ctx.images[i].syms[j].address};
+        str += e->len + 1;
+        uint32_t slot = e->hash & (nslots - 1);
+        while(slots[slot]) slot = (slot + 1) & (nslots - 1);
+        slots[slot] = (uint32_t) (entry - symtab->entries) + 1;
+        entry++;
+    }
+
+    strhash_free(&names);
+    for(uint32_t i = 0; i < count; i++) {
+        free(ctx.images[i].syms);
+    }
+    free(ctx.images);
+}
+
+void b_dyldcache_store_symtab(const struct dyldcache_symtab *symtab, const char *path) {
+    store_file(symtab->storage, path, 0644);
+}
+
+bool b_dyldcache_load_symtab(const struct binary *binary, struct dyldcache_symtab *symtab, const char *path) {
+#define _arg path
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) {
+        if(errno == ENOENT) return false;
+        edie("could not open");
+    }
+    prange_t pr = load_fd(fd, false);
+    close(fd);
+    const struct dyldcache_symtab_header *hdr = pr.start;
+    uint8_t key[16];
+    cache_key(binary, key);
+    if(pr.size < sizeof(*hdr) || memcmp(hdr->magic, "dcsymtb1", 8) || memcmp(hdr->key, key, 16)) {
+        munmap(pr.start, pr.size);
+        return false;
+    }
+    if(!hdr->nslots || (hdr->nslots & (hdr->nslots - 1)) || hdr->nslots / 2 < hdr->nentries ||
+       (uint64_t) hdr->nslots * sizeof(uint32_t) + (uint64_t) hdr->nentries * sizeof(struct dyldcache_symtab_entry) + hdr->strings_size != pr.size - sizeof(*hdr) ||
+       (hdr->strings_size && ((char *) pr.start)[pr.size - 1])) {
+        die("corrupt symbol table");
+    }
+    symtab->storage = pr;
+    symtab->mapped = true;
+    set_symtab_pointers(symtab);
+    return true;
+#undef _arg
+}
+
+void b_dyldcache_free_symtab(struct dyldcache_symtab *symtab) {
+    if(symtab->mapped) {
+        munmap(symtab->storage.start, symtab->storage.size);
+    } else {
+        free(symtab->storage.start);
+    }
+    memset(symtab, 0, sizeof(*symtab));
+}
+
+const struct dyldcache_symtab_entry *b_dyldcache_symtab_lookup(const struct dyldcache_symtab *symtab, const char *name) {
+    uint32_t hash = strhash_hash(name, strlen(name));
+    uint32_t mask = symtab->hdr->nslots - 1;
+    // a sidecar might be garbage, so don't trust it to have empty slots
+    for(uint32_t slot = hash & mask, n = 0; symtab->slots[slot] && n <= mask; slot = (slot + 1) & mask, n++) {
+        uint32_t idx = symtab->slots[slot] - 1;
+        const struct dyldcache_symtab_entry *e = &symtab->entries[idx];
+        if(idx >= symtab->hdr->nentries || e->name >= symtab->hdr->strings_size) {
+            die("corrupt symbol table (slot %u)", slot);
+        }
+        if(e->hash == hash && !strcmp(symtab->strings + e->name, name)) {
+            return e;
+        }
+    }
+    return NULL;
 }
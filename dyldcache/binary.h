@@ -1,19 +1,102 @@
 #pragma once
 #include "../binary.h"
 #include "../mach-o/binary.h"
+#include "../strhash.h"
+
+// an extra file of a split cache (foo.1, foo.2, ..., foo.symbols).  each one gets its own window of binary->valid_range, which is only mapped in the first time something in it is rangeconv'd.
+struct dyldcache_subcache {
+    char *path;
+    addr_t offset; // where the window starts in valid_range
+    size_t size;
+    bool mapped;
+    bool symbols; // the .symbols file, whose mappings (if any) aren't part of the address space
+    struct dyld_cache_header *hdr; // a copy
+    struct shared_file_mapping_np *mappings; // ditto
+};
 
 struct dyldcache_binary {
     struct dyld_cache_header *hdr;
     struct shared_file_mapping_np *mappings;
     uint32_t nmappings;
     struct shared_file_mapping_np *last_sfm;
+
+    // built on first use by b_dyldcache_load_macho
+    struct strhash image_index; // path -> image number
+    struct binary **images; // loaded images, NULL if not loaded yet
+    bool *loading; // images whose reexports are still being loaded
+    // in a reexport cycle, copies of an image taken before its reexports were filled in; they get patched when it finishes
+    struct dyldcache_early_copy {
+        uint32_t image;
+        struct binary *copy;
+    } *early_copies;
+    uint32_t nearly_copies;
+
+    // set for split caches and by b_dyldcache_slide_lazily
+    size_t main_size;
+    struct dyldcache_subcache *subcaches;
+    uint32_t nsubcaches;
+
+    struct dyldcache_slide *slide; // see b_dyldcache_slide_lazily
+
+    // the unmapped local symbols, found when the first image is loaded
+    bool looked_for_local_symbols;
+    const void *local_nlists;
+    uint32_t local_nlist_count;
+    const char *local_strings;
+    uint32_t local_strings_size;
+    struct dyld_cache_local_symbols_entry *local_entries; // a copy, sorted by dylibOffset
+    uint32_t local_nentries;
+};
+
+// a cache-wide table of exported symbols, name -> (image number, address).  where several images export the same name, the lowest-numbered image wins.  the in-memory layout is exactly the sidecar file layout, so a stored table can just be mapped back in.
+struct dyldcache_symtab_header {
+    char magic[8];
+    uint8_t key[16]; // identifies the cache this was built from
+    uint32_t nentries;
+    uint32_t nslots; // a power of two
+    uint32_t strings_size;
+    uint32_t reserved;
+    // then uint32_t slots[nslots] (entry number + 1, or 0), entries[nentries], strings
+};
+
+struct dyldcache_symtab_entry {
+    uint32_t name; // offset into strings
+    uint32_t hash; // strhash_hash of the name
+    uint32_t image;
+    uint32_t reserved;
+    uint64_t address; // |1 if it is a thumb symbol
+};
+
+struct dyldcache_symtab {
+    prange_t storage;
+    bool mapped;
+    const struct dyldcache_symtab_header *hdr;
+    const uint32_t *slots;
+    const struct dyldcache_symtab_entry *entries;
+    const char *strings;
 };
 
 __BEGIN_DECLS
 
 void b_prange_load_dyldcache(struct binary *binary, prange_t range, const char *name);
+// out gets a shallow copy of an image that is loaded at most once per cache, so it (and its reexports) share the parsed state and symbol caches with every other copy.  the image's local symbols (from the cache's local symbols region or the .symbols file) are attached to it, so b_sym(..., PRIVATE_SYM) finds them
 void b_dyldcache_load_macho(const struct binary *binary, const char *filename, struct binary *out);
 
+uint32_t b_dyldcache_image_count(const struct binary *binary);
+const char *b_dyldcache_image_path(const struct binary *binary, uint32_t image);
+
+// loads every image (see b_dyldcache_load_macho) and collects their exports in parallel.  the images keep the export tables this builds; b_macho_forget_caches on them gives the memory back once nothing points into their caches
+void b_dyldcache_build_symtab(const struct binary *binary, struct dyldcache_symtab *symtab);
+void b_dyldcache_store_symtab(const struct dyldcache_symtab *symtab, const char *path);
+// returns false if there is no sidecar at path or it was built from a different cache
+bool b_dyldcache_load_symtab(const struct binary *binary, struct dyldcache_symtab *symtab, const char *path);
+void b_dyldcache_free_symtab(struct dyldcache_symtab *symtab);
+const struct dyldcache_symtab_entry *b_dyldcache_symtab_lookup(const struct dyldcache_symtab *symtab, const char *name);
+
+// the _map_range hook for caches
+size_t b_dyldcache_map_range(const struct binary *binary, addr_t offset, size_t size);
+
+// also picks up filename.1, filename.2, ... (or .01, ...) and filename.symbols if they exist
 void b_load_dyldcache(struct binary *binary, const char *filename);
 
 
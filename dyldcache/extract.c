@@ -0,0 +1,247 @@
+#include "extract.h"
+#include "../mach-o/headers/loader.h"
+#include "../mach-o/headers/nlist.h"
+#include "../strpool.h"
+
+#define PAGE 0x1000
+#define round_page(x) (((x) + PAGE - 1) & ~(uint64_t) (PAGE - 1))
+
+struct linkedit {
+    char *buf;
+    size_t size, cap;
+};
+
+// makes room for size bytes; returns where they go
+static uint32_t le_reserve(struct linkedit *le, size_t size, size_t align) {
+    size_t start = (le->size + align - 1) & ~(align - 1);
+    if(size > UINT32_MAX - start) {
+        die("linkedit too big");
+    }
+    if(start + size > le->cap) {
+        le->cap = (start + size) * 2;
+        le->buf = realloc(le->buf, le->cap);
+    }
+    memset(le->buf + le->size, 0, start - le->size);
+    le->size = start + size;
+    return (uint32_t) start;
+}
+
+static uint32_t le_append(struct linkedit *le, const void *data, size_t size, size_t align) {
+    uint32_t start = le_reserve(le, size, align);
+    memcpy(le->buf + start, data, size);
+    return start;
+}
+
+// copies a blob out of the cache's linkedit; returns the new file offset
+static uint32_t copy_blob(const struct binary *image, struct linkedit *le, uint64_t base, uint32_t off, uint32_t size, size_t align) {
+    if(!size) return 0;
+    const void *data = rangeconv_off((range_t) {image, off, size}, MUST_FIND).start;
+    uint64_t result = base + le_append(le, data, size, align);
+    if(result > UINT32_MAX) die("file too big");
+    return (uint32_t) result;
+}
+
+static void put(int fd, const void *buf, size_t size, const char *path) {
+#define _arg path
+    while(size) {
+        ssize_t written = write(fd, buf, size);
+        if(written <= 0) {
+            edie("could not write");
+        }
+        buf = (const char *) buf + written;
+        size -= (size_t) written;
+    }
+#undef _arg
+}
+
+static void pad_to(int fd, uint64_t *pos, uint64_t to, const char *path) {
+    static const char zeroes[PAGE];
+    while(*pos < to) {
+        size_t n = to - *pos > PAGE ? PAGE : (size_t) (to - *pos);
+        put(fd, zeroes, n, path);
+        *pos += n;
+    }
+}
+
+static void extract_image(const struct binary *image, const char *path) {
+#define _arg path
+    const struct mach_header *hdr = b_mach_hdr(image);
+    size_t hdrsize = (hdr->magic & 1 ? sizeof(struct mach_header_64) : sizeof(struct mach_header)) + hdr->sizeofcmds;
+    struct mach_header *nhdr = malloc(hdrsize);
+    memcpy(nhdr, rangeconv_off((range_t) {image, 0, hdrsize}, MUST_FIND).start, hdrsize);
+
+    // lay out everything but __LINKEDIT back to back
+    uint64_t off = 0;
+    struct load_command *linkedit_cmd = NULL;
+    CMD_ITERATE(nhdr, cmd) {
+        MACHO_SPECIALIZE(
+            if(cmd->cmd == LC_SEGMENT_X) {
+                segment_command_x *seg = (void *) cmd;
+                if(!strncmp(seg->segname, "__LINKEDIT", 16)) {
+                    linkedit_cmd = cmd;
+                    continue;
+                }
+                if(seg->filesize && off == 0 && seg->filesize < hdrsize) {
+                    die("first segment doesn't have room for the load commands");
+                }
+                seg->fileoff = off;
+                section_x *sect = (void *) (seg + 1);
+                for(uint32_t i = 0; i < seg->nsects; i++, sect++) {
+                    uint8_t type = sect->flags & SECTION_TYPE;
+                    if(type != S_ZEROFILL && type != S_GB_ZEROFILL) {
+                        sect->offset = (uint32_t) (off + (sect->addr - seg->vmaddr));
+                    }
+                    sect->reloff = 0;
+                    sect->nreloc = 0;
+                }
+                off += round_page(seg->filesize);
+            }
+        )
+    }
+    if(!linkedit_cmd) {
+        die("no __LINKEDIT");
+    }
+    uint64_t base = off;
+
+    // rebuild __LINKEDIT with only what this image needs
+    struct linkedit le = {NULL, 0, 0};
+    struct symtab_command *symtab = NULL;
+    uint8_t ps = b_pointer_size(image);
+    CMD_ITERATE(nhdr, cmd) {
+        switch(cmd->cmd) {
+        case LC_DYLD_INFO:
+        case LC_DYLD_INFO_ONLY: {
+            struct dyld_info_command *dc = (void *) cmd;
+            dc->rebase_off = copy_blob(image, &le, base, dc->rebase_off, dc->rebase_size, 1);
+            dc->bind_off = copy_blob(image, &le, base, dc->bind_off, dc->bind_size, 1);
+            dc->weak_bind_off = copy_blob(image, &le, base, dc->weak_bind_off, dc->weak_bind_size, 1);
+            dc->lazy_bind_off = copy_blob(image, &le, base, dc->lazy_bind_off, dc->lazy_bind_size, 1);
+            dc->export_off = copy_blob(image, &le, base, dc->export_off, dc->export_size, 1);
+            break;
+        }
+        case LC_CODE_SIGNATURE:
+        case LC_SEGMENT_SPLIT_INFO:
+        case LC_FUNCTION_STARTS:
+        case LC_DATA_IN_CODE:
+        case LC_DYLIB_CODE_SIGN_DRS: {
+            struct linkedit_data_command *lc = (void *) cmd;
+            lc->dataoff = copy_blob(image, &le, base, lc->dataoff, lc->datasize, ps);
+            break;
+        }
+        case LC_SYMTAB: {
+            symtab = (void *) cmd;
+            size_t size = symtab->nsyms * (ps == 8 ? sizeof(struct nlist_64) : sizeof(struct nlist));
+            symtab->symoff = copy_blob(image, &le, base, symtab->symoff, (uint32_t) size, ps);
+            break;
+        }
+        case LC_DYSYMTAB: {
+            struct dysymtab_command *dc = (void *) cmd;
+            dc->indirectsymoff = copy_blob(image, &le, base, dc->indirectsymoff, dc->nindirectsyms * sizeof(uint32_t), 4);
+            // caches don't have any of these
+            dc->tocoff = dc->ntoc = 0;
+            dc->modtaboff = dc->nmodtab = 0;
+            dc->extrefsymoff = dc->nextrefsyms = 0;
+            dc->extreloff = dc->nextrel = 0;
+            dc->locreloff = dc->nlocrel = 0;
+            break;
+        }
+        }
+    }
+
+    // the cache's string table is shared by every image, so only take the strings our symbols use, and each of those once
+    if(symtab && symtab->nsyms) {
+        const char *strtab = image->mach->strtab;
+        uint32_t strsize = image->mach->strsize;
+        size_t stride = ps == 8 ? sizeof(struct nlist_64) : sizeof(struct nlist);
+        struct strpool pool;
+        strpool_init(&pool, symtab->nsyms);
+        // n_strx comes first in both nlist and nlist_64
+        for(uint32_t i = 0; i < symtab->nsyms; i++) {
+            uint32_t strx;
+            memcpy(&strx, le.buf + (symtab->symoff - base) + i * stride, sizeof(strx));
+            if(!strx) continue;
+            if(strx >= strsize) {
+                die("insane strx: %u", strx);
+            }
+            strpool_add(&pool, strtab + strx);
+        }
+        uint32_t size = strpool_layout(&pool, ps);
+        uint32_t strbase = le_reserve(&le, size, 1);
+        strpool_write(&pool, le.buf + strbase);
+        for(uint32_t i = 0; i < symtab->nsyms; i++) {
+            char *at = le.buf + (symtab->symoff - base) + i * stride;
+            uint32_t strx;
+            memcpy(&strx, at, sizeof(strx));
+            if(!strx) continue;
+            strx = strpool_offset(&pool, strtab + strx);
+            memcpy(at, &strx, sizeof(strx));
+        }
+        strpool_free(&pool);
+        symtab->stroff = (uint32_t) (base + strbase);
+        symtab->strsize = size;
+    } else if(symtab) {
+        symtab->stroff = symtab->strsize = 0;
+    }
+
+    MACHO_SPECIALIZE(
+        if(linkedit_cmd->cmd == LC_SEGMENT_X) {
+            segment_command_x *seg = (void *) linkedit_cmd;
+            seg->fileoff = base;
+            seg->filesize = le.size;
+            seg->vmsize = round_page(le.size);
+        }
+    )
+
+    // now stream it out
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+    if(fd == -1) {
+        edie("could not open");
+    }
+    uint64_t pos = 0;
+    CMD_ITERATE(nhdr, cmd) {
+        MACHO_SPECIALIZE(
+            if(cmd->cmd == LC_SEGMENT_X && cmd != linkedit_cmd && ((segment_command_x *) cmd)->filesize) {
+                segment_command_x *seg = (void *) cmd;
+                const char *data = rangeconv((range_t) {image, seg->vmaddr, seg->filesize}, MUST_FIND).start;
+                size_t skip = 0;
+                pad_to(fd, &pos, seg->fileoff, path);
+                if(seg->fileoff == 0) {
+                    put(fd, nhdr, hdrsize, path);
+                    skip = hdrsize;
+                }
+                put(fd, data + skip, seg->filesize - skip, path);
+                pos += seg->filesize;
+            }
+        )
+    }
+    pad_to(fd, &pos, base, path);
+    put(fd, le.buf, le.size, path);
+    close(fd);
+    free(le.buf);
+    free(nhdr);
+#undef _arg
+}
+
+void b_dyldcache_extract(const struct binary *binary, const char *image, const char *path) {
+    b_dyldcache_extract_many(binary, &image, &path, 1);
+}
+
+struct extract_ctx {
+    struct binary *images;
+    const char **paths;
+};
+
+static void extract_one(void *ctx_, size_t i) {
+    struct extract_ctx *ctx = ctx_;
+    extract_image(&ctx->images[i], ctx->paths[i]);
+}
+
+void b_dyldcache_extract_many(const struct binary *binary, const char **images, const char **paths, uint32_t count) {
+    // loading isn't thread safe, but once loaded, every image only reads from the cache
+    struct extract_ctx ctx = {malloc(sizeof(struct binary) * (count ? count : 1)), paths};
+    for(uint32_t i = 0; i < count; i++) {
+        b_dyldcache_load_macho(binary, images[i], &ctx.images[i]);
+    }
+    parallel_for(count, extract_one, &ctx);
+    free(ctx.images);
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include "binary.h"
+
+__BEGIN_DECLS
+
+// writes image out as a standalone Mach-O: the segments get packed file offsets, and __LINKEDIT is rebuilt with just the image's own symbols, strings, indirect symbols and dyld info
+void b_dyldcache_extract(const struct binary *binary, const char *image, const char *path);
+// the same for count images at once, in parallel
+void b_dyldcache_extract_many(const struct binary *binary, const char **images, const char **paths, uint32_t count);
+
+__END_DECLS
@@ -21,6 +21,8 @@
  * @APPLE_LICENSE_HEADER_END@
  */
 
+#include <stddef.h>
+
 struct shared_file_mapping_np {
     uint64_t       sfm_address;
     uint64_t       sfm_size;
@@ -29,7 +31,7 @@ struct shared_file_mapping_np {
     int            sfm_init_prot;
 };
 
-// v1 apparently has some extra gunk at the end, oh well
+// the fields after dyldBaseAddress are only there if mappingOffset is past them
 struct dyld_cache_header
 {
 	char		magic[16];				// e.g. "dyld_v0     ppc"
@@ -38,8 +40,17 @@ struct dyld_cache_header
 	uint32_t	imagesOffset;			// file offset to first dyld_cache_image_info
 	uint32_t	imagesCount;			// number of dyld_cache_image_info entries
 	uint64_t	dyldBaseAddress;		// base address of dyld when cache was built
+	uint64_t	codeSignatureOffset;	// file offset of code signature blob
+	uint64_t	codeSignatureSize;		// size of code signature blob (zero means to end of file)
+	uint64_t	slideInfoOffset;		// file offset of kernel slid info
+	uint64_t	slideInfoSize;			// size of kernel slid info
+	uint64_t	localSymbolsOffset;		// file offset of where local symbols are stored
+	uint64_t	localSymbolsSize;		// size of local symbols information
+	uint8_t		uuid[16];				// unique value for each shared cache file
 };
 
+#define DYLD_CACHE_HAS(hdr, field) ((hdr)->mappingOffset >= offsetof(struct dyld_cache_header, field) + sizeof((hdr)->field))
+
 struct dyld_cache_image_info
 {
 	uint64_t	address;
@@ -49,4 +60,73 @@ struct dyld_cache_image_info
 	uint32_t	pad;
 };
 
+struct dyld_cache_local_symbols_info
+{
+	uint32_t	nlistOffset;		// offset into this chunk of nlist entries
+	uint32_t	nlistCount;			// count of nlist entries
+	uint32_t	stringsOffset;		// offset into this chunk of string pool
+	uint32_t	stringsSize;		// byte count of string pool
+	uint32_t	entriesOffset;		// offset into this chunk of array of dyld_cache_local_symbols_entry
+	uint32_t	entriesCount;		// number of elements in dyld_cache_local_symbols_entry array
+};
+
+struct dyld_cache_local_symbols_entry
+{
+	uint32_t	dylibOffset;		// offset in cache file of start of dylib
+	uint32_t	nlistStartIndex;	// start index of locals for this dylib
+	uint32_t	nlistCount;			// number of local symbols for this dylib
+};
+
+// The rebasing info is to allow the kernel to lazily rebase DATA pages of the
+// dyld shared cache.  Rebasing is adding the slide to interior pointers.
+struct dyld_cache_slide_info
+{
+	uint32_t	version;		// currently 1
+	uint32_t	toc_offset;
+	uint32_t	toc_count;
+	uint32_t	entries_offset;
+	uint32_t	entries_count;
+	uint32_t	entries_size;  // currently 128
+	// uint16_t toc[toc_count];
+	// entrybitmap entries[entries_count];
+};
+
+// The version 2 slide info uses a different compression scheme. Since
+// only interior pointers (pointers that point within the cache) are rebased
+// (slid), we know the possible range of the pointers and thus know there are
+// unused bits in each pointer.  We use those bits to form a linked list of
+// locations needing rebasing in each page.
+struct dyld_cache_slide_info2
+{
+	uint32_t	version;			// currently 2
+	uint32_t	page_size;			// currently 4096 (may also be 16384)
+	uint32_t	page_starts_offset;
+	uint32_t	page_starts_count;
+	uint32_t	page_extras_offset;
+	uint32_t	page_extras_count;
+	uint64_t	delta_mask;			// which (contiguous) set of bits contains the delta to the next rebase location
+	uint64_t	value_add;
+	//uint16_t	page_starts[page_starts_count];
+	//uint16_t	page_extras[page_extras_count];
+};
+#define DYLD_CACHE_SLIDE_PAGE_ATTRS				0xC000	// high bits of uint16_t are flags
+#define DYLD_CACHE_SLIDE_PAGE_ATTR_EXTRA		0x8000	// index is into extras array (not starts array)
+#define DYLD_CACHE_SLIDE_PAGE_ATTR_NO_REBASE	0x4000	// page has no rebasing
+#define DYLD_CACHE_SLIDE_PAGE_ATTR_END			0x8000	// last chain entry for page
+
+// The version 3 of the slide info uses a different compression scheme. Since
+// only interior pointers (pointers that point within the cache) are rebased
+// (slid), we know the possible range of the pointers and thus know there are
+// unused bits in each pointer.  We use those bits to form a linked list of
+// locations needing rebasing in each page.
+struct dyld_cache_slide_info3
+{
+	uint32_t	version;			// currently 3
+	uint32_t	page_size;			// currently 4096 (may also be 16384)
+	uint32_t	page_starts_count;
+	uint64_t	auth_value_add;
+	uint16_t	page_starts[/* page_starts_count */];
+};
+#define DYLD_CACHE_SLIDE_V3_PAGE_ATTR_NO_REBASE	0xFFFF	// page has no rebasing
+
 
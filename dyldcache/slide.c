@@ -0,0 +1,269 @@
+#include "slide.h"
+#include "headers/dyld_cache_format.h"
+#include <pthread.h>
+
+struct dyldcache_slide {
+    addr_t slide;
+    uint32_t version;
+    const void *info;
+    size_t info_size;
+    addr_t data_offset; // of the slid mapping
+    size_t data_size;
+    uint32_t page_size;
+    uint32_t npages; // that have slide info
+    uint8_t pointer_size;
+    uint8_t *done; // only for lazy sliding
+};
+
+static pthread_mutex_t slide_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void check_table(const struct dyldcache_slide *s, uint64_t offset, uint64_t count, size_t size) {
+    if(offset > s->info_size || count > (s->info_size - offset) / size) {
+        die("slide info table (%llx, %llx) out of range", (long long) offset, (long long) count);
+    }
+}
+
+static void parse_slide_info(const struct binary *binary, struct dyldcache_slide *s, addr_t slide) {
+    const struct dyld_cache_header *hdr = binary->dyld->hdr;
+    if(!DYLD_CACHE_HAS(hdr, slideInfoSize) || !hdr->slideInfoOffset || !hdr->slideInfoSize) {
+        die("cache has no slide info");
+    }
+    if(binary->dyld->hdr->mappingCount < 2) {
+        die("cache has no data mapping to slide");
+    }
+    prange_t pr = rangeconv_off((range_t) {binary, hdr->slideInfoOffset, hdr->slideInfoSize}, MUST_FIND);
+    memset(s, 0, sizeof(*s));
+    s->slide = slide;
+    s->info = pr.start;
+    s->info_size = pr.size;
+    s->data_offset = binary->segments[1].file_range.start;
+    s->data_size = binary->segments[1].file_range.size;
+    s->pointer_size = b_pointer_size(binary);
+    if(pr.size < sizeof(uint32_t)) {
+        die("truncated slide info");
+    }
+    s->version = *(uint32_t *) pr.start;
+    switch(s->version) {
+    case 1: {
+        const struct dyld_cache_slide_info *info = pr.start;
+        check_table(s, 0, 1, sizeof(*info));
+        check_table(s, info->toc_offset, info->toc_count, sizeof(uint16_t));
+        check_table(s, info->entries_offset, info->entries_count, info->entries_size ? info->entries_size : 1);
+        // one bit per 32-bit word
+        s->page_size = info->entries_size * 8 * 4;
+        s->npages = info->toc_count;
+        const uint16_t *toc = (const void *) ((char *) pr.start + info->toc_offset);
+        for(uint32_t i = 0; i < info->toc_count; i++) {
+            if(toc[i] >= info->entries_count) die("bad slide info toc entry %u", i);
+        }
+        break;
+    }
+    case 2: {
+        const struct dyld_cache_slide_info2 *info = pr.start;
+        check_table(s, 0, 1, sizeof(*info));
+        check_table(s, info->page_starts_offset, info->page_starts_count, sizeof(uint16_t));
+        check_table(s, info->page_extras_offset, info->page_extras_count, sizeof(uint16_t));
+        if(!info->delta_mask) die("no delta mask");
+        s->page_size = info->page_size;
+        s->npages = info->page_starts_count;
+        break;
+    }
+    case 3: {
+        const struct dyld_cache_slide_info3 *info = pr.start;
+        check_table(s, 0, 1, sizeof(*info));
+        check_table(s, sizeof(*info), info->page_starts_count, sizeof(uint16_t));
+        s->page_size = info->page_size;
+        s->npages = info->page_starts_count;
+        s->pointer_size = 8;
+        break;
+    }
+    default:
+        die("unknown slide info version %u", s->version);
+    }
+    if(!s->page_size || (s->page_size & 3)) {
+        die("bad slide page size %u", s->page_size);
+    }
+    if(s->npages > (s->data_size + s->page_size - 1) / s->page_size) {
+        die("slide info covers more pages (%u) than the data mapping has", s->npages);
+    }
+}
+
+static inline addr_t read_ptr(const char *p, uint8_t pointer_size) {
+    return pointer_size == 4 ? *(uint32_t *) p : *(uint64_t *) p;
+}
+
+static inline void write_ptr(char *p, uint64_t value, uint8_t pointer_size) {
+    if(pointer_size == 4) {
+        *(uint32_t *) p = (uint32_t) value;
+    } else {
+        *(uint64_t *) p = value;
+    }
+}
+
+static void rebase_chain2(const struct dyldcache_slide *s, const struct dyld_cache_slide_info2 *info, char *page, size_t page_size, uint32_t offset) {
+    uint64_t delta_mask = info->delta_mask, value_mask = ~delta_mask;
+    int delta_shift = __builtin_ctzll(delta_mask) - 2;
+    uint64_t delta = 1;
+    while(delta) {
+        if(offset > page_size - s->pointer_size) {
+            die("slide chain runs off the page");
+        }
+        char *loc = page + offset;
+        uint64_t raw = read_ptr(loc, s->pointer_size);
+        delta = (raw & delta_mask) >> delta_shift;
+        uint64_t value = raw & value_mask;
+        if(value) {
+            value += info->value_add + s->slide;
+        }
+        write_ptr(loc, value, s->pointer_size);
+        offset += delta;
+    }
+}
+
+static void slide_page(const struct dyldcache_slide *s, char *data, uint32_t i) {
+    char *page = data + (size_t) i * s->page_size;
+    size_t page_size = s->data_size - (size_t) i * s->page_size;
+    if(page_size > s->page_size) page_size = s->page_size;
+    const char *base = s->info;
+    switch(s->version) {
+    case 1: {
+        const struct dyld_cache_slide_info *info = s->info;
+        const uint16_t *toc = (const void *) (base + info->toc_offset);
+        const uint8_t *bits = (const void *) (base + info->entries_offset + (size_t) toc[i] * info->entries_size);
+        for(uint32_t j = 0; j < info->entries_size; j++) {
+            if(!bits[j]) continue;
+            for(int k = 0; k < 8; k++) {
+                if(!(bits[j] & (1 << k))) continue;
+                size_t offset = (j * 8 + k) * 4;
+                if(offset > page_size - 4) die("slide info points off the page");
+                *(uint32_t *) (page + offset) += (uint32_t) s->slide;
+            }
+        }
+        break;
+    }
+    case 2: {
+        const struct dyld_cache_slide_info2 *info = s->info;
+        const uint16_t *starts = (const void *) (base + info->page_starts_offset);
+        const uint16_t *extras = (const void *) (base + info->page_extras_offset);
+        uint16_t start = starts[i];
+        if(start == DYLD_CACHE_SLIDE_PAGE_ATTR_NO_REBASE) {
+            break;
+        } else if(start & DYLD_CACHE_SLIDE_PAGE_ATTR_EXTRA) {
+            for(uint32_t j = start & ~DYLD_CACHE_SLIDE_PAGE_ATTRS; ; j++) {
+                if(j >= info->page_extras_count) die("slide info extras run off the end");
+                uint16_t extra = extras[j];
+                rebase_chain2(s, info, page, page_size, (extra & ~DYLD_CACHE_SLIDE_PAGE_ATTRS) * 4);
+                if(extra & DYLD_CACHE_SLIDE_PAGE_ATTR_END) break;
+            }
+        } else {
+            rebase_chain2(s, info, page, page_size, start * 4);
+        }
+        break;
+    }
+    case 3: {
+        const struct dyld_cache_slide_info3 *info = s->info;
+        uint16_t start = info->page_starts[i];
+        if(start == DYLD_CACHE_SLIDE_V3_PAGE_ATTR_NO_REBASE) break;
+        uint64_t delta = 0;
+        for(size_t offset = start; ; offset += delta * 8) {
+            if(page_size < 8 || offset > page_size - 8) {
+                die("slide chain runs off the page");
+            }
+            uint64_t *loc = (uint64_t *) (page + offset);
+            uint64_t raw = *loc, value;
+            delta = (raw >> 51) & 0x7ff;
+            if(raw >> 63) {
+                // authenticated: we don't sign anything, so just produce the plain pointer
+                value = (raw & 0xffffffff) + info->auth_value_add + s->slide;
+            } else {
+                // 51 bits, where the top 8 go in the top byte
+                uint64_t value51 = raw & 0x7ffffffffffffull;
+                value = ((value51 & 0x7f80000000000ull) << 13) | (value51 & 0x7ffffffffffull);
+                value += s->slide;
+            }
+            *loc = value;
+            if(!delta) break;
+        }
+        break;
+    }
+    }
+}
+
+struct bulk_ctx {
+    const struct dyldcache_slide *s;
+    char *data;
+};
+
+static void slide_page_bulk(void *ctx_, size_t i) {
+    struct bulk_ctx *ctx = ctx_;
+    slide_page(ctx->s, ctx->data, (uint32_t) i);
+}
+
+void b_dyldcache_apply_slide(const struct binary *binary, prange_t file, addr_t slide) {
+    struct dyldcache_slide s;
+    parse_slide_info(binary, &s, slide);
+    if(s.data_offset > file.size || s.data_size > file.size - s.data_offset) {
+        die("file is too small to contain the data mapping");
+    }
+    struct bulk_ctx ctx = {&s, (char *) file.start + s.data_offset};
+    parallel_for(s.npages, slide_page_bulk, &ctx);
+}
+
+prange_t b_dyldcache_slid_copy(const struct binary *binary, addr_t slide) {
+    // for a split cache, that's just the main file
+    size_t size = binary->dyld->main_size ? binary->dyld->main_size : binary->valid_range.size;
+    prange_t copy = pdup((prange_t) {binary->valid_range.start, size}, size, 0);
+    b_dyldcache_apply_slide(binary, copy, slide);
+    return copy;
+}
+
+void b_dyldcache_slide_lazily(struct binary *binary, addr_t slide) {
+    struct dyldcache_slide *s = malloc(sizeof(*s));
+    parse_slide_info(binary, s, slide);
+    s->done = calloc(s->npages ? s->npages : 1, 1);
+    binary->dyld->slide = s;
+    if(!binary->dyld->main_size) {
+        binary->dyld->main_size = binary->valid_range.size;
+    }
+    binary->_map_range = b_dyldcache_map_range;
+    if(binary->dyld->images) {
+        for(uint32_t i = 0; i < binary->dyld->hdr->imagesCount; i++) {
+            if(binary->dyld->images[i]) {
+                b_dyldcache_slide_image(binary, binary->dyld->images[i]);
+            }
+        }
+    }
+}
+
+void b_dyldcache_slide_image(const struct binary *binary, const struct binary *image) {
+    addr_t base = (char *) image->valid_range.start - (char *) binary->valid_range.start;
+    for(uint32_t i = 0; i < image->nsegments; i++) {
+        range_t fr = image->segments[i].file_range;
+        if(fr.size) {
+            b_dyldcache_slide_range(binary, base + fr.start, fr.size);
+        }
+    }
+}
+
+void b_dyldcache_slide_range(const struct binary *binary, addr_t offset, size_t size) {
+    struct dyldcache_slide *s = binary->dyld->slide;
+    if(offset + size <= s->data_offset || offset >= s->data_offset + s->data_size) {
+        return;
+    }
+    addr_t start = offset > s->data_offset ? offset - s->data_offset : 0;
+    addr_t end = offset + size - s->data_offset;
+    if(!size) end = start + 1;
+    uint32_t last = (uint32_t) ((end - 1) / s->page_size);
+    if(last >= s->npages) last = s->npages - 1;
+    char *data = (char *) binary->valid_range.start + s->data_offset;
+    for(uint32_t i = (uint32_t) (start / s->page_size); i <= last && i < s->npages; i++) {
+        if(s->done[i]) continue;
+        pthread_mutex_lock(&slide_lock);
+        if(!s->done[i]) {
+            slide_page(s, data, i);
+            __sync_synchronize();
+            s->done[i] = 1;
+        }
+        pthread_mutex_unlock(&slide_lock);
+    }
+}
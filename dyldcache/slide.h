@@ -0,0 +1,18 @@
+#pragma once
+#include "binary.h"
+
+__BEGIN_DECLS
+
+// applies the cache's slide info (v1, v2 or v3) to the slid (second) mapping in file, which has to be laid out like binary->valid_range (usually it is binary->valid_range or a copy of it).  pages are done in parallel.
+void b_dyldcache_apply_slide(const struct binary *binary, prange_t file, addr_t slide);
+// a rebased copy of the main cache file
+prange_t b_dyldcache_slid_copy(const struct binary *binary, addr_t slide);
+// from now on, each page of the slid mapping gets rebased in place the first time it is rangeconv'd through binary.  images don't go through binary's _map_range, so their segments are rebased as soon as they are loaded (or now, for images that already are)
+void b_dyldcache_slide_lazily(struct binary *binary, addr_t slide);
+// used by b_dyldcache_slide_lazily and b_dyldcache_load_macho
+void b_dyldcache_slide_image(const struct binary *binary, const struct binary *image);
+
+// used by b_dyldcache_map_range
+void b_dyldcache_slide_range(const struct binary *binary, addr_t offset, size_t size);
+
+__END_DECLS
@@ -1,5 +1,6 @@
 #include "find.h"
 #include "binary.h"
+#include "trace.h"
 
 // Various links:
 // http://ridiculousfish.com/blog/archives/2006/05/30/old-age-and-treachery/
@@ -7,6 +8,7 @@
 // http://www-igm.univ-mlv.fr/~lecroq/string/node19.html#SECTION00190 (was using this)
 
 static addr_t find_data_raw(range_t range, int16_t *buf, ssize_t pattern_size, size_t offset, int align, int options, const char *name) {
+    TRACE_SCOPE("find_data");
     int8_t ps = (int8_t) pattern_size;
     if(ps != pattern_size) {
         die("pattern too long");
@@ -102,6 +104,7 @@ static addr_t find_data_raw(range_t range, int16_t *buf, ssize_t pattern_size, s
         GUTS(lbl2)
     }
     done:
+    TRACE_COUNT(TRACE_FIND_BMH_BYTES, (cursor < end ? cursor : end) - (uint8_t *) pr.start);
     if(foundit) {
         return foundit + offset;
     } else if(options & MUST_FIND) {
@@ -171,9 +174,11 @@ addr_t find_int32(range_t range, uint32_t number, int options) {
     char *end = pr.start + pr.size;
     for(char *p = start; p + 4 <= end; p++) {
         if(*((uint32_t *)p) == number) {
+            TRACE_COUNT(TRACE_FIND_INT32_BYTES, p - start + 4);
             return p - start + range.start;
         }
     }
+    TRACE_COUNT(TRACE_FIND_INT32_BYTES, pr.size);
     if(options & MUST_FIND) {
         die("didn't find %08x in range", number);
     } else {
@@ -276,8 +281,10 @@ addr_t find_bl(range_t *range) {
             }
         }
     }
+    TRACE_COUNT(TRACE_FIND_BL_BYTES, pr.size);
     return 0;
     ok:;
+    TRACE_COUNT(TRACE_FIND_BL_BYTES, (char *) base - (char *) pr.start + 4);
     addr_t baseaddr = ((char *) base) - ((char *) pr.start) + range->start + 4;
     range->start = baseaddr + thumb;
     if(diff & 0x800000) diff |= 0xff000000;
@@ -429,19 +436,17 @@ static uint16_t findmany_recurse(const struct findmany *restrict fm, struct find
 }
 
 void findmany_go(struct findmany *fm) {
+    TRACE_SCOPE("findmany_go");
     struct findmany2 fm2;
     memset(&fm2, 0, sizeof(fm2));
     autofree uint8_t *cur_index_path = calloc(1, fm->num_patterns);
-#ifdef PROFILING
-    clock_t a = clock();
-#endif
-    findmany_recurse(fm, &fm2, cur_index_path);
-#ifdef PROFILING
-    clock_t b = clock();
-    printf("it took %d clocks to prepare the DFA\n", (int) (b - a));
-#endif
+    {
+        TRACE_SCOPE("findmany_dfa");
+        findmany_recurse(fm, &fm2, cur_index_path);
+    }
 
     prange_t pr = rangeconv(fm->range, MUST_FIND);
+    TRACE_COUNT(TRACE_FINDMANY_BYTES, pr.size);
     uint8_t *start = pr.start;
     struct node *cur = &fm2.nodes[0];
     for(uint8_t *ptr = start; ptr < start + pr.size; ptr++) {
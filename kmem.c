@@ -0,0 +1,327 @@
+#include "kmem.h"
+#include <sys/stat.h>
+
+void kmem_init(struct kmem *k, const struct kmem_backend *backend) {
+    memset(k, 0, sizeof(*k));
+    k->backend = *backend;
+    k->cache = malloc(KMEM_CACHE_PAGES * KMEM_PAGE_SIZE);
+}
+
+void kmem_free(struct kmem *k) {
+    kmem_sync(k);
+    if(k->backend.release) k->backend.release(k->backend.ctx);
+    free(k->cache);
+    free(k->write_buf);
+    free(k->ops);
+}
+
+static inline unsigned cache_slot(addr_t page) {
+    return (unsigned) (page / KMEM_PAGE_SIZE) % KMEM_CACHE_PAGES;
+}
+
+static inline bool is_cached(const struct kmem *k, addr_t page) {
+    unsigned slot = cache_slot(page);
+    return k->cache_valid[slot] && k->cache_addr[slot] == page;
+}
+
+static void transfer_read(struct kmem *k, addr_t addr, uint8_t *buf, size_t size) {
+    while(size > 0) {
+        size_t this_size = size < k->backend.max_transfer ? size : k->backend.max_transfer;
+        int err = k->backend.read(k->backend.ctx, addr, buf, this_size);
+        if(err) die("read of 0x%zx bytes at 0x%llx failed: %d", this_size, (long long) addr, err);
+        k->stats.reads++;
+        k->stats.read_bytes += this_size;
+        addr += this_size;
+        buf += this_size;
+        size -= this_size;
+    }
+}
+
+// page granularity, since that's what protects work on
+static inline bool pages_overlap(addr_t a, size_t a_size, addr_t b, size_t b_size) {
+    addr_t mask = ~(addr_t) (KMEM_PAGE_SIZE - 1);
+    return (a & mask) < b + b_size && (b & mask) < a + a_size;
+}
+
+static void sync_writes(struct kmem *k) {
+    addr_t addr = k->write_addr;
+    const uint8_t *buf = k->write_buf;
+    size_t size = k->write_size;
+    while(size > 0) {
+        size_t this_size = size < k->backend.max_transfer ? size : k->backend.max_transfer;
+        int err = k->backend.write(k->backend.ctx, addr, buf, this_size);
+        if(err) die("write of 0x%zx bytes at 0x%llx failed: %d", this_size, (long long) addr, err);
+        k->stats.writes++;
+        k->stats.write_bytes += this_size;
+        addr += this_size;
+        buf += this_size;
+        size -= this_size;
+    }
+    k->write_size = 0;
+}
+
+void kmem_sync(struct kmem *k) {
+    sync_writes(k);
+    for(uint32_t i = 0; i < k->nops; i++) {
+        struct kmem_op *op = &k->ops[i];
+        int err;
+        if(op->kind == 2) {
+            err = k->backend.flush_cache(k->backend.ctx, op->addr, op->size);
+            k->stats.flushes++;
+        } else {
+            err = k->backend.protect(k->backend.ctx, op->addr, op->size, op->kind == 1, op->prot);
+            k->stats.protects++;
+        }
+        if(err) die("%s of 0x%zx bytes at 0x%llx failed: %d", op->kind == 2 ? "cache flush" : "protect", op->size, (long long) op->addr, err);
+    }
+    k->nops = 0;
+}
+
+bool kmem_probe(struct kmem *k, addr_t addr) {
+    if(is_cached(k, addr & ~(addr_t) (KMEM_PAGE_SIZE - 1))) return true;
+    int err = k->backend.probe(k->backend.ctx, addr);
+    if(err == KMEM_INVALID_ADDRESS) return false;
+    if(err && err != KMEM_PROTECTION_FAILURE) die("unexpected error probing 0x%llx: %d", (long long) addr, err);
+    return true;
+}
+
+void kmem_read(struct kmem *k, addr_t addr, void *buf, size_t size) {
+    if(!size) return;
+    kmem_sync(k);
+    addr_t end = addr + size;
+    addr_t page = addr & ~(addr_t) (KMEM_PAGE_SIZE - 1);
+    while(page < end) {
+        addr_t run_end = page + KMEM_PAGE_SIZE;
+        const uint8_t *src;
+        autofree uint8_t *bounce = NULL;
+        if(is_cached(k, page)) {
+            k->stats.cache_hits++;
+            src = k->cache[cache_slot(page)];
+        } else {
+            // read as many missing pages as the cache can hold in one go
+            while(run_end < end && run_end - page < KMEM_CACHE_PAGES * KMEM_PAGE_SIZE && !is_cached(k, run_end)) {
+                run_end += KMEM_PAGE_SIZE;
+            }
+            k->stats.cache_misses += (run_end - page) / KMEM_PAGE_SIZE;
+            // straight into buf, unless the run sticks out of it
+            uint8_t *dst = page >= addr && run_end <= end ? buf + (page - addr) : (bounce = malloc(run_end - page));
+            transfer_read(k, page, dst, run_end - page);
+            for(addr_t p = page; p < run_end; p += KMEM_PAGE_SIZE) {
+                unsigned slot = cache_slot(p);
+                memcpy(k->cache[slot], dst + (p - page), KMEM_PAGE_SIZE);
+                k->cache_addr[slot] = p;
+                k->cache_valid[slot] = true;
+            }
+            if(!bounce) {
+                page = run_end;
+                continue;
+            }
+            src = bounce;
+        }
+        addr_t from = page > addr ? page : addr;
+        addr_t to = run_end < end ? run_end : end;
+        memcpy(buf + (from - addr), src + (from - page), to - from);
+        page = run_end;
+    }
+}
+
+void kmem_write(struct kmem *k, addr_t addr, const void *buf, size_t size) {
+    if(!size) return;
+    // write through to the cache
+    addr_t end = addr + size;
+    for(addr_t page = addr & ~(addr_t) (KMEM_PAGE_SIZE - 1); page < end; page += KMEM_PAGE_SIZE) {
+        if(!is_cached(k, page)) continue;
+        addr_t from = page > addr ? page : addr;
+        addr_t to = page + KMEM_PAGE_SIZE < end ? page + KMEM_PAGE_SIZE : end;
+        memcpy(k->cache[cache_slot(page)] + (from - page), buf + (from - addr), to - from);
+    }
+
+    // kmem_sync sends writes before ops, so this has to wait for any queued op it would otherwise pass
+    for(uint32_t i = 0; i < k->nops; i++) {
+        if(pages_overlap(addr, size, k->ops[i].addr, k->ops[i].size)) {
+            kmem_sync(k);
+            break;
+        }
+    }
+    if(k->write_size && addr != k->write_addr + k->write_size) {
+        sync_writes(k);
+    }
+    if(!k->write_size) {
+        k->write_addr = addr;
+    }
+    if(size > k->write_capacity - k->write_size) {
+        k->write_capacity = (k->write_size + size) * 2;
+        k->write_buf = realloc(k->write_buf, k->write_capacity);
+    }
+    memcpy(k->write_buf + k->write_size, buf, size);
+    k->write_size += size;
+}
+
+static void queue_op(struct kmem *k, int kind, addr_t addr, size_t size, int prot) {
+    if(!size) return;
+    // writes it would otherwise pass go out first
+    if(k->write_size && pages_overlap(addr, size, k->write_addr, k->write_size)) {
+        sync_writes(k);
+    }
+    // merge with an adjacent op of the same kind, as long as nothing queued after it touches this range
+    for(uint32_t i = k->nops; i-- > 0;) {
+        struct kmem_op *op = &k->ops[i];
+        if(pages_overlap(op->addr, op->size, addr, size)) break;
+        if(op->kind != kind || op->prot != prot) continue;
+        if(op->addr + op->size == addr) {
+            op->size += size;
+            return;
+        } else if(addr + size == op->addr) {
+            op->addr = addr;
+            op->size += size;
+            return;
+        }
+    }
+    if(k->nops == k->ops_capacity) {
+        k->ops_capacity = k->ops_capacity ? k->ops_capacity * 2 : 16;
+        k->ops = realloc(k->ops, k->ops_capacity * sizeof(*k->ops));
+    }
+    k->ops[k->nops++] = (struct kmem_op) {addr, size, kind, prot};
+}
+
+void kmem_protect(struct kmem *k, addr_t addr, size_t size, bool set_maximum, int prot) {
+    queue_op(k, set_maximum ? 1 : 0, addr, size, prot);
+}
+
+void kmem_flush_cache(struct kmem *k, addr_t addr, size_t size) {
+    queue_op(k, 2, addr, size, 0);
+}
+
+int kmem_allocate(struct kmem *k, addr_t addr, size_t size) {
+    kmem_sync(k);
+    return k->backend.allocate(k->backend.ctx, addr, size);
+}
+
+void kmem_deallocate(struct kmem *k, addr_t addr, size_t size) {
+    kmem_sync(k);
+    for(unsigned i = 0; i < KMEM_CACHE_PAGES; i++) {
+        if(k->cache_addr[i] >= (addr & ~(addr_t) (KMEM_PAGE_SIZE - 1)) && k->cache_addr[i] < addr + size) {
+            k->cache_valid[i] = false;
+        }
+    }
+    int err = k->backend.deallocate(k->backend.ctx, addr, size);
+    if(err) die("deallocate of 0x%zx bytes at 0x%llx failed: %d", size, (long long) addr, err);
+}
+
+void kmem_invalidate(struct kmem *k) {
+    memset(k->cache_valid, 0, sizeof(k->cache_valid));
+}
+
+// file backend
+
+struct fd_ctx {
+    int fd;
+    addr_t base;
+};
+
+static int fd_read(void *ctx_, addr_t addr, void *buf, size_t size) {
+    struct fd_ctx *ctx = ctx_;
+    if(addr < ctx->base) return KMEM_INVALID_ADDRESS;
+    ssize_t got = pread(ctx->fd, buf, size, (off_t) (addr - ctx->base));
+    if(got < 0) return KMEM_FAILURE;
+    if(got == 0) return KMEM_INVALID_ADDRESS;
+    // the end of the last page
+    memset(buf + got, 0, size - (size_t) got);
+    return KMEM_SUCCESS;
+}
+
+static int fd_write(void *ctx_, addr_t addr, const void *buf, size_t size) {
+    struct fd_ctx *ctx = ctx_;
+    if(addr < ctx->base) return KMEM_INVALID_ADDRESS;
+    return pwrite(ctx->fd, buf, size, (off_t) (addr - ctx->base)) == (ssize_t) size ? KMEM_SUCCESS : KMEM_FAILURE;
+}
+
+static int fd_probe(void *ctx_, addr_t addr) {
+    struct fd_ctx *ctx = ctx_;
+    struct stat st;
+    if(fstat(ctx->fd, &st)) return KMEM_FAILURE;
+    return addr >= ctx->base && addr - ctx->base < (addr_t) st.st_size ? KMEM_SUCCESS : KMEM_INVALID_ADDRESS;
+}
+
+static int fd_allocate(void *ctx_, addr_t addr, size_t size) {
+    struct fd_ctx *ctx = ctx_;
+    struct stat st;
+    if(addr < ctx->base) return KMEM_INVALID_ADDRESS;
+    if(fstat(ctx->fd, &st)) return KMEM_FAILURE;
+    if(addr - ctx->base + size > (addr_t) st.st_size && ftruncate(ctx->fd, (off_t) (addr - ctx->base + size))) {
+        return KMEM_FAILURE;
+    }
+    return KMEM_SUCCESS;
+}
+
+static int fd_nothing(__unused void *ctx, __unused addr_t addr, __unused size_t size) {
+    return KMEM_SUCCESS;
+}
+
+static int fd_protect(__unused void *ctx, __unused addr_t addr, __unused size_t size, __unused bool set_maximum, __unused int prot) {
+    return KMEM_SUCCESS;
+}
+
+void kmem_init_fd(struct kmem *k, int fd, addr_t base) {
+    struct fd_ctx *ctx = malloc(sizeof(*ctx));
+    ctx->fd = fd;
+    ctx->base = base;
+    struct kmem_backend backend = {
+        fd_read, fd_write, fd_probe, fd_allocate, fd_nothing, fd_protect, fd_nothing, free,
+        1 << 30, ctx
+    };
+    kmem_init(k, &backend);
+}
+
+#ifdef __APPLE__
+// task backend
+
+#define TASK(ctx) ((mach_port_t) (uintptr_t) (ctx))
+
+static int task_read(void *ctx, addr_t addr, void *buf, size_t size) {
+    vm_size_t outsize = size;
+    return vm_read_overwrite(TASK(ctx), (vm_address_t) addr, size, (vm_address_t) buf, &outsize);
+}
+
+static int task_write(void *ctx, addr_t addr, const void *buf, size_t size) {
+    return vm_write(TASK(ctx), (vm_address_t) addr, (vm_offset_t) buf, (mach_msg_type_number_t) size);
+}
+
+static int task_probe(void *ctx, addr_t addr) {
+    // This will return either KERN_PROTECTION_FAILURE if it's a good address, and KERN_INVALID_ADDRESS otherwise.
+    // But if we use a shorter size, it will read if it's a good address, and /crash/ otherwise.
+    char buf[KMEM_PAGE_SIZE];
+    vm_size_t size = KMEM_PAGE_SIZE;
+    return vm_read_overwrite(TASK(ctx), (vm_address_t) (addr & ~(addr_t) (KMEM_PAGE_SIZE - 1)), size, (vm_address_t) buf, &size);
+}
+
+static int task_allocate(void *ctx, addr_t addr, size_t size) {
+    vm_address_t address = (vm_address_t) addr;
+    kern_return_t kr = vm_allocate(TASK(ctx), &address, size, VM_FLAGS_FIXED);
+    if(kr) return kr;
+    if(address != addr) die("vm_allocate put it at %08llx instead of %08llx", (long long) address, (long long) addr);
+    return vm_wire(mach_host_self(), TASK(ctx), address, size, VM_PROT_READ);
+}
+
+static int task_deallocate(void *ctx, addr_t addr, size_t size) {
+    return vm_deallocate(TASK(ctx), (vm_address_t) addr, size);
+}
+
+static int task_protect(void *ctx, addr_t addr, size_t size, bool set_maximum, int prot) {
+    return vm_protect(TASK(ctx), (vm_address_t) addr, size, set_maximum, prot);
+}
+
+static int task_flush_cache(void *ctx, addr_t addr, size_t size) {
+    vm_machine_attribute_val_t val = MATTR_VAL_CACHE_FLUSH;
+    return vm_machine_attribute(TASK(ctx), (vm_address_t) addr, size, MATTR_CACHE, &val);
+}
+
+void kmem_init_task(struct kmem *k, mach_port_t task) {
+    struct kmem_backend backend = {
+        task_read, task_write, task_probe, task_allocate, task_deallocate, task_protect, task_flush_cache, NULL,
+        // Well, uh, this sucks.  But there's some block on reading (and writing) a whole page at once.
+        0xfff, (void *) (uintptr_t) task
+    };
+    kmem_init(k, &backend);
+}
+#endif
@@ -0,0 +1,90 @@
+#pragma once
+#include "common.h"
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+
+// the same numbers as the KERN_* ones, so the task backend can pass them through
+#define KMEM_SUCCESS 0
+#define KMEM_INVALID_ADDRESS 1
+#define KMEM_PROTECTION_FAILURE 2
+#define KMEM_FAILURE 5
+
+#define KMEM_PAGE_SIZE 0x1000
+#define KMEM_CACHE_PAGES 64
+
+// where kernel memory actually comes from.  everything returns a KMEM_* code.
+struct kmem_backend {
+    int (*read)(void *ctx, addr_t addr, void *buf, size_t size);
+    int (*write)(void *ctx, addr_t addr, const void *buf, size_t size);
+    // whether the page at addr is mapped, without reading it (KMEM_PROTECTION_FAILURE counts as mapped)
+    int (*probe)(void *ctx, addr_t addr);
+    // exactly at addr, and wired
+    int (*allocate)(void *ctx, addr_t addr, size_t size);
+    int (*deallocate)(void *ctx, addr_t addr, size_t size);
+    int (*protect)(void *ctx, addr_t addr, size_t size, bool set_maximum, int prot);
+    int (*flush_cache)(void *ctx, addr_t addr, size_t size);
+    void (*release)(void *ctx); // optional
+    size_t max_transfer; // the most read or write will be asked to do at once
+    void *ctx;
+};
+
+struct kmem_stats {
+    uint64_t reads, read_bytes;
+    uint64_t writes, write_bytes;
+    uint64_t protects, flushes;
+    uint64_t cache_hits, cache_misses;
+};
+
+// protect and flush_cache calls waiting for kmem_sync
+struct kmem_op {
+    addr_t addr;
+    size_t size;
+    int kind; // 0 = protect, 1 = protect maximum, 2 = flush
+    int prot;
+};
+
+// backend plus a direct-mapped cache of read pages and queues for writes, protects and flushes.
+// reads and writes get coalesced into transfers of up to max_transfer bytes; protects and flushes of adjacent ranges get merged.
+// anything queued goes out before the next read, allocate or deallocate, or on kmem_sync.  writes, protects and flushes that touch the same page go out in the order they were made.
+struct kmem {
+    struct kmem_backend backend;
+    struct kmem_stats stats;
+
+    addr_t cache_addr[KMEM_CACHE_PAGES];
+    bool cache_valid[KMEM_CACHE_PAGES];
+    uint8_t (*cache)[KMEM_PAGE_SIZE];
+
+    addr_t write_addr;
+    uint8_t *write_buf;
+    size_t write_size, write_capacity;
+
+    struct kmem_op *ops;
+    uint32_t nops, ops_capacity;
+};
+
+__BEGIN_DECLS
+
+void kmem_init(struct kmem *k, const struct kmem_backend *backend);
+void kmem_free(struct kmem *k);
+
+// kernel memory starting at base is the file (or memfd) fd, which grows on allocate; protects and flushes do nothing.  the bench runs kmem on this.
+void kmem_init_fd(struct kmem *k, int fd, addr_t base);
+#ifdef __APPLE__
+void kmem_init_task(struct kmem *k, mach_port_t task);
+#endif
+
+bool kmem_probe(struct kmem *k, addr_t addr);
+// these die on failure
+void kmem_read(struct kmem *k, addr_t addr, void *buf, size_t size);
+void kmem_write(struct kmem *k, addr_t addr, const void *buf, size_t size);
+void kmem_protect(struct kmem *k, addr_t addr, size_t size, bool set_maximum, int prot);
+void kmem_flush_cache(struct kmem *k, addr_t addr, size_t size);
+void kmem_sync(struct kmem *k);
+// returns a KMEM_* code, since allocations are allowed to fail
+int kmem_allocate(struct kmem *k, addr_t addr, size_t size);
+void kmem_deallocate(struct kmem *k, addr_t addr, size_t size);
+// forget cached pages; kernel memory can change behind our back
+void kmem_invalidate(struct kmem *k);
+
+__END_DECLS
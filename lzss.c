@@ -1,4 +1,3 @@
-#ifdef IMG3_SUPPORT
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
@@ -96,4 +95,69 @@ decompress_lzss(uint8_t *dst, uint8_t *src, uint32_t srclen)
     
     return dst - dststart;
 }
-#endif
+
+// not Okumura's encoder: greedy matching through hash chains, which is plenty for making test inputs.
+// returns the compressed size, or 0 if it didn't fit in dstlen
+#define HASH_SIZE 4096
+#define MAX_CHAIN 64
+uint32_t
+compress_lzss(uint8_t *dst, uint32_t dstlen, const uint8_t *src, uint32_t srclen)
+{
+    /* 1 + the last position with each hash, and 1 + the one before each position */
+    uint32_t head[HASH_SIZE], prev[N];
+    uint8_t *out = dst, *outend = dst + dstlen, *flags = NULL;
+    int bit = 8;
+    uint32_t p = 0;
+    memset(head, 0, sizeof(head));
+
+#define HASH(q) (((src[q] << 8) ^ (src[(q) + 1] << 4) ^ src[(q) + 2]) & (HASH_SIZE - 1))
+#define INSERT(q) if ((q) + THRESHOLD < srclen) { \
+            uint32_t h = HASH(q); \
+            prev[(q) & (N - 1)] = head[h]; \
+            head[h] = (q) + 1; \
+        }
+
+    while (p < srclen) {
+        if (bit == 8) {
+            if (out == outend) return 0;
+            flags = out++;
+            *flags = 0;
+            bit = 0;
+        }
+        uint32_t best_len = 0, best_pos = 0;
+        if (p + THRESHOLD < srclen) {
+            uint32_t max_len = srclen - p < F ? srclen - p : F;
+            uint32_t cand = head[HASH(p)];
+            for (int chain = 0; cand && chain < MAX_CHAIN; chain++) {
+                uint32_t q = cand - 1;
+                /* matches can't reach further back than the ring buffer holds */
+                if (p - q > N - F) break;
+                uint32_t len = 0;
+                while (len < max_len && src[q + len] == src[p + len]) len++;
+                if (len > best_len) {
+                    best_len = len;
+                    best_pos = q;
+                    if (len == max_len) break;
+                }
+                cand = prev[q & (N - 1)];
+            }
+        }
+        if (best_len > THRESHOLD) {
+            if (outend - out < 2) return 0;
+            uint32_t r = (N - F + best_pos) & (N - 1);
+            *out++ = r & 0xff;
+            *out++ = ((r >> 4) & 0xf0) | (best_len - THRESHOLD - 1);
+            for (uint32_t k = 0; k < best_len; k++, p++) {
+                INSERT(p)
+            }
+        } else {
+            if (out == outend) return 0;
+            *flags |= 1 << bit;
+            *out++ = src[p];
+            INSERT(p)
+            p++;
+        }
+        bit++;
+    }
+    return out - dst;
+}
@@ -3,13 +3,80 @@
 #include "headers/nlist.h"
 #include "headers/fat.h"
 #include "read_dyld_info.h"
+#include "../strhash.h"
+#include "../trace.h"
 
 const int desired_cputype = CPU_TYPE_ARM;
 const int desired_cpusubtype = CPU_SUBTYPE_ARM_V7;
 
 static addr_t sym(const struct binary *binary, const char *name, int options);
+static void sym_many(const struct binary *binary, const char **names, addr_t *results, uint32_t count, int options);
 static void copy_syms(const struct binary *binary, struct data_sym **syms, uint32_t *nsyms, int options);
 
+static void section_key(char key[32], const char *segname, const char *sectname) {
+    // the same layout as the start of struct section
+    memset(key, 0, 32);
+    memcpy(key, sectname, strnlen(sectname, 16));
+    memcpy(key + 16, segname, strnlen(segname, 16));
+}
+
+static void forget_sections(struct mach_binary *mach) {
+    free(mach->sections);
+    mach->sections = NULL;
+    mach->nsections = 0;
+    strhash_free(&mach->section_index);
+    strhash_free(&mach->segment_index);
+}
+
+// must be called after binary->segments is filled in
+static void do_sections(struct binary *binary) {
+    struct mach_binary *mach = binary->mach;
+    forget_sections(mach);
+    uint32_t nsects = 0;
+    for(uint32_t i = 0; i < binary->nsegments; i++) {
+        MACHO_SPECIALIZE(
+            const segment_command_x *scmd = binary->segments[i].native_segment;
+            if(scmd->cmd == LC_SEGMENT_X) {
+                if(scmd->nsects > MAX_ARRAY(struct data_section) - nsects) {
+                    die("section overflow");
+                }
+                nsects += scmd->nsects;
+            }
+        )
+    }
+    mach->nsections = nsects;
+    struct data_section *ds = mach->sections = malloc(sizeof(*mach->sections) * nsects);
+    strhash_init(&mach->segment_index, binary->nsegments);
+    strhash_init(&mach->section_index, nsects);
+    for(uint32_t i = 0; i < binary->nsegments; i++) {
+        MACHO_SPECIALIZE(
+            const segment_command_x *scmd = binary->segments[i].native_segment;
+            if(scmd->cmd == LC_SEGMENT_X) {
+                strhash_insert(&mach->segment_index, scmd->segname, strnlen(scmd->segname, 16), i);
+                section_x *sect = (void *) (scmd + 1);
+                for(uint32_t j = 0; j < scmd->nsects; j++, sect++, ds++) {
+                    section_key(ds->names, sect->segname, sect->sectname);
+                    ds->vm_range = (range_t) {binary, sect->addr, sect->size};
+                    uint8_t type = sect->flags & SECTION_TYPE;
+                    if(type == S_ZEROFILL || type == S_GB_ZEROFILL) {
+                        ds->file_range = (range_t) {binary, 0, 0};
+                    } else {
+                        ds->file_range = (range_t) {binary, sect->offset, sect->size};
+                    }
+                    ds->flags = sect->flags;
+                    ds->reserved1 = sect->reserved1;
+                    ds->reserved2 = sect->reserved2;
+                    ds->reloff = sect->reloff;
+                    ds->nreloc = sect->nreloc;
+                    ds->segment = i;
+                    ds->native_section = sect;
+                    strhash_insert(&mach->section_index, ds->names, 32, ds - mach->sections);
+                }
+            }
+        )
+    }
+}
+
 static void do_load_commands(struct binary *binary) {
     struct mach_header *hdr = b_mach_hdr(binary);
     if(!prange_check(binary, (prange_t) {hdr, hdr->sizeofcmds})) {
@@ -47,6 +114,9 @@ static void do_load_commands(struct binary *binary) {
         case LC_DYLD_INFO_ONLY:
             required = sizeof(struct dyld_info_command);
             break;
+        case LC_DYLD_CHAINED_FIXUPS:
+            required = sizeof(struct linkedit_data_command);
+            break;
         case LC_ID_DYLIB:
             required = sizeof(struct dylib_command);
             break;
@@ -78,11 +148,10 @@ static void do_load_commands(struct binary *binary) {
         )
         }
     }
+    do_sections(binary);
 }
 
 static void do_symbols(struct binary *binary) {
-    binary->mach = calloc(sizeof(*binary->mach), 1);
-    binary->mach->hdr = b_mach_hdr(binary);
 
     CMD_ITERATE(b_mach_hdr(binary), cmd) {
         MACHO_SPECIALIZE(
@@ -111,6 +180,8 @@ static void do_symbols(struct binary *binary) {
             struct dyld_info_command *dcmd = (void *) cmd;
             binary->mach->dyld_info = dcmd;
             binary->mach->export_trie = rangeconv_off((range_t) {binary, dcmd->export_off, dcmd->export_size}, MUST_FIND);
+        } else if(cmd->cmd == LC_DYLD_CHAINED_FIXUPS) {
+            binary->mach->chained_fixups = (void *) cmd;
         }
     }
     const struct dysymtab_command *dc;
@@ -134,9 +205,11 @@ static void do_symbols(struct binary *binary) {
 }
 
 void b_prange_load_macho(struct binary *binary, prange_t pr, size_t offset, const char *name) {
+    TRACE_SCOPE("b_prange_load_macho");
     b_prange_load_macho_nosyms(binary, pr, offset, name);
     do_symbols(binary);
     binary->_sym = sym;
+    binary->_sym_many = sym_many;
     binary->_copy_syms = copy_syms;
 }
 
@@ -203,6 +276,9 @@ void b_prange_load_macho_nosyms(struct binary *binary, prange_t pr, size_t offse
     binary->cputype = b_mach_hdr(binary)->cputype;
     binary->cpusubtype = b_mach_hdr(binary)->cpusubtype;
 
+    binary->mach = calloc(sizeof(*binary->mach), 1);
+    binary->mach->hdr = b_mach_hdr(binary);
+
     do_load_commands(binary);
 #undef _arg
 }
@@ -241,135 +317,444 @@ void *b_macho_nth_symbol(const struct binary *binary, uint32_t n) {
 }
 
 
+static addr_t sym_reexported(const struct binary *binary, const char *name, int options);
+
 static addr_t sym_nlist(const struct binary *binary, const char *name, int options) {
+    TRACE_COUNT(TRACE_SYM_NLIST, 1);
     // I stole dyld's codez
-    const struct nlist *base = binary->mach->ext_symtab;
-    for(uint32_t n = binary->mach->ext_nsyms; n > 0; n /= 2) {
-        const struct nlist *pivot = base + n/2;
-        struct data_sym ds = convert_nlist(binary, pivot, options);
-        int cmp = strcmp(name, ds.name);
-        if(cmp == 0) {
-            return ds.address;
-        } else if(cmp > 0) {
-            base = pivot + 1; 
-            n--;
+    MACHO_SPECIALIZE_POINTER_SIZE(binary,
+        const nlist_x *base = (const void *) binary->mach->ext_symtab;
+        for(uint32_t n = binary->mach->ext_nsyms; n > 0; n /= 2) {
+            const nlist_x *pivot = base + n/2;
+            uint32_t strx = pivot->n_un.n_strx;
+            if(strx >= binary->mach->strsize) {
+                die("insane strx: %u", strx);
+            }
+            int cmp = strcmp(name, binary->mach->strtab + strx);
+            if(cmp == 0) {
+                return convert_nlist(binary, pivot, options).address;
+            } else if(cmp > 0) {
+                base = pivot + 1; 
+                n--;
+            }
         }
-    }
+    )
 
-    for(unsigned int i = 0; i < binary->nreexports; i++) {
-        addr_t result;
-        if(result = b_sym(&binary->reexports[i], name, options)) {
-            return result;
+    return sym_reexported(binary, name, options);
+}
+
+// the export trie, flattened.  a trie walk per lookup is fine for a few symbols, but callers that look up hundreds (or enumerate them) want this instead.
+
+static void read_export_terminal(struct macho_export *ex, void *ptr, void *end, const char *name) {
+    ex->name = name;
+    ex->flags = (uint32_t) read_uleb128(&ptr, end);
+    ex->address = read_uleb128(&ptr, end);
+    ex->reexport_name = NULL;
+    if(ex->flags & EXPORT_SYMBOL_FLAGS_INDIRECT_DEFINITION) {
+        // address is actually a library ordinal
+        if(ptr != end) {
+            char *import_name = read_cstring(&ptr, end);
+            if(import_name[0]) ex->reexport_name = import_name;
         }
+    } else if(ex->flags & 0x10) {
+        // stub and resolver; we don't care where the resolver is
+        read_uleb128(&ptr, end);
     }
-
-    return 0;
 }
 
-static addr_t trie_recurse(const struct binary *binary, void *ptr, char *start, char *end, const char *name0, const char *name, int options) {
-    if(start == end) return 0;
-    uint8_t terminal_size = read_int(&ptr, end, uint8_t);
-    if(terminal_size) {
-        uint32_t flags = read_uleb128(&ptr, end);
-        uint32_t address = read_uleb128(&ptr, end);
-        uint32_t resolver = 0;
-        if(flags & 0x10) {
-            resolver = read_uleb128(&ptr, end);
+static struct export_table *flatten_trie(const struct binary *binary) {
+    char *start = binary->mach->export_trie.start;
+    char *end = start + binary->mach->export_trie.size;
+
+    struct export_table *et = calloc(1, sizeof(*et));
+    uint32_t exports_cap = 0;
+
+    // every node's full name goes into one buffer; pointers into it are fixed up at the end since it moves around
+    size_t names_size = 1, names_cap = 256;
+    char *names = malloc(names_cap);
+    names[0] = 0;
+
+    struct todo { uint32_t node; size_t name; } *stack = NULL;
+    size_t stack_size = 0, stack_cap = 0;
+    size_t visits = 0;
+
+    #define PUSH(node_, name_) do { \
+        if(stack_size == stack_cap) { \
+            stack_cap = stack_cap ? stack_cap * 2 : 64; \
+            stack = realloc(stack, stack_cap * sizeof(*stack)); \
+        } \
+        stack[stack_size++] = (struct todo) {(node_), (name_)}; \
+    } while(0)
+
+    if(start != end) PUSH(0, 0);
+    while(stack_size) {
+        struct todo t = stack[--stack_size];
+        if(++visits > (size_t) (end - start)) {
+            die("export trie has a loop");
         }
-        if(!name[0]) {
-            if(resolver) {
-                fprintf(stderr, "trie_recurse: %s has a resolver; returning failure\n", name0);
-                return 0;
-            }
-            if(flags & 8) {
-                // indirect definition
-                address--;
-                if(address >= binary->nreexports) {
-                    die("invalid sub-library %d", address);
-                }
-                return b_sym(&binary->reexports[address], name0, options);
+        void *ptr = start + t.node;
+        addr_t terminal_size = read_uleb128(&ptr, end);
+        if(terminal_size > (size_t) (end - (char *) ptr)) {
+            die("terminal overflows the export trie");
+        }
+        void *children = (char *) ptr + terminal_size;
+        if(terminal_size) {
+            if(et->nexports == exports_cap) {
+                exports_cap = exports_cap ? exports_cap * 2 : 256;
+                if(exports_cap > MAX_ARRAY(struct macho_export)) die("too many exports");
+                et->exports = realloc(et->exports, exports_cap * sizeof(*et->exports));
             }
-            if(binary->cputype == CPU_TYPE_ARM && !(options & TO_EXECUTE)) {
-                address &= ~1u;
+            // stash the offset in the name pointer for now
+            read_export_terminal(&et->exports[et->nexports++], ptr, children, (const char *) (uintptr_t) t.name);
+        }
+
+        ptr = children;
+        uint8_t child_count = read_int(&ptr, end, uint8_t);
+        size_t prefix_len = strlen(names + t.name);
+        while(child_count--) {
+            char *edge = read_cstring(&ptr, end);
+            addr_t offset = read_uleb128(&ptr, end);
+            if(offset >= (size_t) (end - start)) die("invalid child offset");
+
+            size_t edge_len = strlen(edge);
+            size_t needed = names_size + prefix_len + edge_len + 1;
+            if(needed > names_cap) {
+                while(needed > names_cap) names_cap *= 2;
+                names = realloc(names, names_cap);
             }
-            return ((addr_t) address) + binary->mach->export_baseaddr;
+            char *name = names + names_size;
+            memcpy(name, names + t.name, prefix_len);
+            memcpy(name + prefix_len, edge, edge_len + 1);
+            PUSH((uint32_t) offset, names_size);
+            names_size = needed;
         }
     }
+    #undef PUSH
+    free(stack);
 
+    // b_copy_syms and b_macho_symbolicate hand out pointers into the names, so they belong to the binary rather than the table and survive b_macho_forget_caches
+    struct mach_binary *mach = binary->mach;
+    if(mach->export_names && mach->export_names_size == names_size && !memcmp(mach->export_names, names, names_size)) {
+        free(names);
+        names = mach->export_names;
+    } else {
+        if(mach->export_names) {
+            mach->old_export_names = realloc(mach->old_export_names, (mach->nold_export_names + 1) * sizeof(char *));
+            mach->old_export_names[mach->nold_export_names++] = mach->export_names;
+        }
+        mach->export_names = names;
+        mach->export_names_size = names_size;
+    }
+    et->names = names;
+    strhash_init(&et->index, et->nexports);
+    for(uint32_t i = 0; i < et->nexports; i++) {
+        struct macho_export *ex = &et->exports[i];
+        ex->name = names + (uintptr_t) ex->name;
+        if(!(ex->flags & EXPORT_SYMBOL_FLAGS_INDIRECT_DEFINITION)) {
+            ex->address += binary->mach->export_baseaddr;
+        }
+        strhash_insert(&et->index, ex->name, strlen(ex->name), i);
+    }
+    return et;
+}
+
+const struct export_table *b_macho_export_table(const struct binary *binary) {
+    if(!binary->mach->export_trie.start) {
+        return NULL;
+    }
+    if(!binary->mach->export_table) {
+        binary->mach->export_table = flatten_trie(binary);
+    }
+    return binary->mach->export_table;
+}
+
+static addr_t resolve_export(const struct binary *binary, const struct macho_export *ex, int options) {
+    if(ex->flags & EXPORT_SYMBOL_FLAGS_INDIRECT_DEFINITION) {
+        addr_t lib = ex->address - 1;
+        if(lib >= binary->nreexports) {
+            die("invalid sub-library %d", (int) lib);
+        }
+        return b_sym(&binary->reexports[lib], ex->reexport_name ? ex->reexport_name : ex->name, options);
+    }
+    if(ex->flags & 0x10) {
+        fprintf(stderr, "resolve_export: %s has a resolver; returning failure\n", ex->name);
+        return 0;
+    }
+    addr_t address = ex->address;
+    if(binary->cputype == CPU_TYPE_ARM && !(options & TO_EXECUTE)) {
+        address &= ~1u;
+    }
+    return address;
+}
+
+// walks the trie for all of names[lo..hi), which are sorted and all begin with the same depth characters
+static void trie_descend(const struct binary *binary, uint32_t node, size_t depth, size_t level, const char **names, addr_t *results, uint32_t lo, uint32_t hi, int options) {
+    char *start = binary->mach->export_trie.start;
+    char *end = start + binary->mach->export_trie.size;
+    if(lo == hi || node >= (size_t) (end - start)) return;
+    // every level of a real trie is a different node, but an empty edge can point back up
+    if(level > (size_t) (end - start)) {
+        die("export trie has a loop");
+    }
+
+    void *ptr = start + node;
+    addr_t terminal_size = read_uleb128(&ptr, end);
+    if(terminal_size > (size_t) (end - (char *) ptr)) {
+        die("terminal overflows the export trie");
+    }
+    void *children = (char *) ptr + terminal_size;
+    // names that end here sort first
+    if(terminal_size && !names[lo][depth]) {
+        struct macho_export ex;
+        read_export_terminal(&ex, ptr, children, names[lo]);
+        if(!(ex.flags & EXPORT_SYMBOL_FLAGS_INDIRECT_DEFINITION)) {
+            ex.address += binary->mach->export_baseaddr;
+        }
+        addr_t result = resolve_export(binary, &ex, options);
+        while(lo < hi && !names[lo][depth]) results[lo++] = result;
+    }
+    while(lo < hi && !names[lo][depth]) lo++;
+
+    ptr = children;
     uint8_t child_count = read_int(&ptr, end, uint8_t);
-    while(child_count--) {
-        const char *name2 = name;
-        char c;
-        while(1) {
-            c = read_int(&ptr, end, char);
-            if(!c) {
-                uint64_t offset = read_uleb128(&ptr, end);
-                if(offset >= (size_t) (end - start)) die("invalid child offset");
-                return trie_recurse(binary, start + offset, start, end, name0, name2, options);
-            }
-            if(c != *name2++) {
-                break;
+    while(child_count-- && lo < hi) {
+        char *edge = read_cstring(&ptr, end);
+        addr_t offset = read_uleb128(&ptr, end);
+        if(offset >= (size_t) (end - start)) die("invalid child offset");
+        size_t edge_len = strlen(edge);
+
+        // the names under this edge are contiguous
+        uint32_t a = lo;
+        while(a < hi && strncmp(names[a] + depth, edge, edge_len) < 0) a++;
+        uint32_t b = a;
+        while(b < hi && !strncmp(names[b] + depth, edge, edge_len)) b++;
+        trie_descend(binary, (uint32_t) offset, depth + edge_len, level + 1, names, results, a, b, options);
+    }
+}
+
+// flatten once this many lookups have walked the trie
+#define TRIE_WALKS_BEFORE_FLATTENING 32
+
+static addr_t sym_trie(const struct binary *binary, const char *name, int options) {
+    // only a heuristic, but it can be reached from several threads
+    if(!binary->mach->export_table && __atomic_fetch_add(&binary->mach->trie_walks, 1, __ATOMIC_RELAXED) < TRIE_WALKS_BEFORE_FLATTENING) {
+        TRACE_COUNT(TRACE_SYM_TRIE_WALK, 1);
+        addr_t result = 0;
+        trie_descend(binary, 0, 0, 0, &name, &result, 0, 1, options);
+        return result;
+    }
+    TRACE_COUNT(TRACE_SYM_EXPORT_TABLE, 1);
+    const struct export_table *et = b_macho_export_table(binary);
+    const struct strhash_entry *e = strhash_get(&et->index, name);
+    return e ? resolve_export(binary, &et->exports[e->value], options) : 0;
+}
+
+// everything that can be found through binary->reexports, so that a miss (or a hit deep inside an umbrella framework) is one probe
+
+struct namespace_building {
+    struct reexport_namespace *ns;
+    uint32_t cap;
+    // keyed by the bytes of binary->mach, which the shallow copies of one image share
+    struct strhash visited;
+};
+
+static bool namespace_visit(struct namespace_building *nb, const struct binary *binary) {
+    return !binary->mach || strhash_insert(&nb->visited, (const char *) &binary->mach, sizeof(binary->mach), 0);
+}
+
+static void namespace_add(struct namespace_building *nb, const char *name, addr_t plain, addr_t exec) {
+    struct reexport_namespace *ns = nb->ns;
+    if(!plain && !exec) return;
+    if(!strhash_insert(&ns->index, name, strlen(name), ns->count)) return;
+    if(ns->count == nb->cap) {
+        nb->cap = nb->cap ? nb->cap * 2 : 256;
+        ns->addrs = realloc(ns->addrs, nb->cap * sizeof(*ns->addrs));
+    }
+    ns->addrs[ns->count][0] = plain;
+    ns->addrs[ns->count][1] = exec;
+    ns->count++;
+}
+
+// adds what b_sym on binary would find, in the order it would find it
+static void namespace_add_binary(struct namespace_building *nb, const struct binary *binary) {
+    if(!namespace_visit(nb, binary)) return;
+
+    if(binary->mach) {
+        const struct export_table *et = b_macho_export_table(binary);
+        if(et) {
+            for(uint32_t i = 0; i < et->nexports; i++) {
+                const struct macho_export *ex = &et->exports[i];
+                if(ex->flags & 0x10) continue; // resolvers always fail
+                namespace_add(nb, ex->name, resolve_export(binary, ex, 0), resolve_export(binary, ex, TO_EXECUTE));
             }
+            // a trie lookup only reaches the reexports through its own indirect entries, which resolve_export followed
+            return;
+        } else if(binary->mach->ext_symtab) {
+            MACHO_SPECIALIZE_POINTER_SIZE(binary,
+                const nlist_x *nl = (const void *) binary->mach->ext_symtab;
+                for(uint32_t i = 0; i < binary->mach->ext_nsyms; i++, nl++) {
+                    uint32_t strx = nl->n_un.n_strx;
+                    if(strx >= binary->mach->strsize) {
+                        die("insane strx: %u", strx);
+                    }
+                    addr_t exec = nl->n_value;
+                    if(nl->n_desc & N_ARM_THUMB_DEF) exec |= 1;
+                    namespace_add(nb, binary->mach->strtab + strx, nl->n_value, exec);
+                }
+            )
         }
-        // skip the rest
-        read_cstring(&ptr, end);
-        read_uleb128(&ptr, end);
     }
-    return 0;
+    // same order as sym_nlist used to search them in
+    for(unsigned int i = 0; i < binary->nreexports; i++) {
+        namespace_add_binary(nb, &binary->reexports[i]);
+    }
 }
 
-static addr_t sym_trie(const struct binary *binary, const char *name, int options) {
-    return trie_recurse(binary,
-                        binary->mach->export_trie.start,
-                        binary->mach->export_trie.start,
-                        (char *)binary->mach->export_trie.start + binary->mach->export_trie.size,
-                        name,
-                        name,
-                        options);
+static const struct reexport_namespace *reexport_namespace(const struct binary *binary) {
+    if(!binary->mach->reexport_namespace) {
+        struct namespace_building nb = {calloc(1, sizeof(*nb.ns)), 0, {NULL, 0, 0}};
+        strhash_init(&nb.ns->index, 1024);
+        strhash_init(&nb.visited, 16);
+        // don't look at our own symbols, just the ones we reexport
+        namespace_visit(&nb, binary);
+        for(unsigned int i = 0; i < binary->nreexports; i++) {
+            namespace_add_binary(&nb, &binary->reexports[i]);
+        }
+        strhash_free(&nb.visited);
+        binary->mach->reexport_namespace = nb.ns;
+    }
+    return binary->mach->reexport_namespace;
+}
+
+static addr_t sym_reexported(const struct binary *binary, const char *name, int options) {
+    if(!binary->nreexports) return 0;
+    TRACE_COUNT(TRACE_SYM_REEXPORT, 1);
+    const struct reexport_namespace *ns = reexport_namespace(binary);
+    const struct strhash_entry *e = strhash_get(&ns->index, name);
+    return e ? ns->addrs[e->value][(options & TO_EXECUTE) ? 1 : 0] : 0;
+}
+
+static void add_private_syms(struct strhash *h, const struct binary *binary, const void *symtab, uint32_t nsyms, const char *strtab, uint32_t strsize) {
+    MACHO_SPECIALIZE_POINTER_SIZE(binary,
+        const nlist_x *nl = symtab;
+        for(uint32_t i = 0; i < nsyms; i++, nl++) {
+            uint32_t strx = nl->n_un.n_strx;
+            if(strx >= strsize) {
+                die("insane strx: %u", strx);
+            }
+            // the first one wins, like it did when we searched linearly
+            strhash_insert(h, strtab + strx, strnlen(strtab + strx, strsize - strx), (uint64_t) (uintptr_t) nl);
+        }
+    )
+}
+
+static const struct strhash *private_index(const struct binary *binary) {
+    struct mach_binary *mach = binary->mach;
+    if(!mach->private_index) {
+        struct strhash *h = malloc(sizeof(*h));
+        strhash_init(h, (mach->symtab ? mach->nsyms : 0) + mach->local_nsyms);
+        if(mach->symtab) {
+            add_private_syms(h, binary, mach->symtab, mach->nsyms, mach->strtab, mach->strsize);
+        }
+        if(mach->local_symtab) {
+            add_private_syms(h, binary, mach->local_symtab, mach->local_nsyms, mach->local_strtab, mach->local_strsize);
+        }
+        mach->private_index = h;
+    }
+    return mach->private_index;
 }
 
 static addr_t sym_private(const struct binary *binary, const char *name, int options) {
-    if(!binary->mach->symtab) {
+    TRACE_COUNT(TRACE_SYM_PRIVATE, 1);
+    struct mach_binary *mach = binary->mach;
+    if(!mach->symtab && !mach->local_symtab) {
         die("we wanted %s but there is no symbol table", name);
     }
+    const struct strhash_entry *e = strhash_get(private_index(binary), name);
+    if(!e) return 0;
+    addr_t address;
     MACHO_SPECIALIZE_POINTER_SIZE(binary,
-        const nlist_x *base = binary->mach->symtab;
-        for(uint32_t i = 0; i < binary->mach->nsyms; i++) {
-            struct data_sym ds = convert_nlist(binary, base + i, options);
-            if(!strcmp(ds.name, name)) return ds.address;
+        const nlist_x *nl = (const void *) (uintptr_t) e->value;
+        address = nl->n_value;
+        if((options & TO_EXECUTE) && (nl->n_desc & N_ARM_THUMB_DEF)) {
+            address |= 1;
         }
     )
-    return 0;
+    return address;
 }
 
+void b_macho_attach_local_symbols(struct binary *binary, const void *symtab, uint32_t nsyms, const char *strtab, uint32_t strsize) {
+    struct mach_binary *mach = binary->mach;
+    if(nsyms && (!strsize || strtab[strsize - 1])) {
+        die("string table does not end with \\0");
+    }
+    mach->local_symtab = symtab;
+    mach->local_nsyms = nsyms;
+    mach->local_strtab = strtab;
+    mach->local_strsize = strsize;
+    if(mach->private_index) {
+        strhash_free(mach->private_index);
+        free(mach->private_index);
+        mach->private_index = NULL;
+    }
+}
 
-static addr_t sym_imported(const struct binary *binary, const char *name, __unused int options) {
-    // most of this function is copied and pasted from link.c :$
-    CMD_ITERATE(b_mach_hdr(binary), cmd) {
-        MACHO_SPECIALIZE(
-            if(cmd->cmd == LC_SEGMENT_X) {
-                segment_command_x *seg = (void *) cmd;
-                section_x *sect = (void *) (seg + 1);
-                for(uint32_t i = 0; i < seg->nsects; i++, sect++) {
-                    uint8_t type = sect->flags & SECTION_TYPE;
-                    if(type != S_NON_LAZY_SYMBOL_POINTERS && type != S_LAZY_SYMBOL_POINTERS) continue;
-
-                    uint32_t indirect_table_offset = sect->reserved1;
-                    uint32_t *indirect = rangeconv_off((range_t) {binary, (addr_t) (binary->mach->dysymtab->indirectsymoff + indirect_table_offset*sizeof(uint32_t)), (sect->size / 4) * sizeof(uint32_t)}, MUST_FIND).start;
-                    
-                    for(uint32_t i = 0; i < sect->size / 4; i++) {
-                        uint32_t sym = indirect[i];
-                        if(sym == INDIRECT_SYMBOL_LOCAL || sym == INDIRECT_SYMBOL_ABS) continue;
-                        nlist_x *nl = b_macho_nth_symbol(binary, sym);
-                        if(!strcmp(binary->mach->strtab + nl->n_un.n_strx, name)) {
-                            return sect->addr + 4*i;
-                        }
-                    }
-                }
+static void add_import_slots(const struct binary *binary, struct strhash *h, bool stubs) {
+    const struct dysymtab_command *dysymtab = binary->mach->dysymtab;
+    uint8_t pointer_size = b_pointer_size(binary);
+    for(uint32_t i = 0; i < binary->mach->nsections; i++) {
+        const struct data_section *sect = &binary->mach->sections[i];
+        uint8_t type = sect->flags & SECTION_TYPE;
+        uint32_t stride;
+        if(type == S_NON_LAZY_SYMBOL_POINTERS || type == S_LAZY_SYMBOL_POINTERS) {
+            if(stubs) continue;
+            stride = pointer_size;
+        } else if(type == S_SYMBOL_STUBS) {
+            if(!stubs) continue;
+            stride = sect->reserved2;
+            if(!stride) die("zero-sized stubs");
+        } else {
+            continue;
+        }
+
+        uint32_t num_syms = (uint32_t) (sect->vm_range.size / stride);
+        uint32_t indirect_table_offset = sect->reserved1;
+        if(indirect_table_offset > dysymtab->nindirectsyms || num_syms > dysymtab->nindirectsyms - indirect_table_offset) {
+            die("bad indirect section");
+        }
+        uint32_t *indirect = rangeconv_off((range_t) {binary, (addr_t) (dysymtab->indirectsymoff + indirect_table_offset*sizeof(uint32_t)), num_syms * sizeof(uint32_t)}, MUST_FIND).start;
+
+        MACHO_SPECIALIZE_POINTER_SIZE(binary,
+            for(uint32_t j = 0; j < num_syms; j++) {
+                uint32_t sym = indirect[j];
+                if(sym & (INDIRECT_SYMBOL_LOCAL | INDIRECT_SYMBOL_ABS)) continue;
+                nlist_x *nl = b_macho_nth_symbol(binary, sym);
+                const char *name = binary->mach->strtab + nl->n_un.n_strx;
+                // the first slot wins, like it did when we searched linearly
+                strhash_insert(h, name, strlen(name), sect->vm_range.start + (addr_t) stride * j);
             }
         )
     }
-    return 0;
+}
+
+static const struct strhash *import_slots(const struct binary *binary) {
+    if(!binary->mach->import_slots) {
+        struct strhash *h = malloc(sizeof(*h));
+        strhash_init(h, binary->mach->imp_nsyms);
+        if(binary->mach->symtab && binary->mach->dysymtab) {
+            // pointers take precedence over stubs
+            add_import_slots(binary, h, false);
+            add_import_slots(binary, h, true);
+        }
+        binary->mach->import_slots = h;
+    }
+    return binary->mach->import_slots;
+}
+
+static addr_t sym_imported(const struct binary *binary, const char *name, __unused int options) {
+    TRACE_COUNT(TRACE_SYM_IMPORTED, 1);
+    const struct strhash_entry *e = strhash_get(import_slots(binary), name);
+    return e ? (addr_t) e->value : 0;
 }
 
 static addr_t sym(const struct binary *binary, const char *name, int options) {
@@ -385,63 +770,334 @@ static addr_t sym(const struct binary *binary, const char *name, int options) {
     return func(binary, name, options & ~MUST_FIND);
 }
 
-static void copy_syms(const struct binary *binary, struct data_sym **syms, uint32_t *nsyms, int options) {
+static void prepare_binary(struct strhash *visited, const struct binary *binary, int options) {
+    // the caches live in binary->mach, so that's what identifies a binary (see namespace_visit)
+    if(!binary->mach || !strhash_insert(visited, (const char *) &binary->mach, sizeof(binary->mach), 0)) return;
+
+    if(options & PRIVATE_SYM) {
+        private_index(binary);
+        return;
+    } else if(options & IMPORTED_SYM) {
+        import_slots(binary);
+        return;
+    }
+    // with the table there, sym_trie stops counting walks
+    b_macho_export_table(binary);
+    if(binary->nreexports) {
+        reexport_namespace(binary);
+    }
+    // indirect exports are resolved with b_sym on the reexports
+    for(unsigned int i = 0; i < binary->nreexports; i++) {
+        prepare_binary(visited, &binary->reexports[i], options);
+    }
+}
+
+void b_macho_prepare_concurrent_sym(const struct binary *binary, int options) {
+    struct strhash visited;
+    strhash_init(&visited, 16);
+    prepare_binary(&visited, binary, options);
+    strhash_free(&visited);
+}
+
+static void sym_many(const struct binary *binary, const char **names, addr_t *results, uint32_t count, int options) {
+    options &= ~MUST_FIND;
+    bool sorted = true;
+    for(uint32_t i = 1; i < count && sorted; i++) {
+        sorted = strcmp(names[i - 1], names[i]) <= 0;
+    }
+    if((options & (PRIVATE_SYM | IMPORTED_SYM)) || !binary->mach->export_trie.start || binary->mach->export_table || !sorted || count >= TRIE_WALKS_BEFORE_FLATTENING) {
+        for(uint32_t i = 0; i < count; i++) {
+            results[i] = sym(binary, names[i], options);
+        }
+        return;
+    }
+    // not worth flattening; walk the trie once for all of them
+    TRACE_COUNT(TRACE_SYM_TRIE_BATCH, count);
+    memset(results, 0, count * sizeof(*results));
+    trie_descend(binary, 0, 0, 0, names, results, 0, count, options);
+}
+
+void b_macho_each_sym(const struct binary *binary, int options, bool (*visit)(void *context, const struct data_sym *sym), void *context) {
     uint32_t n;
-    const void *nl;
-    size_t size;
-    MACHO_SPECIALIZE_POINTER_SIZE(binary, size = sizeof(nlist_x);)
+    const void *nl_;
     bool can_be_zero = false;
+    if(!(options & (PRIVATE_SYM | IMPORTED_SYM)) && binary->mach->export_trie.start) {
+        const struct export_table *et = b_macho_export_table(binary);
+        for(uint32_t i = 0; i < et->nexports; i++) {
+            struct data_sym ds = {et->exports[i].name, resolve_export(binary, &et->exports[i], options)};
+            if(!ds.address) continue;
+            if(!visit(context, &ds)) return;
+        }
+        return;
+    }
     if(options & PRIVATE_SYM) {
-        nl = binary->mach->symtab;
+        nl_ = binary->mach->symtab;
         n = binary->mach->nsyms;
     } else if(options & IMPORTED_SYM) {
-        nl = binary->mach->imp_symtab;
+        nl_ = binary->mach->imp_symtab;
         n = binary->mach->imp_nsyms;
         can_be_zero = true;
     } else {
-        nl = binary->mach->ext_symtab;
+        nl_ = binary->mach->ext_symtab;
+        n = binary->mach->ext_nsyms;
+    }
+    const char *strtab = binary->mach->strtab;
+    uint32_t strsize = binary->mach->strsize;
+    bool to_execute = options & TO_EXECUTE;
+    MACHO_SPECIALIZE_POINTER_SIZE(binary,
+        const nlist_x *nl = nl_;
+        for(uint32_t i = 0; i < n; i++, nl++) {
+            uint32_t strx = nl->n_un.n_strx;
+            if(strx >= strsize) {
+                die("insane strx: %u", strx);
+            }
+            struct data_sym ds = {strtab + strx, nl->n_value};
+            if(to_execute && (nl->n_desc & N_ARM_THUMB_DEF)) {
+                ds.address |= 1;
+            }
+            if(!can_be_zero && !ds.address) continue;
+            if(!visit(context, &ds)) return;
+        }
+    )
+}
+
+static bool append_sym(void *context, const struct data_sym *sym) {
+    struct data_sym **s = context;
+    *(*s)++ = *sym;
+    return true;
+}
+
+static void copy_syms(const struct binary *binary, struct data_sym **syms, uint32_t *nsyms, int options) {
+    uint32_t n;
+    if(options & PRIVATE_SYM) {
+        n = binary->mach->nsyms;
+    } else if(options & IMPORTED_SYM) {
+        n = binary->mach->imp_nsyms;
+    } else if(binary->mach->export_trie.start) {
+        n = b_macho_export_table(binary)->nexports;
+    } else {
         n = binary->mach->ext_nsyms;
     }
     struct data_sym *s = *syms = malloc(sizeof(struct data_sym) * n);
+    b_macho_each_sym(binary, options, append_sym, &s);
+    *nsyms = s - *syms;
+}
+
+const struct sym_view *b_macho_sym_view(const struct binary *binary) {
+    if(binary->mach->sym_view) {
+        return binary->mach->sym_view;
+    }
+    uint32_t n = binary->mach->symtab ? binary->mach->nsyms : 0;
+    // one allocation; the columns are in decreasing order of alignment
+    size_t row = sizeof(addr_t) + sizeof(uint32_t) + sizeof(uint16_t) + 2 * sizeof(uint8_t);
+    if(n > (SIZE_MAX - sizeof(struct sym_view)) / row) {
+        die("ridiculous number of symbols (%u)", n);
+    }
+    struct sym_view *view = malloc(sizeof(*view) + n * row);
+    view->count = n;
+    view->addrs = (void *) (view + 1);
+    view->strx = (void *) (view->addrs + n);
+    view->descs = (void *) (view->strx + n);
+    view->types = (void *) (view->descs + n);
+    view->sects = view->types + n;
+    MACHO_SPECIALIZE_POINTER_SIZE(binary,
+        const nlist_x *nl = binary->mach->symtab;
+        for(uint32_t i = 0; i < n; i++, nl++) {
+            view->addrs[i] = nl->n_value;
+            view->strx[i] = nl->n_un.n_strx;
+            view->descs[i] = nl->n_desc;
+            view->types[i] = nl->n_type;
+            view->sects[i] = nl->n_sect;
+        }
+    )
     for(uint32_t i = 0; i < n; i++) {
-        *s = convert_nlist(binary, nl, options);
-        nl += size;
-        if(can_be_zero || s->address) s++;
+        if(view->strx[i] >= binary->mach->strsize) {
+            die("insane strx: %u", view->strx[i]);
+        }
     }
-    *nsyms = s - *syms;
+    binary->mach->sym_view = view;
+    return view;
 }
 
-range_t b_macho_segrange(const struct binary *binary, const char *segname) {
-    CMD_ITERATE(b_mach_hdr(binary), cmd) {
-        MACHO_SPECIALIZE(
-            if(cmd->cmd == LC_SEGMENT_X) {
-                segment_command_x *seg = (void *) cmd;
-                if(!strncmp(seg->segname, segname, 16)) {
-                    return (range_t) {binary, seg->vmaddr, seg->filesize};
+uint32_t b_macho_sym_view_filter(const struct sym_view *view, addr_t start, addr_t end, uint8_t type_mask, uint8_t type, uint32_t *out) {
+    // no branches in here, so that the compiler has a chance
+    uint32_t count = 0;
+    for(uint32_t i = 0; i < view->count; i++) {
+        addr_t a = view->addrs[i];
+        bool match = (a - start < end - start) & ((view->types[i] & type_mask) == type);
+        out[count] = i;
+        count += match;
+    }
+    return count;
+}
+
+// address -> symbol
+
+struct symbol_index_building {
+    addr_t address;
+    const char *name;
+    uint8_t priority;
+    bool thumb;
+};
+
+static int compare_building(const void *a_, const void *b_) {
+    const struct symbol_index_building *a = a_, *b = b_;
+    if(a->address != b->address) return a->address < b->address ? -1 : 1;
+    return (int) a->priority - (int) b->priority;
+}
+
+static struct symbol_index *build_symbol_index(const struct binary *binary) {
+    bool arm = binary->cputype == CPU_TYPE_ARM;
+    size_t n = 0, cap = 256;
+    struct symbol_index_building *b = malloc(cap * sizeof(*b));
+    #define ADD(address_, name_, priority_, thumb_) do { \
+        if(n == cap) { \
+            if(cap > MAX_ARRAY(*b) / 2) die("too many symbols"); \
+            cap *= 2; \
+            b = realloc(b, cap * sizeof(*b)); \
+        } \
+        b[n++] = (struct symbol_index_building) {(address_), (name_), (priority_), (thumb_)}; \
+    } while(0)
+
+    if(binary->mach->symtab) {
+        MACHO_SPECIALIZE_POINTER_SIZE(binary,
+            const nlist_x *nl = binary->mach->symtab;
+            for(uint32_t i = 0; i < binary->mach->nsyms; i++, nl++) {
+                if((nl->n_type & N_STAB) || (nl->n_type & N_TYPE) != N_SECT) continue;
+                if((uint32_t) nl->n_un.n_strx >= binary->mach->strsize) {
+                    die("insane strx: %u", (uint32_t) nl->n_un.n_strx);
                 }
+                bool thumb = arm && ((nl->n_desc & N_ARM_THUMB_DEF) || (nl->n_value & 1));
+                ADD(arm ? nl->n_value & ~(addr_t) 1 : nl->n_value, binary->mach->strtab + nl->n_un.n_strx, (nl->n_type & N_EXT) ? 0 : 1, thumb);
             }
         )
     }
-    die("no such segment %s", segname);
-}
 
-range_t b_macho_sectrange(const struct binary *binary, const char *segname, const char *sectname) {
+    const struct export_table *et = b_macho_export_table(binary);
+    if(et) {
+        for(uint32_t i = 0; i < et->nexports; i++) {
+            const struct macho_export *ex = &et->exports[i];
+            if(ex->flags & (EXPORT_SYMBOL_FLAGS_INDIRECT_DEFINITION | 0x10)) continue;
+            ADD(arm ? ex->address & ~(addr_t) 1 : ex->address, ex->name, 0, arm && (ex->address & 1));
+        }
+    }
+
     CMD_ITERATE(b_mach_hdr(binary), cmd) {
-        MACHO_SPECIALIZE(
-            if(cmd->cmd == LC_SEGMENT_X) {
-                segment_command_x *seg = (void *) cmd;
-                if(!strncmp(seg->segname, segname, 16)) {
-                    section_x *sect = (void *) (seg + 1);
-                    for(uint32_t i = 0; i < seg->nsects; i++) {
-                        if(!strncmp(sect[i].sectname, sectname, 16)) {
-                            return (range_t) {binary, sect->addr, sect->size};
-                        }
-                    }
-                }
+        if(cmd->cmd == LC_FUNCTION_STARTS) {
+            const struct linkedit_data_command *fs = (void *) cmd;
+            prange_t pr = rangeconv_off((range_t) {binary, fs->dataoff, fs->datasize}, MUST_FIND);
+            void *ptr = pr.start, *end = ptr + pr.size;
+            addr_t address = binary->mach->export_baseaddr;
+            while(ptr != end) {
+                addr_t delta = read_uleb128(&ptr, end);
+                if(!delta) break;
+                address += delta;
+                ADD(arm ? address & ~(addr_t) 1 : address, NULL, 2, arm && (address & 1));
             }
-        )
+        }
+    }
+    #undef ADD
+
+    qsort(b, n, sizeof(*b), compare_building);
+
+    struct symbol_index *si = calloc(1, sizeof(*si));
+    si->addrs = malloc(n * sizeof(*si->addrs));
+    si->names = malloc(n * sizeof(*si->names));
+    si->thumb = malloc(n);
+    uint32_t count = 0;
+    for(size_t i = 0; i < n; i++) {
+        // the best one at each address sorts first
+        if(count && si->addrs[count - 1] == b[i].address) continue;
+        si->addrs[count] = b[i].address;
+        si->names[count] = b[i].name;
+        si->thumb[count] = b[i].thumb;
+        count++;
+    }
+    si->count = count;
+    free(b);
+    return si;
+}
+
+const struct symbol_index *b_macho_symbol_index(const struct binary *binary) {
+    if(!binary->mach->symbol_index) {
+        binary->mach->symbol_index = build_symbol_index(binary);
+    }
+    return binary->mach->symbol_index;
+}
+
+static void fill_symbolication(const struct symbol_index *si, uint32_t i, addr_t addr, struct macho_symbolication *out) {
+    out->found = true;
+    out->name = si->names[i];
+    out->start = si->addrs[i];
+    out->offset = addr - si->addrs[i];
+    out->thumb = si->thumb[i];
+}
+
+bool b_macho_symbolicate(const struct binary *binary, addr_t addr, struct macho_symbolication *out) {
+    const struct symbol_index *si = b_macho_symbol_index(binary);
+    if(binary->cputype == CPU_TYPE_ARM) addr &= ~(addr_t) 1;
+    memset(out, 0, sizeof(*out));
+    if(!si->count || addr < si->addrs[0]) return false;
+    // branchless; ends up at the last entry <= addr
+    const addr_t *base = si->addrs;
+    uint32_t n = si->count;
+    while(n > 1) {
+        uint32_t half = n / 2;
+        base = base[half] <= addr ? base + half : base;
+        n -= half;
+    }
+    fill_symbolication(si, (uint32_t) (base - si->addrs), addr, out);
+    return true;
+}
+
+void b_macho_symbolicate_many(const struct binary *binary, const addr_t *addrs, uint32_t count, struct macho_symbolication *out) {
+    const struct symbol_index *si = b_macho_symbol_index(binary);
+    addr_t mask = binary->cputype == CPU_TYPE_ARM ? ~(addr_t) 1 : ~(addr_t) 0;
+    // i is the last entry <= the previous address, or -1
+    int64_t i = -1;
+    for(uint32_t a = 0; a < count; a++) {
+        addr_t addr = addrs[a] & mask;
+        if(a && addr < (addrs[a - 1] & mask)) die("addresses aren't sorted");
+        // gallop forward, then binary search the last step
+        uint32_t step = 1;
+        while(i + step < si->count && si->addrs[i + step] <= addr) {
+            i += step;
+            step *= 2;
+        }
+        while(step > 1) {
+            step /= 2;
+            if(i + step < si->count && si->addrs[i + step] <= addr) i += step;
+        }
+        if(i < 0) {
+            memset(&out[a], 0, sizeof(out[a]));
+        } else {
+            fill_symbolication(si, (uint32_t) i, addr, &out[a]);
+        }
+    }
+}
+
+const struct data_section *b_macho_section(const struct binary *binary, const char *segname, const char *sectname) {
+    char key[32];
+    section_key(key, segname, sectname);
+    const struct strhash_entry *e = strhash_lookup(&binary->mach->section_index, key, 32);
+    return e ? &binary->mach->sections[e->value] : NULL;
+}
+
+range_t b_macho_segrange(const struct binary *binary, const char *segname) {
+    const struct strhash_entry *e = strhash_lookup(&binary->mach->segment_index, segname, strnlen(segname, 16));
+    if(!e) {
+        die("no such segment %s", segname);
+    }
+    const struct data_segment *seg = &binary->segments[e->value];
+    return (range_t) {binary, seg->vm_range.start, seg->file_range.size};
+}
+
+range_t b_macho_sectrange(const struct binary *binary, const char *segname, const char *sectname) {
+    const struct data_section *sect = b_macho_section(binary, segname, sectname);
+    if(!sect) {
+        die("no such section %s,%s", segname, sectname);
     }
-    die("no such segment %s", segname);
+    return sect->vm_range;
 }
 
 void b_load_macho(struct binary *binary, const char *filename) {
@@ -463,6 +1119,45 @@ addr_t b_macho_reloc_base(const struct binary *binary) {
     die("no segments");
 }
 
+void b_macho_forget_caches(struct binary *binary) {
+    struct mach_binary *mach = binary->mach;
+    if(!mach) return;
+    mach->hdr = b_mach_hdr(binary);
+    do_sections(binary);
+    if(mach->import_slots) {
+        strhash_free(mach->import_slots);
+        free(mach->import_slots);
+        mach->import_slots = NULL;
+    }
+    if(mach->export_table) {
+        strhash_free(&mach->export_table->index);
+        free(mach->export_table->exports);
+        free(mach->export_table);
+        mach->export_table = NULL;
+    }
+    mach->trie_walks = 0;
+    if(mach->private_index) {
+        strhash_free(mach->private_index);
+        free(mach->private_index);
+        mach->private_index = NULL;
+    }
+    if(mach->symbol_index) {
+        free(mach->symbol_index->addrs);
+        free(mach->symbol_index->names);
+        free(mach->symbol_index->thumb);
+        free(mach->symbol_index);
+        mach->symbol_index = NULL;
+    }
+    free(mach->sym_view);
+    mach->sym_view = NULL;
+    if(mach->reexport_namespace) {
+        strhash_free(&mach->reexport_namespace->index);
+        free(mach->reexport_namespace->addrs);
+        free(mach->reexport_namespace);
+        mach->reexport_namespace = NULL;
+    }
+}
+
 const char *convert_lc_str(const struct load_command *cmd, uint32_t offset) {
     const char *ret = ((const char *) cmd) + offset;
     size_t size = cmd->cmdsize - offset;
@@ -1,6 +1,7 @@
 #pragma once
 #include "../binary.h"
 #include "headers/loader.h"
+#include "../strhash.h"
 
 #define CMD_ITERATE(hdr, cmd) \
     for(struct load_command *cmd = \
@@ -31,6 +32,64 @@
 #define MACHO_SPECIALIZE_POINTER_SIZE(binary, text...) _MACHO_SPECIALIZE_32(text)
 #endif
 
+struct macho_export {
+    const char *name;
+    addr_t address; // a library ordinal if flags has EXPORT_SYMBOL_FLAGS_INDIRECT_DEFINITION
+    uint32_t flags;
+    const char *reexport_name; // NULL if it's the same as name
+};
+
+struct export_table {
+    struct macho_export *exports;
+    uint32_t nexports;
+    const char *names; // owned by the binary
+    struct strhash index;
+};
+
+// every defined symbol, export and LC_FUNCTION_STARTS entry, sorted by address (without the thumb bit)
+struct symbol_index {
+    addr_t *addrs;
+    const char **names; // NULL for function starts that have no symbol
+    uint8_t *thumb;
+    uint32_t count;
+};
+
+struct macho_symbolication {
+    bool found;
+    bool thumb;
+    const char *name;
+    addr_t start;
+    addr_t offset;
+};
+
+// names point into the reexported binaries, so they have to stick around
+struct reexport_namespace {
+    struct strhash index;
+    addr_t (*addrs)[2]; // without and with TO_EXECUTE
+    uint32_t count;
+};
+
+struct data_section {
+    char names[32]; // sectname, then segname, each padded with zeroes like in struct section
+    range_t vm_range;
+    range_t file_range; // empty for zerofill
+    uint32_t flags;
+    uint32_t reserved1, reserved2;
+    uint32_t reloff, nreloc;
+    uint32_t segment; // index into binary->segments
+    void *native_section;
+};
+
+// the whole symbol table, as columns
+struct sym_view {
+    uint32_t count;
+    addr_t *addrs;
+    uint32_t *strx; // into strtab
+    uint16_t *descs;
+    uint8_t *types;
+    uint8_t *sects;
+};
+
 struct mach_binary {
     // this is unnecessary, don't use it
     struct mach_header *hdr;
@@ -52,6 +111,35 @@ struct mach_binary {
     char *strtab;
     uint32_t strsize;
     const struct dysymtab_command *dysymtab;
+
+    // LC_DYLD_CHAINED_FIXUPS, which replaces dyld_info's rebase and bind opcodes
+    const struct linkedit_data_command *chained_fixups;
+
+    // symbols that live outside the binary, like a dyld cache's local symbols; see b_macho_attach_local_symbols
+    const void *local_symtab;
+    uint32_t local_nsyms;
+    const char *local_strtab;
+    uint32_t local_strsize;
+
+    // every section, in load command order; built at load time
+    struct data_section *sections;
+    uint32_t nsections;
+    struct strhash section_index, segment_index;
+
+    // lazily built caches; see b_macho_forget_caches
+    struct strhash *import_slots;
+    struct export_table *export_table;
+    uint32_t trie_walks;
+    struct symbol_index *symbol_index;
+    struct sym_view *sym_view;
+    struct reexport_namespace *reexport_namespace;
+    struct strhash *private_index; // name -> nlist, for PRIVATE_SYM
+
+    // the export table's names.  they are never freed, since b_copy_syms and b_macho_symbolicate results point into them: flattening the same trie again reuses them, but every time the trie's contents change (not just its place in memory), the old names stay behind on old_export_names
+    char *export_names;
+    size_t export_names_size;
+    char **old_export_names;
+    uint32_t nold_export_names;
 };
 
 __BEGIN_DECLS
@@ -60,6 +148,8 @@ static inline struct mach_header *b_mach_hdr(const struct binary *binary) {
     return (struct mach_header *) (binary->valid_range.start + binary->header_offset);
 }
 
+// NULL if there is no such section
+const struct data_section *b_macho_section(const struct binary *binary, const char *segname, const char *sectname);
 __attribute__((pure)) range_t b_macho_segrange(const struct binary *binary, const char *segname);
 __attribute__((pure)) range_t b_macho_sectrange(const struct binary *binary, const char *segname, const char *sectname);
 
@@ -68,10 +158,34 @@ void b_prange_load_macho_nosyms(struct binary *binary, prange_t range, size_t of
 
 void b_load_macho(struct binary *binary, const char *filename);
 
+// NULL if there is no export trie
+const struct export_table *b_macho_export_table(const struct binary *binary);
+
+// b_sym and b_sym_many build caches on first use, so they must not run on the same binary from several threads at once, except with these options after this has been called (and until b_macho_forget_caches).  it builds them up front for binary and, for plain exports, everything it reexports
+void b_macho_prepare_concurrent_sym(const struct binary *binary, int options);
+
+// calls visit for each symbol b_copy_syms would return, without copying anything; names point into strtab, or for exports of a binary with an export trie, into its export names (with reexports resolved).  stops if visit returns false
+void b_macho_each_sym(const struct binary *binary, int options, bool (*visit)(void *context, const struct data_sym *sym), void *context);
+const struct sym_view *b_macho_sym_view(const struct binary *binary);
+// puts the indices of symbols with start <= address < end and (n_type & type_mask) == type into out (which needs room for view->count), and returns how many
+uint32_t b_macho_sym_view_filter(const struct sym_view *view, addr_t start, addr_t end, uint8_t type_mask, uint8_t type, uint32_t *out);
+
+const struct symbol_index *b_macho_symbol_index(const struct binary *binary);
+// find the closest symbol at or before addr; false if there isn't one
+bool b_macho_symbolicate(const struct binary *binary, addr_t addr, struct macho_symbolication *out);
+// same thing for a lot of addresses, which must be sorted
+void b_macho_symbolicate_many(const struct binary *binary, const addr_t *addrs, uint32_t count, struct macho_symbolication *out);
+
 void *b_macho_nth_symbol(const struct binary *binary, uint32_t n);
 
 addr_t b_macho_reloc_base(const struct binary *binary);
 
+// call this after changing the load commands or the symbol tables (b_relocate does it for you).  names handed out by b_copy_syms and b_macho_symbolicate stay valid, so if the export trie's contents changed, the old names are kept (see export_names)
+void b_macho_forget_caches(struct binary *binary);
+
+// PRIVATE_SYM lookups also search these nlists (after the binary's own symbol table); nothing is copied
+void b_macho_attach_local_symbols(struct binary *binary, const void *symtab, uint32_t nsyms, const char *strtab, uint32_t strsize);
+
 const char *convert_lc_str(const struct load_command *cmd, uint32_t offset);
 __END_DECLS
 
@@ -0,0 +1,333 @@
+#include "codesign.h"
+#include "headers/loader.h"
+#include "headers/cs_blobs.h"
+#include "../sha.h"
+
+#define CS_PAGE_SHIFT 12
+#define CS_PAGE_SIZE (1u << CS_PAGE_SHIFT)
+#define PAGES_PER_CHUNK 64
+
+struct sign_cmds {
+    struct load_command *text, *linkedit; // segment commands
+    struct linkedit_data_command *sig;
+    addr_t text_off, text_size;
+    addr_t linkedit_off, linkedit_size;
+    addr_t other_end; // the end of everything in the file that isn't __LINKEDIT
+    addr_t first_data; // the lowest offset of anything that isn't the header
+};
+
+static void find_cmds(const struct binary *binary, struct sign_cmds *sc) {
+    memset(sc, 0, sizeof(*sc));
+    sc->first_data = binary->valid_range.size;
+    CMD_ITERATE(b_mach_hdr(binary), cmd) {
+        MACHO_SPECIALIZE(
+            if(cmd->cmd == LC_SEGMENT_X) {
+                segment_command_x *seg = (void *) cmd;
+                if(!strncmp(seg->segname, "__LINKEDIT", 16)) {
+                    sc->linkedit = cmd;
+                    sc->linkedit_off = seg->fileoff;
+                    sc->linkedit_size = seg->filesize;
+                    continue;
+                }
+                if(!strncmp(seg->segname, "__TEXT", 16)) {
+                    sc->text = cmd;
+                    sc->text_off = seg->fileoff;
+                    sc->text_size = seg->filesize;
+                }
+                if(seg->filesize && seg->fileoff + seg->filesize > sc->other_end) {
+                    sc->other_end = seg->fileoff + seg->filesize;
+                }
+                if(seg->filesize && seg->fileoff && seg->fileoff < sc->first_data) {
+                    sc->first_data = seg->fileoff;
+                }
+                section_x *sect = (void *) (seg + 1);
+                for(uint32_t i = 0; i < seg->nsects; i++, sect++) {
+                    if(sect->size && sect->offset && sect->offset < sc->first_data) {
+                        sc->first_data = sect->offset;
+                    }
+                }
+            }
+        )
+        if(cmd->cmd == LC_CODE_SIGNATURE) {
+            sc->sig = (void *) cmd;
+        }
+    }
+}
+
+// which code pages of [start, start + npages * CS_PAGE_SIZE) have been written to since they were mapped; NULL if we can't tell
+static bool *dirty_pages(const void *start, size_t npages) {
+    uintptr_t os_page = (uintptr_t) sysconf(_SC_PAGESIZE);
+    uintptr_t lo = (uintptr_t) start & ~(os_page - 1);
+    uintptr_t hi = ((uintptr_t) start + npages * CS_PAGE_SIZE + os_page - 1) & ~(os_page - 1);
+    size_t n = (hi - lo) / os_page;
+    autofree bool *os_dirty = malloc(n);
+#if defined(__APPLE__)
+    autofree char *vec = malloc(n);
+    if(mincore((void *) lo, hi - lo, vec)) return NULL;
+    int mask = MINCORE_MODIFIED | MINCORE_MODIFIED_OTHER;
+#ifdef MINCORE_COPIED
+    mask |= MINCORE_COPIED | MINCORE_PAGED_OUT;
+#endif
+    for(size_t i = 0; i < n; i++) {
+        os_dirty[i] = vec[i] & mask;
+    }
+#elif defined(__linux__)
+    // bit 63 is present, 62 is swapped, 61 is file-backed; a written MAP_PRIVATE page is anonymous
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if(fd == -1) return NULL;
+    autofree uint64_t *ent = malloc(n * sizeof(uint64_t));
+    ssize_t want = (ssize_t) (n * sizeof(uint64_t));
+    ssize_t got = pread(fd, ent, want, (off_t) (lo / os_page * sizeof(uint64_t)));
+    close(fd);
+    if(got != want) return NULL;
+    for(size_t i = 0; i < n; i++) {
+        os_dirty[i] = (ent[i] >> 62 & 1) || ((ent[i] >> 63 & 1) && !(ent[i] >> 61 & 1));
+    }
+#else
+    return NULL;
+#endif
+    bool *dirty = malloc(npages);
+    for(size_t i = 0; i < npages; i++) {
+        uintptr_t p = (uintptr_t) start + i * CS_PAGE_SIZE;
+        dirty[i] = false;
+        for(size_t j = (p - lo) / os_page; j <= (p + CS_PAGE_SIZE - 1 - lo) / os_page; j++) {
+            dirty[i] |= os_dirty[j];
+        }
+    }
+    return dirty;
+}
+
+// the code slots of the CodeDirectory in sig with this hash type, if it covers exactly the same pages
+static const uint8_t *old_hashes(prange_t sig, uint8_t hash_type, uint8_t hash_size, uint32_t code_limit, uint32_t nslots) {
+    const CS_SuperBlob *sb = sig.start;
+    if(sig.size < sizeof(*sb) || swap32(sb->magic) != CSMAGIC_EMBEDDED_SIGNATURE) return NULL;
+    uint32_t count = swap32(sb->count);
+    if(count > (sig.size - sizeof(*sb)) / sizeof(CS_BlobIndex)) return NULL;
+    for(uint32_t i = 0; i < count; i++) {
+        uint32_t type = swap32(sb->index[i].type), offset = swap32(sb->index[i].offset);
+        if(type != CSSLOT_CODEDIRECTORY && (type < CSSLOT_ALTERNATE_CODEDIRECTORIES || type >= CSSLOT_ALTERNATE_CODEDIRECTORY_LIMIT)) continue;
+        if(offset > sig.size || sig.size - offset < sizeof(CS_CodeDirectory)) continue;
+        const CS_CodeDirectory *cd = sig.start + offset;
+        uint32_t length = swap32(cd->length), hash_offset = swap32(cd->hashOffset);
+        if(swap32(cd->magic) != CSMAGIC_CODEDIRECTORY || length > sig.size - offset) continue;
+        if(cd->hashType != hash_type || cd->hashSize != hash_size || cd->pageSize != CS_PAGE_SHIFT) continue;
+        if(swap32(cd->codeLimit) != code_limit || swap32(cd->nCodeSlots) != nslots) continue;
+        if(hash_offset > length || (length - hash_offset) / hash_size < nslots) continue;
+        return (const uint8_t *) cd + hash_offset;
+    }
+    return NULL;
+}
+
+struct sign_cd {
+    uint8_t hash_type, hash_size;
+    uint32_t slot;
+    uint32_t offset, size; // in the superblob
+    uint32_t nspecial;
+    uint8_t *hashes; // code slot 0
+    const uint8_t *old;
+};
+
+struct sign_ctx {
+    const uint8_t *base;
+    uint32_t code_limit;
+    uint32_t npages;
+    const bool *dirty;
+    struct sign_cd *cds;
+    unsigned ncds;
+};
+
+static void do_hash(uint8_t type, const void *data, size_t size, uint8_t *out) {
+    if(type == CS_HASHTYPE_SHA1) {
+        sha1(data, size, out);
+    } else {
+        sha256(data, size, out);
+    }
+}
+
+static void hash_chunk(void *ctx_, size_t chunk) {
+    struct sign_ctx *ctx = ctx_;
+    uint32_t start = (uint32_t) chunk * PAGES_PER_CHUNK;
+    uint32_t end = start + PAGES_PER_CHUNK < ctx->npages ? start + PAGES_PER_CHUNK : ctx->npages;
+    for(uint32_t i = start; i < end; i++) {
+        size_t off = (size_t) i * CS_PAGE_SIZE;
+        size_t size = ctx->code_limit - off < CS_PAGE_SIZE ? ctx->code_limit - off : CS_PAGE_SIZE;
+        // the header always changes
+        bool clean = i && ctx->dirty && !ctx->dirty[i];
+        for(unsigned c = 0; c < ctx->ncds; c++) {
+            struct sign_cd *cd = &ctx->cds[c];
+            uint8_t *out = cd->hashes + i * cd->hash_size;
+            if(clean && cd->old) {
+                memcpy(out, cd->old + i * cd->hash_size, cd->hash_size);
+            } else {
+                do_hash(cd->hash_type, ctx->base + off, size, out);
+            }
+        }
+    }
+}
+
+static void put_blob_index(CS_SuperBlob *sb, uint32_t i, uint32_t type, uint32_t offset) {
+    sb->index[i].type = swap32(type);
+    sb->index[i].offset = swap32(offset);
+}
+
+void b_macho_sign(struct binary *binary, const char *identifier, prange_t entitlements, int flags) {
+    if(!(flags & (SIGN_SHA1 | SIGN_SHA256))) flags |= SIGN_SHA1 | SIGN_SHA256;
+
+    struct sign_cmds sc;
+    find_cmds(binary, &sc);
+    if(!sc.linkedit) die("no __LINKEDIT to put the signature in");
+    struct mach_header *hdr = b_mach_hdr(binary);
+    if(!sc.sig) {
+        size_t header_size = sizeof(*hdr) + (hdr->magic & 1 ? 4 : 0);
+        if(sc.first_data < binary->header_offset + header_size + hdr->sizeofcmds + sizeof(struct linkedit_data_command)) {
+            die("no room for LC_CODE_SIGNATURE");
+        }
+    }
+    addr_t sigoff = sc.sig ? sc.sig->dataoff : (sc.linkedit_off + sc.linkedit_size + 15) & ~15;
+    if(sigoff < sc.linkedit_off || sigoff < sc.other_end || (sc.sig && sigoff > binary->valid_range.size)) {
+        die("the code signature isn't at the end of __LINKEDIT");
+    }
+    if(sigoff > 0xffffffff) die("binary too big to sign");
+    uint32_t code_limit = (uint32_t) sigoff;
+    uint32_t npages = (uint32_t) ((sigoff + CS_PAGE_SIZE - 1) >> CS_PAGE_SHIFT);
+
+    // work out the layout: CodeDirectories, requirements, entitlements, CMS
+    uint32_t ident_size = (uint32_t) strlen(identifier) + 1;
+    struct sign_cd cds[2];
+    unsigned ncds = 0;
+    if(flags & SIGN_SHA1) cds[ncds++] = (struct sign_cd) {CS_HASHTYPE_SHA1, CS_SHA1_LEN, 0, 0, 0, 0, NULL, NULL};
+    if(flags & SIGN_SHA256) cds[ncds++] = (struct sign_cd) {CS_HASHTYPE_SHA256, CS_SHA256_LEN, 0, 0, 0, 0, NULL, NULL};
+    uint32_t nblobs = ncds + 2 + (entitlements.size ? 1 : 0);
+    uint32_t offset = sizeof(CS_SuperBlob) + nblobs * sizeof(CS_BlobIndex);
+    for(unsigned c = 0; c < ncds; c++) {
+        struct sign_cd *cd = &cds[c];
+        cd->slot = c ? CSSLOT_ALTERNATE_CODEDIRECTORIES + c - 1 : CSSLOT_CODEDIRECTORY;
+        cd->nspecial = entitlements.size ? CSSLOT_ENTITLEMENTS : CSSLOT_REQUIREMENTS;
+        cd->offset = offset;
+        cd->size = sizeof(CS_CodeDirectory) + ident_size + (cd->nspecial + npages) * cd->hash_size;
+        offset += cd->size;
+    }
+    uint32_t req_offset = offset;
+    offset += sizeof(CS_SuperBlob);
+    uint32_t ent_offset = offset;
+    if(entitlements.size > 0xffffff) die("entitlements too big");
+    if(entitlements.size) offset += sizeof(CS_GenericBlob) + (uint32_t) entitlements.size;
+    uint32_t cms_offset = offset;
+    offset += sizeof(CS_GenericBlob);
+    uint32_t sig_length = offset;
+    uint32_t sig_size = (sig_length + 15) & ~15;
+
+    // this has to happen before anything gets written or copied
+    autofree bool *dirty = NULL;
+    if((flags & SIGN_REUSE_CLEAN) && sc.sig) {
+        prange_t old_sig = rangeconv_off((range_t) {binary, sc.sig->dataoff, sc.sig->datasize}, MUST_FIND);
+        for(unsigned c = 0; c < ncds; c++) {
+            cds[c].old = old_hashes(old_sig, cds[c].hash_type, cds[c].hash_size, code_limit, npages);
+        }
+        if(cds[0].old || (ncds > 1 && cds[1].old)) {
+            dirty = dirty_pages(binary->valid_range.start, npages);
+        }
+        // make sure the old signature was any good by checking the first clean page
+        for(uint32_t i = 1; dirty && i < npages; i++) {
+            if(dirty[i]) continue;
+            size_t size = code_limit - (size_t) i * CS_PAGE_SIZE < CS_PAGE_SIZE ? code_limit - (size_t) i * CS_PAGE_SIZE : CS_PAGE_SIZE;
+            for(unsigned c = 0; c < ncds; c++) {
+                uint8_t hash[CS_SHA256_LEN];
+                do_hash(cds[c].hash_type, binary->valid_range.start + (size_t) i * CS_PAGE_SIZE, size, hash);
+                if(cds[c].old && memcmp(hash, cds[c].old + i * cds[c].hash_size, cds[c].hash_size)) {
+                    cds[c].old = NULL;
+                }
+            }
+            break;
+        }
+    }
+
+    size_t new_size = sigoff + sig_size;
+    if(new_size > binary->valid_range.size) {
+        binary->valid_range = pdup(binary->valid_range, new_size, 0);
+    } else {
+        binary->valid_range.size = new_size;
+    }
+    find_cmds(binary, &sc);
+    hdr = b_mach_hdr(binary);
+
+    if(!sc.sig) {
+        sc.sig = (void *) ((char *) (hdr + 1) + (hdr->magic & 1 ? 4 : 0) + hdr->sizeofcmds);
+        sc.sig->cmd = LC_CODE_SIGNATURE;
+        sc.sig->cmdsize = sizeof(struct linkedit_data_command);
+        hdr->ncmds++;
+        hdr->sizeofcmds += sizeof(struct linkedit_data_command);
+    }
+    sc.sig->dataoff = (uint32_t) sigoff;
+    sc.sig->datasize = sig_size;
+    MACHO_SPECIALIZE(
+        if(sc.linkedit->cmd == LC_SEGMENT_X) {
+            segment_command_x *seg = (void *) sc.linkedit;
+            seg->filesize = new_size - seg->fileoff;
+            if(seg->vmsize < seg->filesize) {
+                seg->vmsize = (seg->filesize + 0xfff) & ~0xfff;
+            }
+        }
+    )
+
+    // the old signature may be where the new one goes (or in another buffer), so build this one on the side
+    autofree uint8_t *sig = calloc(1, sig_length);
+    CS_SuperBlob *sb = (void *) sig;
+    sb->magic = swap32(CSMAGIC_EMBEDDED_SIGNATURE);
+    sb->length = swap32(sig_length);
+    sb->count = swap32(nblobs);
+    uint32_t nindex = 0;
+
+    CS_SuperBlob *req = (void *) (sig + req_offset);
+    req->magic = swap32(CSMAGIC_REQUIREMENTS);
+    req->length = swap32(sizeof(CS_SuperBlob));
+    CS_GenericBlob *ent = (void *) (sig + ent_offset);
+    if(entitlements.size) {
+        ent->magic = swap32(CSMAGIC_EMBEDDED_ENTITLEMENTS);
+        ent->length = swap32(sizeof(CS_GenericBlob) + (uint32_t) entitlements.size);
+        memcpy(ent->data, entitlements.start, entitlements.size);
+    }
+    CS_GenericBlob *cms = (void *) (sig + cms_offset);
+    cms->magic = swap32(CSMAGIC_BLOBWRAPPER);
+    cms->length = swap32(sizeof(CS_GenericBlob));
+
+    for(unsigned c = 0; c < ncds; c++) {
+        struct sign_cd *c_ = &cds[c];
+        CS_CodeDirectory *cd = (void *) (sig + c_->offset);
+        uint32_t hash_offset = sizeof(*cd) + ident_size + c_->nspecial * c_->hash_size;
+        cd->magic = swap32(CSMAGIC_CODEDIRECTORY);
+        cd->length = swap32(c_->size);
+        cd->version = swap32(CS_SUPPORTSEXECSEG);
+        cd->flags = swap32(CS_ADHOC);
+        cd->hashOffset = swap32(hash_offset);
+        cd->identOffset = swap32(sizeof(*cd));
+        cd->nSpecialSlots = swap32(c_->nspecial);
+        cd->nCodeSlots = swap32(npages);
+        cd->codeLimit = swap32(code_limit);
+        cd->hashSize = c_->hash_size;
+        cd->hashType = c_->hash_type;
+        cd->pageSize = CS_PAGE_SHIFT;
+        cd->execSegBase = __builtin_bswap64(sc.text_off);
+        cd->execSegLimit = __builtin_bswap64(sc.text_size);
+        cd->execSegFlags = __builtin_bswap64(hdr->filetype == MH_EXECUTE ? CS_EXECSEG_MAIN_BINARY : 0);
+        memcpy(cd + 1, identifier, ident_size);
+        c_->hashes = (uint8_t *) cd + hash_offset;
+        // special slots count down from the code slots
+        do_hash(c_->hash_type, req, sizeof(CS_SuperBlob), c_->hashes - CSSLOT_REQUIREMENTS * c_->hash_size);
+        if(entitlements.size) {
+            do_hash(c_->hash_type, ent, sizeof(CS_GenericBlob) + entitlements.size, c_->hashes - CSSLOT_ENTITLEMENTS * c_->hash_size);
+        }
+        put_blob_index(sb, nindex++, c_->slot, c_->offset);
+        if(!c) {
+            put_blob_index(sb, nindex++, CSSLOT_REQUIREMENTS, req_offset);
+            if(entitlements.size) put_blob_index(sb, nindex++, CSSLOT_ENTITLEMENTS, ent_offset);
+        }
+    }
+    put_blob_index(sb, nindex++, CSSLOT_SIGNATURESLOT, cms_offset);
+
+    struct sign_ctx ctx = {binary->valid_range.start, code_limit, npages, dirty, cds, ncds};
+    parallel_for((npages + PAGES_PER_CHUNK - 1) / PAGES_PER_CHUNK, hash_chunk, &ctx);
+
+    memcpy(binary->valid_range.start + sigoff, sig, sig_length);
+    memset(binary->valid_range.start + sigoff + sig_length, 0, sig_size - sig_length);
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "binary.h"
+
+// flags for b_macho_sign
+#define SIGN_SHA1 1 // a SHA-1 CodeDirectory, for iOS < 11
+#define SIGN_SHA256 2 // a SHA-256 one (as an alternate CodeDirectory if there is also a SHA-1 one); neither flag means both
+#define SIGN_REUSE_CLEAN 4 // keep the old hashes of pages that haven't been written to since they were mapped
+
+__BEGIN_DECLS
+
+// ad-hoc sign binary, like ldid -S, replacing any existing signature; entitlements is the plist (or an empty range).
+// the signature goes at the end of __LINKEDIT, so this may modify binary->valid_range and trash everything else, like b_inject_macho_binary.
+// if there is no LC_CODE_SIGNATURE, there has to be room in the header for one.
+void b_macho_sign(struct binary *binary, const char *identifier, prange_t entitlements, int flags);
+
+__END_DECLS
@@ -3,6 +3,7 @@
 #include "headers/loader.h"
 #include "headers/nlist.h"
 #include "headers/reloc.h"
+#include "../strpool.h"
 #include <stddef.h>
 
 addr_t b_allocate_vmaddr(const struct binary *binary) {
@@ -76,17 +77,24 @@ static void handle_retarded_dyld_info(void *ptr, uint32_t size, int num_segments
 }
 
 
-uint32_t b_macho_extend_cmds(struct binary *binary, size_t space) {
+// how much b_macho_extend_cmds has to prepend to make room for space more bytes of commands (0 if they already fit), and the resulting limit on sizeofcmds
+static size_t extend_cmds_plan(const struct binary *binary, size_t space, uint32_t *limit) {
     size_t old_size = b_mach_hdr(binary)->sizeofcmds;
     size_t new_size = old_size + space;
     if((new_size >> 12) == (old_size >> 12)) {
         // good enough, it'll fit
-        return (new_size + 0xfff) & ~0xfff;
+        *limit = (new_size + 0xfff) & ~0xfff;
+        return 0;
     }
 
     // looks like we need to make a duplicate header and do ugly stuff
     size_t stuff_size = (sizeof(struct mach_header) + sizeof(struct segment_command) + sizeof(struct section) + new_size + 0xfff) & ~0xfff;
+    *limit = stuff_size - sizeof(struct mach_header);
+    return stuff_size;
+}
 
+// move every file offset in the (old) header up by stuff_size
+static void extend_cmds_shift(struct binary *binary, size_t stuff_size) {
     #define X(a) if(a) a += stuff_size;
     CMD_ITERATE(b_mach_hdr(binary), cmd) {
         switch(cmd->cmd) {
@@ -153,8 +161,10 @@ uint32_t b_macho_extend_cmds(struct binary *binary, size_t space) {
         }
     }
     #undef X
+}
 
-    binary->valid_range = pdup(binary->valid_range, ((binary->valid_range.size + 0xfff) & ~0xfff) + stuff_size, stuff_size);
+// binary->valid_range has been moved up by stuff_size; put a copy of the header with an extra segment in front
+static void extend_cmds_header(struct binary *binary, size_t stuff_size) {
     struct mach_header *hdr = binary->valid_range.start;
     struct segment_command *seg = (void *) (hdr + 1);
     struct section *sect = (void *) (seg + 1);
@@ -190,8 +200,17 @@ uint32_t b_macho_extend_cmds(struct binary *binary, size_t space) {
     sect->flags = 0;
     sect->reserved1 = 0;
     sect->reserved2 = 0;
+}
 
-    return stuff_size - sizeof(struct mach_header);
+uint32_t b_macho_extend_cmds(struct binary *binary, size_t space) {
+    uint32_t limit;
+    size_t stuff_size = extend_cmds_plan(binary, space, &limit);
+    if(stuff_size) {
+        extend_cmds_shift(binary, stuff_size);
+        binary->valid_range = pdup(binary->valid_range, ((binary->valid_range.size + 0xfff) & ~0xfff) + stuff_size, stuff_size);
+        extend_cmds_header(binary, stuff_size);
+    }
+    return limit;
 }
 
 
@@ -399,18 +418,6 @@ static void fixup_stub_helpers(int cputype, void *base, size_t size, uint32_t in
     }
 }
 
-void b_inject_macho_binary(struct binary *target, const struct binary *binary, addr_t (*find_hack_func)(const struct binary *binary), bool userland) {
-#define ADD_COMMAND(size) ({ \
-        void *ret = (char *) hdr + sizeof(struct mach_header) + hdr->sizeofcmds; \
-        uint32_t newsize = hdr->sizeofcmds + size; \
-        if(newsize > sizeofcmds_limit) { \
-            die("not enough space for commands"); \
-        } \
-        hdr->ncmds++; \
-        hdr->sizeofcmds += (uint32_t) (size); \
-        ret; \
-    })
-
 #define ADD_SEGMENT(size) ({ \
         uint32_t ret = (seg_off + 0xfff) & ~0xfff; \
         seg_off = ret + (size); \
@@ -422,40 +429,350 @@ void b_inject_macho_binary(struct binary *target, const struct binary *binary, a
         seg_addr = ret + (size); \
         ret; \
     })
-        
+
+// push {r0-r3, lr}; adr lr, f+1; ldr pc, a; f: b next; a: .long 0; next:
+// (the address of the init func)
+static const uint16_t stub_part1[] = {0xb50f, 0xf20f, 0x0e07, 0xf8df, 0xf004, 0xe001};
+// (bytes_to_move bytes of stuff)
+// pop {r0-r3, lr}
+static const uint16_t stub_part2[] = {0xe8bd, 0x400f};
+// ldr pc, [pc]
+static const uint16_t stub_part3[] = {0xf8df, 0xf000};
+static const uint32_t stub_bytes_to_move = 12; // don't cut the MRC in two!
+
+// where everything ends up in the output, worked out before anything is copied so that the output only gets allocated once
+struct inject_layout {
+    size_t stuff_size; // what b_macho_extend_cmds would prepend, or 0
+    uint32_t sizeofcmds_limit;
+    size_t target_size; // how much of the original target is kept
+
+    struct placed_segment {
+        prange_t data;
+        uint32_t fileoff;
+    } *segments; // every payload's, in order
+    unsigned nsegments;
+    unsigned *first_segment; // index into segments of each payload's first, plus one past the end
+
+    uint32_t *init_ptrs;
+    unsigned num_init_ptrs;
+    addr_t hack_func;
+    size_t hack_func_off; // in the output
+    uint32_t stub_off, stub_size, stub_addr;
+
+    uint32_t linkedit_off, linkedit_size, linkedit_addr;
+    struct strpool strings; // everybody's symbol names, deduplicated
+
+    size_t size;
+};
+
+// fills in the missing movemes with empty ones and returns the size of the merged LINKEDIT, not counting the string table
+static uint32_t merged_linkedit_size(struct linkedit_info *li, unsigned nli) {
+    uint32_t newsize = 0;
+    for(int i = 0; i < NMOVEME; i++) {
+        for(unsigned l = 0; l < nli; l++) {
+            struct moveme *m = &li[l].moveme[i];
+            if(!m->size) {
+                static uint32_t zero = 0;
+                m->size = m->off = &zero;
+                m->element_size = 1;
+            }
+            if(m->off_base != -1 && i != MM_STRTAB) {
+                newsize += *m->size * m->element_size;
+            }
+        }
+    }
+    return newsize;
+}
+
+// the merged string table only has the names the moved symbols use, each once
+static uint32_t pool_strings(struct strpool *pool, struct linkedit_info *li, unsigned nli) {
+    strpool_init(pool, 0);
+    for(unsigned l = 0; l < nli; l++) {
+        struct moveme *mm = li[l].moveme;
+        const void *base = li[l].linkedit_ptr - li[l].linkedit_range.start;
+        const struct nlist *symtab = base + *mm[MM_SYMTAB].off;
+        const char *strtab = base + *mm[MM_STRTAB].off;
+        uint32_t strsize = *mm[MM_STRTAB].size;
+        for(int j = MM_LOCALSYM; j <= MM_UNDEFSYM; j++) {
+            for(uint32_t i = 0; i < *mm[j].size; i++) {
+                uint32_t strx = symtab[*mm[j].off + i].n_un.n_strx;
+                if(!strx) continue;
+                if(strx >= strsize || !memchr(strtab + strx, 0, strsize - strx)) {
+                    die("insane strx: %u", strx);
+                }
+                strpool_add(pool, strtab + strx);
+            }
+        }
+    }
+    return strpool_layout(pool, 4);
+}
+
+static bool segments_overlap(const struct segment_command *a, const struct segment_command *b) {
+    return a->vmsize && b->vmsize &&
+           (uint64_t) a->vmaddr < (uint64_t) b->vmaddr + b->vmsize &&
+           (uint64_t) b->vmaddr < (uint64_t) a->vmaddr + a->vmsize;
+}
+
+// each payload keeps its own addresses, so they had better not collide with the target's or an earlier payload's; what says whose seg it is, for the message
+static void check_segment(const struct binary *target, const struct binary *const *binaries, unsigned npayloads, const char *what, const struct segment_command *seg, bool userland) {
+    CMD_ITERATE(b_mach_hdr(target), cmd) {
+        if(cmd->cmd != LC_SEGMENT) continue;
+        const struct segment_command *tseg = (void *) cmd;
+        // the target's LINKEDIT gets merged and moved
+        if(userland && !strcmp(tseg->segname, "__LINKEDIT")) continue;
+        if(segments_overlap(seg, tseg)) {
+            die("%s %.16s (%08x+%x) overlaps the target's %.16s (%08x+%x)", what, seg->segname, seg->vmaddr, seg->vmsize, tseg->segname, tseg->vmaddr, tseg->vmsize);
+        }
+    }
+    for(unsigned q = 0; q < npayloads; q++) {
+        CMD_ITERATE(b_mach_hdr(binaries[q]), cmd) {
+            if(cmd->cmd != LC_SEGMENT) continue;
+            const struct segment_command *qseg = (void *) cmd;
+            if(userland && !strcmp(qseg->segname, "__LINKEDIT")) continue;
+            if(segments_overlap(seg, qseg)) {
+                die("%s %.16s (%08x+%x) overlaps payload %u's %.16s (%08x+%x)", what, seg->segname, seg->vmaddr, seg->vmsize, q, qseg->segname, qseg->vmaddr, qseg->vmsize);
+            }
+        }
+    }
+}
+
+static void check_payload_segment(const struct binary *target, const struct binary *const *binaries, unsigned p, const struct segment_command *seg, bool userland) {
+    char what[32];
+    snprintf(what, sizeof(what), "payload %u's", p);
+    check_segment(target, binaries, p, what, seg, userland);
+}
+
+// the segments injection adds (the new header's __TEXT, the stub, the merged LINKEDIT) go wherever the layout put them, which a payload linked just past the target can be sitting on
+static void check_new_segments(const struct inject_layout *lay, const struct binary *target, const struct binary *const *binaries, unsigned count, bool userland) {
+    struct segment_command segs[3];
+    unsigned nsegs = 0;
+    if(lay->stuff_size) {
+        // where extend_cmds_header will put it
+        segs[nsegs++] = (struct segment_command) {.segname = "__TEXT", .vmaddr = (uint32_t) b_allocate_vmaddr(target), .vmsize = (uint32_t) lay->stuff_size};
+    }
+    if(lay->stub_size) {
+        segs[nsegs++] = (struct segment_command) {.segname = "__CRAP", .vmaddr = lay->stub_addr, .vmsize = lay->stub_size};
+    }
+    if(lay->linkedit_size) {
+        segs[nsegs++] = (struct segment_command) {.segname = "__LINKEDIT", .vmaddr = lay->linkedit_addr, .vmsize = (lay->linkedit_size + 0xfff) & ~0xfff};
+    }
+    for(unsigned i = 0; i < nsegs; i++) {
+        check_segment(target, binaries, count, "the new", &segs[i], userland);
+        for(unsigned j = 0; j < i; j++) {
+            if(segments_overlap(&segs[i], &segs[j])) {
+                die("the new %.16s (%08x+%x) overlaps the new %.16s (%08x+%x)", segs[i].segname, segs[i].vmaddr, segs[i].vmsize, segs[j].segname, segs[j].vmaddr, segs[j].vmsize);
+            }
+        }
+    }
+}
+
+// li has an entry for each payload and then one for the target
+static void plan_injection(struct inject_layout *lay, struct linkedit_info *li, const struct binary *target, const struct binary *const *binaries, unsigned count, addr_t (*find_hack_func)(const struct binary *binary), bool userland) {
+    memset(lay, 0, sizeof(*lay));
+
+    size_t space = 0;
+    for(unsigned p = 0; p < count; p++) {
+        space += b_mach_hdr(binaries[p])->sizeofcmds;
+    }
     // the 0x100 is arbitrary, but intended to please codesign_allocate
-    uint32_t sizeofcmds_limit = b_macho_extend_cmds(target, b_mach_hdr(binary)->sizeofcmds + 0x100);
+    lay->stuff_size = extend_cmds_plan(target, space + 0x100, &lay->sizeofcmds_limit);
 
     size_t seg_off = target->valid_range.size;
+    if(lay->stuff_size) {
+        seg_off = ((seg_off + 0xfff) & ~0xfff) + lay->stuff_size;
+    }
     addr_t seg_addr = 0;
 
-    struct mach_header *hdr = b_mach_hdr(target);
-    hdr->flags &= ~MH_PIE;
-
-    const struct binary *binaries[] = {binary, target};
-    
     // in userland mode, we cut off the LINKEDIT segment  (for target, only if it's at the end of the binary)
-    struct linkedit_info li[2];
     if(userland) {
-        for(int i = 0; i < 2; i++) { 
-            if(catch_linkedit(b_mach_hdr(binaries[i]), &li[i], i == 1)) {
-                li[i].linkedit_ptr = rangeconv_off((range_t) {binaries[i], li[i].linkedit_range.start, li[i].linkedit_range.size}, MUST_FIND).start;
+        for(unsigned i = 0; i <= count; i++) {
+            const struct binary *binary = i == count ? target : binaries[i];
+            if(catch_linkedit(b_mach_hdr(binary), &li[i], false)) {
+                li[i].linkedit_ptr = rangeconv_off((range_t) {binary, li[i].linkedit_range.start, li[i].linkedit_range.size}, MUST_FIND).start;
+            }
+        }
+        if((size_t) (li[count].linkedit_range.start + li[count].linkedit_range.size) + lay->stuff_size == seg_off) {
+            seg_off = li[count].linkedit_range.start + lay->stuff_size;
+        }
+        for(unsigned p = 0; p < count; p++) {
+            if((li[p].dyld_info != 0) != (li[count].dyld_info != 0)) {
+                die("LC_DYLD_INFO(_ONLY) should be in both or neither");
             }
         }
-        if((size_t) (li[1].linkedit_range.start + li[1].linkedit_range.size) == seg_off) {
-            target->valid_range.size = seg_off = li[1].linkedit_range.start;
+    }
+    lay->target_size = seg_off - lay->stuff_size;
+    if(lay->target_size > target->valid_range.size) {
+        lay->target_size = target->valid_range.size;
+    }
+
+    lay->first_segment = malloc((count + 1) * sizeof(*lay->first_segment));
+    unsigned cap_segments = 0, cap_init_ptrs = 0;
+    for(unsigned p = 0; p < count; p++) {
+        const struct binary *binary = binaries[p];
+        lay->first_segment[p] = lay->nsegments;
+        CMD_ITERATE(b_mach_hdr(binary), cmd) {
+            if(cmd->cmd != LC_SEGMENT) continue;
+            const struct segment_command *seg = (void *) cmd;
+
+            if(userland && !strcmp(seg->segname, "__LINKEDIT")) continue;
+            check_payload_segment(target, binaries, p, seg, userland);
+
+            // make seg_addr useful
+            addr_t new_addr = seg->vmaddr + seg->vmsize;
+            if(new_addr > seg_addr) seg_addr = new_addr;
+
+            if(lay->nsegments == cap_segments) {
+                cap_segments = cap_segments ? cap_segments * 2 : 8;
+                lay->segments = realloc(lay->segments, cap_segments * sizeof(*lay->segments));
+            }
+            prange_t pr = rangeconv_off((range_t) {binary, seg->fileoff, seg->filesize}, MUST_FIND);
+            lay->segments[lay->nsegments++] = (struct placed_segment) {pr, (uint32_t) ADD_SEGMENT(pr.size)};
+
+            // ZEROFILL is okay because iBoot always zeroes vmsize - filesize
+            if(userland) continue;
+            const struct section *sections = (void *) (seg + 1);
+            for(uint32_t i = 0; i < seg->nsects; i++) {
+                const struct section *sect = &sections[i];
+                if((sect->flags & SECTION_TYPE) != S_MOD_INIT_FUNC_POINTERS) continue;
+                const uint32_t *ip = rangeconv_off((range_t) {binary, sect->offset, sect->size}, MUST_FIND).start;
+                size_t num = sect->size / 4;
+                if(num > cap_init_ptrs - lay->num_init_ptrs) {
+                    cap_init_ptrs = lay->num_init_ptrs + num;
+                    lay->init_ptrs = realloc(lay->init_ptrs, cap_init_ptrs * sizeof(*lay->init_ptrs));
+                }
+                memcpy(lay->init_ptrs + lay->num_init_ptrs, ip, num * 4);
+                lay->num_init_ptrs += num;
+            }
+        }
+    }
+    lay->first_segment[count] = lay->nsegments;
+
+    // the init pointers (if not userland) get a stub segment that hack_func jumps to
+    if(lay->num_init_ptrs > 0) {
+        if(lay->num_init_ptrs == 1) { // hey, correct plurals are nice
+            fprintf(stderr, "note: 1 constructor function is present; using the hack_func\n");
+        } else {
+            fprintf(stderr, "note: %d constructor functions are present; using the hack_func\n", lay->num_init_ptrs);
+        }
+
+        if(!find_hack_func) {
+            die("...but there was no find_hack_func");
         }
-        if((li[0].dyld_info != 0) != (li[1].dyld_info != 0)) {
-            die("LC_DYLD_INFO(_ONLY) should be in both or neither");
+
+        addr_t hack_func = find_hack_func(target);
+        fprintf(stderr, "hack_func = %08llx\n", (long long) hack_func);
+        prange_t hack_func_pr = rangeconv((range_t) {target, hack_func & ~1, stub_bytes_to_move}, MUST_FIND);
+        if(!(hack_func & 1)) {
+            die("hack func 0x%x is not thumb", hack_func);
+        }
+        lay->hack_func = hack_func;
+        lay->hack_func_off = (char *) hack_func_pr.start - (char *) target->valid_range.start + lay->stuff_size;
+
+        lay->stub_size = (uint32_t) ((sizeof(stub_part1) + 4) * lay->num_init_ptrs + sizeof(stub_part2) + stub_bytes_to_move + sizeof(stub_part3) + 4);
+        lay->stub_addr = ADD_SEGMENT_ADDR(lay->stub_size);
+        lay->stub_off = ADD_SEGMENT(lay->stub_size);
+    }
+
+    if(userland) {
+        lay->linkedit_size = merged_linkedit_size(li, count + 1);
+        lay->linkedit_size += pool_strings(&lay->strings, li, count + 1);
+        if(lay->linkedit_size != 0) {
+            lay->linkedit_off = ADD_SEGMENT(lay->linkedit_size);
+            lay->linkedit_addr = ADD_SEGMENT_ADDR(lay->linkedit_size);
+        }
+    }
+
+    check_new_segments(lay, target, binaries, count, userland);
+
+    lay->size = seg_off;
+}
+
+static void build_stub(const struct inject_layout *lay, void *out) {
+    // ldr pc, [pc]
+    static const uint16_t part0[] = {0xf8df, 0xf000};
+    uint16_t part1[sizeof(stub_part1) / 2];
+    memcpy(part1, stub_part1, sizeof(part1));
+
+    void *hack_func_ptr = out + lay->hack_func_off;
+    void *ptr = out + lay->stub_off;
+    for(unsigned i = 0; i < lay->num_init_ptrs; i++) {
+        memcpy(ptr, part1, sizeof(part1));
+        ptr += sizeof(part1);
+        memcpy(ptr, &lay->init_ptrs[i], 4);
+        ptr += 4;
+        part1[0] = 0x46c0;
+    }
+
+    memcpy(ptr, stub_part2, sizeof(stub_part2));
+    ptr += sizeof(stub_part2);
+
+    memcpy(ptr, hack_func_ptr, stub_bytes_to_move);
+    ptr += stub_bytes_to_move;
+
+    memcpy(ptr, stub_part3, sizeof(stub_part3));
+    ptr += sizeof(stub_part3);
+
+    uint32_t new_addr = lay->hack_func + stub_bytes_to_move;
+    memcpy(ptr, &new_addr, 4);
+
+    new_addr = lay->stub_addr | 1;
+    memcpy(hack_func_ptr, part0, sizeof(part0));
+    memcpy(hack_func_ptr + sizeof(part0), &new_addr, 4);
+}
+
+void b_inject_macho_binary(struct binary *target, const struct binary *binary, addr_t (*find_hack_func)(const struct binary *binary), bool userland) {
+    b_inject_macho_binaries(target, &binary, 1, find_hack_func, userland);
+}
+
+void b_inject_macho_binaries(struct binary *target, const struct binary *const *binaries, unsigned count, addr_t (*find_hack_func)(const struct binary *binary), bool userland) {
+#define ADD_COMMAND(size) ({ \
+        void *ret = (char *) hdr + sizeof(struct mach_header) + hdr->sizeofcmds; \
+        uint32_t newsize = hdr->sizeofcmds + size; \
+        if(newsize > sizeofcmds_limit) { \
+            die("not enough space for commands"); \
+        } \
+        hdr->ncmds++; \
+        hdr->sizeofcmds += (uint32_t) (size); \
+        ret; \
+    })
+
+    // the payloads, then the target
+    unsigned nli = count + 1;
+    struct linkedit_info *li = calloc(nli, sizeof(*li));
+    struct inject_layout lay;
+    plan_injection(&lay, li, target, binaries, count, find_hack_func, userland);
+    uint32_t sizeofcmds_limit = lay.sizeofcmds_limit;
+
+    // the target gets copied exactly once, into an output of the final size; everything else is written straight into place
+    void *old_target = target->valid_range.start;
+    if(lay.stuff_size) {
+        extend_cmds_shift(target, lay.stuff_size);
+    }
+    target->valid_range = pdup((prange_t) {old_target, lay.target_size}, lay.size, lay.stuff_size);
+    if(lay.stuff_size) {
+        extend_cmds_header(target, lay.stuff_size);
+    }
+    void *out = target->valid_range.start;
+
+    struct mach_header *hdr = b_mach_hdr(target);
+    hdr->flags &= ~MH_PIE;
+
+    // how far each payload's indirect symbols and lazy binds end up from the start of the merged ones
+    uint32_t *indirect_before = calloc(nli, sizeof(uint32_t));
+    uint32_t *lazy_before = calloc(nli, sizeof(uint32_t));
+    if(userland) {
+        // now cut the target's LINKEDIT for real, but keep reading it from where it was
+        catch_linkedit(hdr, &li[count], true);
+        li[count].linkedit_ptr = old_target + li[count].linkedit_range.start - lay.stuff_size;
+        merged_linkedit_size(li, nli);
+        for(unsigned p = 0; p < count; p++) {
+            indirect_before[p + 1] = indirect_before[p] + *li[p].moveme[MM_INDIRECT].size;
+            lazy_before[p + 1] = lazy_before[p] + *li[p].moveme[MM_LAZY_BIND].size;
         }
     }
 
-    uint32_t init_ptrs[100];
-    unsigned num_init_ptrs = 0;
-    uint32_t *reserved1s[100];
-    unsigned num_reserved1s = 0;
-    struct copy { ptrdiff_t off; void *start; size_t size; } copies[100];
-    unsigned num_copies = 0;
+    uint32_t **reserved1s = NULL;
+    unsigned num_reserved1s = 0, cap_reserved1s = 0;
 
     unsigned num_segments = 0;
     if(userland) {
@@ -470,287 +787,220 @@ void b_inject_macho_binary(struct binary *target, const struct binary *binary, a
                     case S_NON_LAZY_SYMBOL_POINTERS:
                     case S_LAZY_SYMBOL_POINTERS:
                     case S_SYMBOL_STUBS:
-                        if(num_reserved1s < 100) reserved1s[num_reserved1s++] = &sect->reserved1;
+                        if(num_reserved1s == cap_reserved1s) {
+                            cap_reserved1s = cap_reserved1s ? cap_reserved1s * 2 : 16;
+                            reserved1s = realloc(reserved1s, cap_reserved1s * sizeof(*reserved1s));
+                        }
+                        reserved1s[num_reserved1s++] = &sect->reserved1;
                         break;
                     }
 
-                    if(li[0].dyld_info && !strcmp(sect->sectname, "__stub_helper")) {
+                    if(li[count].dyld_info && !strcmp(sect->sectname, "__stub_helper")) {
                         void *segdata = rangeconv_off((range_t) {target, seg->fileoff, seg->filesize}, MUST_FIND).start;
-                        fixup_stub_helpers(hdr->cputype, segdata + sect->offset - seg->fileoff, sect->size, *li[0].moveme[MM_LAZY_BIND].size);
+                        fixup_stub_helpers(hdr->cputype, segdata + sect->offset - seg->fileoff, sect->size, lazy_before[count]);
                     }
                 }
             }
         }
     }
 
-    CMD_ITERATE(b_mach_hdr(binary), cmd) {
-        switch(cmd->cmd) {
-        case LC_SEGMENT: {
-            struct segment_command *seg = (void *) cmd;
+    for(unsigned p = 0; p < count; p++) {
+        unsigned seg_idx = lay.first_segment[p];
+        CMD_ITERATE(b_mach_hdr(binaries[p]), cmd) {
+            switch(cmd->cmd) {
+            case LC_SEGMENT: {
+                struct segment_command *seg = (void *) cmd;
 
-            if(userland && !strcmp(seg->segname, "__LINKEDIT")) continue;
+                if(userland && !strcmp(seg->segname, "__LINKEDIT")) continue;
 
-            size_t size = sizeof(struct segment_command) + seg->nsects * sizeof(struct section);
+                size_t size = sizeof(struct segment_command) + seg->nsects * sizeof(struct section);
 
-            // make seg_addr useful
-            addr_t new_addr = seg->vmaddr + seg->vmsize;
-            if(new_addr > seg_addr) seg_addr = new_addr;
+                struct segment_command *newseg = ADD_COMMAND(size);
+                memcpy(newseg, seg, size);
 
-            struct segment_command *newseg = ADD_COMMAND(size);
-            memcpy(newseg, seg, size);
-            prange_t pr = rangeconv_off((range_t) {binary, seg->fileoff, seg->filesize}, MUST_FIND);
+                const struct placed_segment *ps = &lay.segments[seg_idx++];
+                newseg->fileoff = ps->fileoff;
+                memcpy(out + ps->fileoff, ps->data.start, ps->data.size);
 
-            newseg->fileoff = (uint32_t) ADD_SEGMENT(pr.size);
-            //printf("setting fileoff to %u\n", newseg->fileoff);
-            if(num_copies < 100) copies[num_copies++] = (struct copy) {newseg->fileoff, pr.start, pr.size};
-            
-            struct section *sections = (void *) (newseg + 1);
-            for(uint32_t i = 0; i < seg->nsects; i++) {
-                struct section *sect = &sections[i];
-                sect->offset = newseg->fileoff + sect->addr - newseg->vmaddr;
-                // ZEROFILL is okay because iBoot always zeroes vmsize - filesize
-                if(!userland && (sect->flags & SECTION_TYPE) == S_MOD_INIT_FUNC_POINTERS) {
-                    uint32_t *p = rangeconv_off((range_t) {binary, sect->offset, sect->size}, MUST_FIND).start;
-                    size_t num = sect->size / 4;
-                    while(num--) {
-                        if(num_init_ptrs < 100) init_ptrs[num_init_ptrs++] = *p++;
+                struct section *sections = (void *) (newseg + 1);
+                for(uint32_t i = 0; i < seg->nsects; i++) {
+                    struct section *sect = &sections[i];
+                    sect->offset = newseg->fileoff + sect->addr - newseg->vmaddr;
+                    if(!userland) continue;
+                    // payloads after the first have their indirect symbols and lazy binds further in
+                    switch(sect->flags & SECTION_TYPE) {
+                    case S_NON_LAZY_SYMBOL_POINTERS:
+                    case S_LAZY_SYMBOL_POINTERS:
+                    case S_SYMBOL_STUBS:
+                        sect->reserved1 += indirect_before[p];
+                        break;
+                    }
+                    if(li[p].dyld_info && lazy_before[p] && !strcmp(sect->sectname, "__stub_helper")) {
+                        fixup_stub_helpers(hdr->cputype, out + sect->offset, sect->size, lazy_before[p]);
                     }
                 }
+                break;
             }
-            break;
-        }
-        case LC_LOAD_DYLIB:
-            if(userland) {
-                void *newcmd = ADD_COMMAND(cmd->cmdsize);
-                memcpy(newcmd, cmd, cmd->cmdsize);
+            case LC_LOAD_DYLIB:
+                if(userland) {
+                    void *newcmd = ADD_COMMAND(cmd->cmdsize);
+                    memcpy(newcmd, cmd, cmd->cmdsize);
+                }
+                break;
             }
-            break;
         }
     }
 
-
-    // now deal with the init pointers (if not userland)
-    // this code is really gross
-    if(num_init_ptrs > 0) {
-        if(num_init_ptrs == 1) { // hey, correct plurals are nice
-            fprintf(stderr, "note: 1 constructor function is present; using the hack_func\n");
-        } else {
-            fprintf(stderr, "note: %d constructor functions are present; using the hack_func\n", num_init_ptrs);
-        }
-
-        if(!find_hack_func) {
-            die("...but there was no find_hack_func");
-        }
-        
-        // ldr pc, [pc]
-        uint16_t part0[] = {0xf8df, 0xf000};
-
-        // push {r0-r3, lr}; adr lr, f+1; ldr pc, a; f: b next; a: .long 0; next:
-        // (the address of the init func)
-        // 
-        uint16_t part1[] = {0xb50f, 0xf20f, 0x0e07, 0xf8df, 0xf004, 0xe001};
-        // (bytes_to_move bytes of stuff)
-        // pop {r0-r3, lr}
-        static const uint16_t part2[] = {0xe8bd, 0x400f};
-        // ldr pc, [pc]
-        static const uint16_t part3[] = {0xf8df, 0xf000};
-
-        uint32_t bytes_to_move = 12; // don't cut the MRC in two!
-
-        addr_t hack_func = find_hack_func(target);
-        fprintf(stderr, "hack_func = %08llx\n", (long long) hack_func);
-        prange_t hack_func_pr = rangeconv((range_t) {target, hack_func & ~1, bytes_to_move}, MUST_FIND);
-
-        // allocate a new segment for the stub
-
-        uint32_t stub_size = (uint32_t) ((sizeof(part1) + 4) * num_init_ptrs + sizeof(part2) + bytes_to_move + sizeof(part3) + 4);
-
-        if(!(hack_func & 1)) {
-            die("hack func 0x%x is not thumb", hack_func);
-        }
-
+    if(lay.num_init_ptrs > 0) {
         struct segment_command *newseg = ADD_COMMAND(sizeof(struct segment_command));
-        
+
         newseg->cmd = LC_SEGMENT;
         newseg->cmdsize = sizeof(struct segment_command);
         memset(newseg->segname, 0, 16);
         strcpy(newseg->segname, "__CRAP");
-        newseg->vmaddr = ADD_SEGMENT_ADDR(stub_size);
-        newseg->vmsize = stub_size;
-        newseg->fileoff = ADD_SEGMENT(stub_size);
-        newseg->filesize = stub_size;
+        newseg->vmaddr = lay.stub_addr;
+        newseg->vmsize = lay.stub_size;
+        newseg->fileoff = lay.stub_off;
+        newseg->filesize = lay.stub_size;
         newseg->maxprot = newseg->initprot = PROT_READ | PROT_EXEC;
         newseg->nsects = 0;
         newseg->flags = 0;
 
-        void *ptr = malloc(stub_size);
-        for(unsigned i = 0; i < num_init_ptrs; i++) {
-            memcpy(ptr, part1, sizeof(part1));
-            ptr += sizeof(part1);
-            memcpy(ptr, &init_ptrs[i], 4);
-            ptr += 4;
-            part1[0] = 0x46c0;
-        }
-
-        memcpy(ptr, part2, sizeof(part2));
-        ptr += sizeof(part2);
-
-        memcpy(ptr, hack_func_pr.start, bytes_to_move);
-        ptr += bytes_to_move;
-        
-        memcpy(ptr, part3, sizeof(part3));
-        ptr += sizeof(part3);
-
-        uint32_t new_addr = hack_func + bytes_to_move;
-        memcpy(ptr, &new_addr, 4);
-        ptr += 4;
-        
-        new_addr = newseg->vmaddr | 1;
-        memcpy(hack_func_pr.start, part0, sizeof(part0));
-        memcpy(hack_func_pr.start + sizeof(part0), &new_addr, 4);
-
-        if(num_copies < 100) copies[num_copies++] = (struct copy) {newseg->fileoff, ptr, stub_size};
+        build_stub(&lay, out);
     }
 
-    autofree char *linkedit = NULL;
+    if(userland && lay.linkedit_size != 0) {
+        // build the new LINKEDIT, in place
+        uint32_t linkedit_off = lay.linkedit_off;
+        char *linkedit = out + linkedit_off;
+        uint32_t off = 0;
 
-    if(userland) {
-        // build the new LINKEDIT
-        uint32_t newsize = 0;
         for(int i = 0; i < NMOVEME; i++) {
-            for(int l = 0; l < 2; l++) {
+            uint32_t s = 0;
+            for(unsigned l = 0; l < nli; l++) {
                 struct moveme *m = &li[l].moveme[i];
-                if(!m->size) {
-                    static uint32_t zero = 0;
-                    m->size = m->off = &zero;
-                    m->element_size = 1;
+                m->copied_size = *m->size * m->element_size;
+                m->copied_to = linkedit + off + s;
+                if(m->off_base > 0) {
+                    // the value is an index into a table represented by another moveme (i.e. the symtab)
+                    m->copied_from = li[l].moveme[m->off_base].copied_from + *m->off * m->element_size;
+                } else {
+                    // the value is a file offset
+                    // if 0, just plain copy; if -1, the references will handle copying
+                    m->copied_from = li[l].linkedit_ptr - li[l].linkedit_range.start + *m->off;
                 }
+                if(i == MM_STRTAB) continue;
                 if(m->off_base != -1) {
-                    newsize += *m->size * m->element_size;
+                    memcpy(m->copied_to, m->copied_from, m->copied_size);
                 }
+                s += m->copied_size;
             }
-        }
-
-        if(newsize != 0) {
-            uint32_t linkedit_off = ADD_SEGMENT(newsize);
-            linkedit = malloc(newsize);
-            uint32_t off = 0;
-            
-            for(int i = 0; i < NMOVEME; i++) {
-                uint32_t s = 0;
-                for(int l = 0; l < 2; l++) {
-                    struct moveme *m = &li[l].moveme[i];
-                    m->copied_size = *m->size * m->element_size;
-                    m->copied_to = linkedit + off + s;
-                    if(m->off_base > 0) {
-                        // the value is an index into a table represented by another moveme (i.e. the symtab)
-                        m->copied_from = li[l].moveme[m->off_base].copied_from + *m->off * m->element_size;
-                    } else {
-                        // the value is a file offset
-                        // if 0, just plain copy; if -1, the references will handle copying
-                        m->copied_from = li[l].linkedit_ptr - li[l].linkedit_range.start + *m->off;
-                    }
-                    if(m->off_base != -1) {
-                        memcpy(m->copied_to, m->copied_from, m->copied_size);
-                    }
-                    s += m->copied_size;
-                }
-                //printf("i=%d s=%u off=%u\n", i, s, off);
-                // update the one to load
-                struct moveme *m = &li[1].moveme[i];
-                *m->off = linkedit_off + off;
-                if(m->off_base > 0) {
-                    *m->off = (*m->off - *li[1].moveme[m->off_base].off) / m->element_size;
-                }
-                *m->size = s / m->element_size;
+            if(i == MM_STRTAB) {
+                // pooled rather than concatenated; the symbols get their new n_strxs below
+                strpool_write(&lay.strings, linkedit + off);
+                s = lay.strings.size;
+            }
+            //printf("i=%d s=%u off=%u\n", i, s, off);
+            // update the one to load
+            struct moveme *m = &li[count].moveme[i];
+            *m->off = linkedit_off + off;
+            if(m->off_base > 0) {
+                *m->off = (*m->off - *li[count].moveme[m->off_base].off) / m->element_size;
+            }
+            *m->size = s / m->element_size;
 
-                if(m->off_base != -1) {
-                    off += s;
-                }
+            if(m->off_base != -1) {
+                off += s;
             }
+        }
 
-            // update struct references (which are out of order, yay)
-            off = 0;
-            for(int i = 0; i < 2; i++) {
-                for(int j = MM_LOCREL; j <= MM_INDIRECT; j++) {
-                    int k = moveref[j].target;
-                    if(!k) continue;
-
-                    struct moveme *m = &li[i].moveme[j];
-                    for(void *ptr = m->copied_to; ptr < m->copied_to + m->copied_size; ptr += m->element_size) {
-                        uint32_t diff = 0;
-                        int b = li[i].moveme[k].off_base;
-                        if(b > 0) {
-                            //    A1 A2 B1 B2 C1 C2
-                            // 0: <--------->
-                            // 1: <------------>
-                            int orig_off = (li[i].moveme[k].copied_from - li[i].moveme[b].copied_from) / li[i].moveme[k].element_size;
-                            int new_off = (li[i].moveme[k].copied_to - li[0].moveme[b].copied_to) / li[i].moveme[k].element_size;
-                            diff = new_off - orig_off;
-                        } else {
-                            //    A   B
-                            // 0: 
-                            // 1: <->
-                            if(i == 1) {
-                                diff = li[0].moveme[k].copied_size / li[0].moveme[k].element_size;
-                            }
+        // update struct references (which are out of order, yay)
+        for(unsigned i = 0; i < nli; i++) {
+            for(int j = MM_LOCREL; j <= MM_INDIRECT; j++) {
+                int k = moveref[j].target;
+                if(!k) continue;
+
+                struct moveme *m = &li[i].moveme[j];
+                for(void *ptr = m->copied_to; ptr < m->copied_to + m->copied_size; ptr += m->element_size) {
+                    if(k == MM_STRTAB) {
+                        uint32_t *strx = ptr + moveref[j].offset;
+                        if(*strx) *strx = strpool_offset(&lay.strings, li[i].moveme[MM_STRTAB].copied_from + *strx);
+                        continue;
+                    }
+                    uint32_t diff = 0;
+                    int b = li[i].moveme[k].off_base;
+                    if(b > 0) {
+                        //    A1 A2 B1 B2 C1 C2
+                        // 0: <--------->
+                        // 1: <------------>
+                        int orig_off = (li[i].moveme[k].copied_from - li[i].moveme[b].copied_from) / li[i].moveme[k].element_size;
+                        int new_off = (li[i].moveme[k].copied_to - li[0].moveme[b].copied_to) / li[i].moveme[k].element_size;
+                        diff = new_off - orig_off;
+                    } else {
+                        //    A   B   C
+                        // 0:
+                        // 1: <->
+                        // 2: <----->
+                        for(unsigned l = 0; l < i; l++) {
+                            diff += li[l].moveme[k].copied_size / li[l].moveme[k].element_size;
                         }
-
-                        uint32_t *p = ptr + moveref[j].offset;
-                        if(*p < 0x10000000) *p += diff;
                     }
+
+                    uint32_t *p = ptr + moveref[j].offset;
+                    if(*p < 0x10000000) *p += diff;
                 }
             }
-            
-            // update library numbers in symbol table
-            {
-                struct moveme *restrict m = &li[0].moveme[MM_UNDEFSYM];
-                for(struct nlist *nl = m->copied_to; (void *) (nl + 1) <= (m->copied_to + m->copied_size); nl++) {
-                    unsigned lib = GET_LIBRARY_ORDINAL(nl->n_desc);
-                    if(lib != SELF_LIBRARY_ORDINAL && lib <= MAX_LIBRARY_ORDINAL) {
-
-                        SET_LIBRARY_ORDINAL(nl->n_desc, DYNAMIC_LOOKUP_ORDINAL);
-                    }
+        }
+        
+        // update library numbers in the payloads' symbol tables
+        for(unsigned l = 0; l < count; l++) {
+            struct moveme *restrict m = &li[l].moveme[MM_UNDEFSYM];
+            for(struct nlist *nl = m->copied_to; (void *) (nl + 1) <= (m->copied_to + m->copied_size); nl++) {
+                unsigned lib = GET_LIBRARY_ORDINAL(nl->n_desc);
+                if(lib != SELF_LIBRARY_ORDINAL && lib <= MAX_LIBRARY_ORDINAL) {
+
+                    SET_LIBRARY_ORDINAL(nl->n_desc, DYNAMIC_LOOKUP_ORDINAL);
                 }
             }
+        }
 
-            // ... and update section references
-            for(unsigned i = 0; i < num_reserved1s; i++) {
-                *reserved1s[i] += *li[0].moveme[MM_INDIRECT].size;
-            }
+        // ... and update section references
+        for(unsigned i = 0; i < num_reserved1s; i++) {
+            *reserved1s[i] += indirect_before[count];
+        }
 
-            // ... and dyld info
-            if(li->dyld_info) {
-                for(int i = MM_BIND; i <= MM_LAZY_BIND; i++) {
-                    if(*li[1].moveme[i].off) {
-                        handle_retarded_dyld_info(linkedit - linkedit_off + *li[1].moveme[i].off, *li[0].moveme[i].size, num_segments, true, i != MM_LAZY_BIND);
-                    }
+        // ... and dyld info (the payloads' segments come after the target's, in order)
+        if(li[count].dyld_info) {
+            for(int i = MM_BIND; i <= MM_LAZY_BIND; i++) {
+                if(!*li[count].moveme[i].off) continue;
+                void *ptr = linkedit - linkedit_off + *li[count].moveme[i].off;
+                for(unsigned p = 0; p < count; p++) {
+                    handle_retarded_dyld_info(ptr, *li[p].moveme[i].size, num_segments + lay.first_segment[p], true, i != MM_LAZY_BIND);
+                    ptr += *li[p].moveme[i].size;
                 }
             }
-
-            struct segment_command *newseg = ADD_COMMAND(sizeof(struct segment_command));
-            newseg->cmd = LC_SEGMENT;
-            newseg->cmdsize = sizeof(struct segment_command);
-            memset(newseg->segname, 0, 16);
-            strcpy(newseg->segname, "__LINKEDIT");
-            newseg->vmaddr = ADD_SEGMENT_ADDR(newsize);
-            newseg->vmsize = (newsize + 0xfff) & ~0xfff;
-            newseg->fileoff = linkedit_off;
-            newseg->filesize = newsize;
-            newseg->maxprot = newseg->initprot = PROT_READ | PROT_WRITE;
-            newseg->nsects = 0;
-            newseg->flags = 0;
-
-            //printf("off=%d newsize=%d\n", linkedit_off, newsize);
-            if(num_copies < 100) copies[num_copies++] = (struct copy) {linkedit_off, linkedit, newsize};
         }
-        
-    }
 
-    // finally, expand the binary in memory and actually copy in the new stuff
-    target->valid_range = pdup(target->valid_range, seg_off, 0);
-    for(unsigned i = 0; i < num_copies; i++) {
-        memcpy(target->valid_range.start + copies[i].off, copies[i].start, copies[i].size);
+        struct segment_command *newseg = ADD_COMMAND(sizeof(struct segment_command));
+        newseg->cmd = LC_SEGMENT;
+        newseg->cmdsize = sizeof(struct segment_command);
+        memset(newseg->segname, 0, 16);
+        strcpy(newseg->segname, "__LINKEDIT");
+        newseg->vmaddr = lay.linkedit_addr;
+        newseg->vmsize = (lay.linkedit_size + 0xfff) & ~0xfff;
+        newseg->fileoff = linkedit_off;
+        newseg->filesize = lay.linkedit_size;
+        newseg->maxprot = newseg->initprot = PROT_READ | PROT_WRITE;
+        newseg->nsects = 0;
+        newseg->flags = 0;
     }
-}
 
+    free(reserved1s);
+    free(indirect_before);
+    free(lazy_before);
+    free(li);
+    free(lay.segments);
+    free(lay.first_segment);
+    free(lay.init_ptrs);
+    if(userland) strpool_free(&lay.strings);
+}
@@ -7,4 +7,6 @@ addr_t b_allocate_vmaddr(const struct binary *binary);
 uint32_t b_macho_extend_cmds(struct binary *binary, size_t space);
 // this function works for both the kernel and uselrand binaries.  for userland, pass NULL for find_hack_func.
 void b_inject_macho_binary(struct binary *target, const struct binary *inject, addr_t (*find_hack_func)(const struct binary *binary), bool userland);
+// the same for several payloads at once: one layout, one merged LINKEDIT, one copy of target.  their segments are added in order.
+void b_inject_macho_binaries(struct binary *target, const struct binary *const *inject, unsigned count, addr_t (*find_hack_func)(const struct binary *binary), bool userland);
 
@@ -3,11 +3,238 @@
 #include "headers/nlist.h"
 #include "headers/reloc.h"
 #include "headers/arm_reloc.h"
+#include "headers/fixup-chains.h"
 #include <ctype.h>
+#include <stddef.h>
 #include "read_dyld_info.h"
+#include "../trace.h"
 
-static addr_t lookup_symbol_or_do_stuff(lookupsym_t lookup_sym, void *context, const char *name, bool weak, bool userland) {
-    addr_t sym = lookup_sym(context, name);
+// every symbol is looked up at most once per b_relocate
+struct resolver {
+    lookupsym_t lookup_sym;
+    void *context;
+    struct strhash names; // name -> index into values
+    addr_t *values;
+    uint32_t nvalues, capvalues;
+    uint32_t *by_symnum; // symbol number -> index into values + 1, or 0
+};
+
+static void resolver_init(struct resolver *r, const struct binary *load, lookupsym_t lookup_sym, void *context) {
+    r->lookup_sym = lookup_sym;
+    r->context = context;
+    strhash_init(&r->names, 64);
+    r->values = NULL;
+    r->nvalues = r->capvalues = 0;
+    r->by_symnum = calloc(load->mach->nsyms ? load->mach->nsyms : 1, sizeof(uint32_t));
+}
+
+static void resolver_free(struct resolver *r) {
+    strhash_free(&r->names);
+    free(r->values);
+    free(r->by_symnum);
+}
+
+static uint32_t intern(struct resolver *r, const char *name, bool *is_new) {
+    size_t len = strlen(name);
+    const struct strhash_entry *e = strhash_lookup(&r->names, name, len);
+    if(e) {
+        *is_new = false;
+        return (uint32_t) e->value;
+    }
+    if(r->nvalues == r->capvalues) {
+        r->capvalues = r->capvalues ? r->capvalues * 2 : 64;
+        r->values = realloc(r->values, r->capvalues * sizeof(*r->values));
+    }
+    strhash_insert(&r->names, name, len, r->nvalues);
+    *is_new = true;
+    return r->nvalues++;
+}
+
+static uint32_t resolve_index(struct resolver *r, const char *name) {
+    bool is_new;
+    uint32_t i = intern(r, name, &is_new);
+    if(is_new) {
+        r->values[i] = r->lookup_sym(r->context, name);
+    }
+    return i;
+}
+
+static addr_t resolve(struct resolver *r, const char *name) {
+    uint32_t i = resolve_index(r, name); // (this may realloc values)
+    return r->values[i];
+}
+
+// RELOC_PARALLEL_LOOKUP: find every symbol that will be needed, then look them all up at once
+
+static void want_symbolnum(const struct binary *load, struct resolver *r, uint32_t symbolnum) {
+    if(symbolnum >= load->mach->nsyms || r->by_symnum[symbolnum]) return;
+    struct nlist *nl = b_macho_nth_symbol(load, symbolnum);
+    if((uint32_t) nl->n_un.n_strx >= load->mach->strsize) return;
+    bool is_new;
+    r->by_symnum[symbolnum] = intern(r, load->mach->strtab + nl->n_un.n_strx, &is_new) + 1;
+}
+
+static void want_relocs(const struct binary *load, struct resolver *r, uint32_t reloff, uint32_t nreloc) {
+    const struct relocation_info *things = rangeconv_off((range_t) {load, reloff, nreloc * sizeof(struct relocation_info)}, MUST_FIND).start;
+    for(uint32_t i = 0; i < nreloc; i++) {
+        if(things[i].r_extern && things[i].r_address != 0 && things[i].r_symbolnum != R_ABS) {
+            want_symbolnum(load, r, things[i].r_symbolnum);
+        }
+    }
+}
+
+static void want_binds(struct resolver *r, prange_t opcodes) {
+    void *ptr = opcodes.start, *end = ptr + opcodes.size;
+    while(ptr != end) {
+        uint8_t byte = read_int(&ptr, end, uint8_t);
+        switch(byte & BIND_OPCODE_MASK) {
+        case BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM: {
+            bool is_new;
+            intern(r, read_cstring(&ptr, end), &is_new);
+            break;
+        }
+        case BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB:
+        case BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+        case BIND_OPCODE_ADD_ADDR_ULEB:
+        case BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB:
+            read_uleb128(&ptr, end);
+            break;
+        case BIND_OPCODE_SET_ADDEND_SLEB:
+            read_sleb128(&ptr, end);
+            break;
+        case BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB:
+            read_uleb128(&ptr, end);
+            read_uleb128(&ptr, end);
+            break;
+        }
+    }
+}
+
+static const struct dyld_chained_fixups_header *chained_header(const struct binary *load, uint32_t *size) {
+    const struct linkedit_data_command *lc = load->mach->chained_fixups;
+    const struct dyld_chained_fixups_header *hdr = rangeconv_off((range_t) {load, lc->dataoff, lc->datasize}, MUST_FIND).start;
+    *size = lc->datasize;
+    if(*size < sizeof(*hdr) || hdr->fixups_version != 0) {
+        die("bad chained fixups header");
+    }
+    if(hdr->symbols_format != 0) {
+        die("compressed chained fixup symbols are not supported");
+    }
+    if(hdr->starts_offset > *size - sizeof(uint32_t) || hdr->imports_offset > *size || hdr->symbols_offset > *size) {
+        die("chained fixups header points outside the blob");
+    }
+    return hdr;
+}
+
+// the name of import i, or dies
+static const char *chained_import(const struct dyld_chained_fixups_header *hdr, uint32_t size, uint32_t i, bool *weak, addr_t *addend) {
+    size_t entsize;
+    switch(hdr->imports_format) {
+    case DYLD_CHAINED_IMPORT: entsize = sizeof(struct dyld_chained_import); break;
+    case DYLD_CHAINED_IMPORT_ADDEND: entsize = sizeof(struct dyld_chained_import_addend); break;
+    case DYLD_CHAINED_IMPORT_ADDEND64: entsize = sizeof(struct dyld_chained_import_addend64); break;
+    default: die("unknown chained import format %u", hdr->imports_format);
+    }
+    if(hdr->imports_count > (size - hdr->imports_offset) / entsize || i >= hdr->imports_count) {
+        die("chained import %u out of range", i);
+    }
+    const void *entry = (const char *) hdr + hdr->imports_offset + i * entsize;
+    uint64_t name_offset;
+    switch(hdr->imports_format) {
+    case DYLD_CHAINED_IMPORT: {
+        struct dyld_chained_import im;
+        memcpy(&im, entry, sizeof(im));
+        name_offset = im.name_offset;
+        *weak = im.weak_import;
+        *addend = 0;
+        break;
+    }
+    case DYLD_CHAINED_IMPORT_ADDEND: {
+        struct dyld_chained_import_addend im;
+        memcpy(&im, entry, sizeof(im));
+        name_offset = im.name_offset;
+        *weak = im.weak_import;
+        *addend = (addr_t) (int64_t) im.addend;
+        break;
+    }
+    default: {
+        struct dyld_chained_import_addend64 im;
+        memcpy(&im, entry, sizeof(im));
+        name_offset = im.name_offset;
+        *weak = im.weak_import;
+        *addend = im.addend;
+        break;
+    }
+    }
+    if(name_offset >= size - hdr->symbols_offset) {
+        die("chained import %u has a bad name", i);
+    }
+    const char *name = (const char *) hdr + hdr->symbols_offset + name_offset;
+    if(!memchr(name, 0, size - hdr->symbols_offset - name_offset)) {
+        die("chained import %u has a bad name", i);
+    }
+    return name;
+}
+
+struct prepass_ctx {
+    struct resolver *r;
+    const char **names;
+};
+
+static void lookup_one(void *ctx_, size_t i) {
+    struct prepass_ctx *ctx = ctx_;
+    ctx->r->values[i] = ctx->r->lookup_sym(ctx->r->context, ctx->names[i]);
+}
+
+static void prepass(const struct binary *load, struct resolver *r) {
+    if(load->mach->chained_fixups) {
+        uint32_t size;
+        const struct dyld_chained_fixups_header *hdr = chained_header(load, &size);
+        for(uint32_t i = 0; i < hdr->imports_count; i++) {
+            bool weak, is_new;
+            addr_t addend;
+            intern(r, chained_import(hdr, size, i, &weak, &addend), &is_new);
+        }
+    } else if(load->mach->dyld_info) {
+        const struct dyld_info_command *di = load->mach->dyld_info;
+        uint32_t offs[] = {di->bind_off, di->weak_bind_off, di->lazy_bind_off};
+        uint32_t sizes[] = {di->bind_size, di->weak_bind_size, di->lazy_bind_size};
+        for(int i = 0; i < 3; i++) {
+            if(offs[i]) {
+                want_binds(r, rangeconv_off((range_t) {load, offs[i], sizes[i]}, MUST_FIND));
+            }
+        }
+    } else {
+        const struct dysymtab_command *dysymtab = load->mach->dysymtab;
+        want_relocs(load, r, dysymtab->extreloff, dysymtab->nextrel);
+        want_relocs(load, r, dysymtab->locreloff, dysymtab->nlocrel);
+        for(uint32_t i = 0; i < load->mach->nsections; i++) {
+            const struct data_section *sect = &load->mach->sections[i];
+            uint8_t type = sect->flags & SECTION_TYPE;
+            want_relocs(load, r, sect->reloff, sect->nreloc);
+            if(type != S_NON_LAZY_SYMBOL_POINTERS && type != S_LAZY_SYMBOL_POINTERS) continue;
+            uint32_t num_syms = (uint32_t) (sect->vm_range.size / b_pointer_size(load));
+            if(sect->reserved1 > dysymtab->nindirectsyms || num_syms > dysymtab->nindirectsyms - sect->reserved1) continue;
+            const uint32_t *indirect_syms = rangeconv_off((range_t) {load, (addr_t) dysymtab->indirectsymoff + sect->reserved1 * sizeof(uint32_t), num_syms * sizeof(uint32_t)}, MUST_FIND).start;
+            for(uint32_t j = 0; j < num_syms; j++) {
+                if(!(indirect_syms[j] & (INDIRECT_SYMBOL_LOCAL | INDIRECT_SYMBOL_ABS))) {
+                    want_symbolnum(load, r, indirect_syms[j]);
+                }
+            }
+        }
+    }
+
+    struct prepass_ctx ctx = {r, malloc(sizeof(char *) * (r->nvalues ? r->nvalues : 1))};
+    for(uint32_t i = 0; i <= r->names.mask; i++) {
+        const struct strhash_entry *e = &r->names.entries[i];
+        if(e->key) ctx.names[e->value] = e->key;
+    }
+    parallel_for(r->nvalues, lookup_one, &ctx);
+    free(ctx.names);
+}
+
+// sym is what lookup_sym said
+static addr_t lookup_symbol_or_do_stuff(const char *name, addr_t sym, bool weak, bool userland) {
     if(!sym) {
         if(userland) {
             // let it pass
@@ -22,91 +249,127 @@ static addr_t lookup_symbol_or_do_stuff(lookupsym_t lookup_sym, void *context, c
     return sym;
 }
 
-static addr_t lookup_nth_symbol(const struct binary *load, uint32_t symbolnum, lookupsym_t lookup_sym, void *context, bool userland) {
+static addr_t lookup_nth_symbol(const struct binary *load, uint32_t symbolnum, struct resolver *r, bool userland) {
     struct nlist *nl = b_macho_nth_symbol(load, symbolnum);
     bool weak = nl->n_desc & N_WEAK_REF;
     const char *name = load->mach->strtab + nl->n_un.n_strx;
-    return lookup_symbol_or_do_stuff(lookup_sym, context, name, weak, userland);
+    if(!r->by_symnum[symbolnum]) {
+        r->by_symnum[symbolnum] = resolve_index(r, name) + 1;
+    }
+    return lookup_symbol_or_do_stuff(name, r->values[r->by_symnum[symbolnum] - 1], weak, userland);
+}
+
+// b_relocation_plan: everything below works out what to write without writing it
+
+struct plan_builder {
+    const struct binary *load;
+    enum reloc_mode mode;
+    struct resolver *r;
+    struct reloc_plan *plan;
+    uint32_t capfixups, capmarks;
+};
+
+static addr_t offset_of(const struct binary *load, const void *p) {
+    return (addr_t) ((const char *) p - (const char *) load->valid_range.start);
 }
 
-static void relocate_area(struct binary *load, uint32_t reloff, uint32_t nreloc, enum reloc_mode mode, lookupsym_t lookup_sym, void *context, addr_t slide) {
-    struct relocation_info *things = rangeconv_off((range_t) {load, reloff, nreloc * sizeof(struct relocation_info)}, MUST_FIND).start;
+static void push_fixups(struct plan_builder *b, const struct reloc_fixup *fixups, uint32_t count) {
+    struct reloc_plan *plan = b->plan;
+    if(count > UINT32_MAX - plan->nfixups) {
+        die("too many fixups");
+    }
+    if(plan->nfixups + count > b->capfixups) {
+        while(plan->nfixups + count > b->capfixups) {
+            b->capfixups = b->capfixups ? b->capfixups * 2 : 256;
+        }
+        plan->fixups = realloc(plan->fixups, b->capfixups * sizeof(*plan->fixups));
+    }
+    memcpy(plan->fixups + plan->nfixups, fixups, count * sizeof(*fixups));
+    plan->nfixups += count;
+}
+
+static void add_fixup(struct plan_builder *b, const void *p, uint8_t kind, uint8_t size, addr_t value, addr_t count, addr_t stride) {
+    if(!count) return;
+    if(count > UINT32_MAX || stride > UINT32_MAX) {
+        die("fixup run too long");
+    }
+    struct reloc_fixup f = {offset_of(b->load, p), value, (uint32_t) count, (uint32_t) stride, kind, size};
+    push_fixups(b, &f, 1);
+}
+
+static void add_mark(struct plan_builder *b, const void *p, size_t size, uint8_t kind) {
+    struct reloc_plan *plan = b->plan;
+    if(plan->nmarks == b->capmarks) {
+        b->capmarks = b->capmarks ? b->capmarks * 2 : 256;
+        plan->marks = realloc(plan->marks, b->capmarks * sizeof(*plan->marks));
+    }
+    plan->marks[plan->nmarks++] = (struct reloc_mark) {offset_of(b->load, p), (uint32_t) size, kind};
+}
+
+static void relocate_area(struct plan_builder *b, uint32_t reloff, uint32_t nreloc) {
+    if(!nreloc) return;
+    const struct binary *load = b->load;
+    enum reloc_mode mode = b->mode;
+    const struct relocation_info *things = rangeconv_off((range_t) {load, reloff, nreloc * sizeof(struct relocation_info)}, MUST_FIND).start;
+    addr_t base = 0;
+    bool have_base = false;
     for(uint32_t i = 0; i < nreloc; i++) {
         if(things[i].r_length != 2) {
             die("bad relocation length");
         }
         addr_t address = things[i].r_address;
         if(address == 0 || things[i].r_symbolnum == R_ABS) continue;
-        address += b_macho_reloc_base(load);
-        uint32_t *p = rangeconv((range_t) {load, address, 4}, MUST_FIND).start;
+        if(!have_base) {
+            base = b_macho_reloc_base(load);
+            have_base = true;
+        }
+        address += base;
+        const uint32_t *p = rangeconv((range_t) {load, address, 4}, MUST_FIND).start;
 
         addr_t value;
         if(things[i].r_extern) {
             if(mode == RELOC_LOCAL_ONLY) continue;
-            value = lookup_nth_symbol(load, things[i].r_symbolnum, lookup_sym, context, mode == RELOC_USERLAND);
+            value = lookup_nth_symbol(load, things[i].r_symbolnum, b->r, mode == RELOC_USERLAND);
             if(value == 0 && mode == RELOC_USERLAND) continue;
         } else {
             if(mode == RELOC_EXTERN_ONLY || mode == RELOC_USERLAND) continue;
             // *shrug*
-            value = slide;
+            value = 0;
         }
 
-        things[i].r_address = 0;
-        things[i].r_symbolnum = R_ABS;
+        add_mark(b, &things[i], sizeof(things[i]), RELOC_MARK_RELOC);
 
         if(mode == RELOC_EXTERN_ONLY && things[i].r_type != ARM_RELOC_VANILLA) {
             die("non-VANILLA relocation but we are relocating without knowing the slide; use __attribute__((long_call)) to get rid of these");
         }
         switch(things[i].r_type) {
         case ARM_RELOC_VANILLA:
-            //printf("%x, %x += %x\n", address, *p, value); 
-            if(rangeconv((range_t) {load, *p, 0}, 0).start) {
-                // when dyld_stub_binding_helper (which would just crash, btw) is present, entries in the indirect section point to it; usually this increments to point to the right dyld_stub_binding_helper, then that's clobbered by the indirect code.  when we do prelinking, the indirect code runs first and we would be relocating the already-correctly-located importee symbol, so we add this check (easier than actually checking that it's not in the indirect section) to make sure we're not relocating nonsense.
-                *p += value;
-            }
-            //else printf("skipping %x\n", *p);
+            add_fixup(b, p, things[i].r_extern ? RELOC_FIXUP_VANILLA : RELOC_FIXUP_VANILLA_SLIDE, 4, value, 1, 4);
             break;
-        case ARM_RELOC_BR24: {
+        case ARM_RELOC_BR24:
             if(!things[i].r_pcrel) die("weird relocation");
-            uint32_t ins = *p;
-            uint32_t off = ins & 0x00ffffff;
-            if(ins & 0x00800000) off |= 0xff000000;
-            off <<= 2;
-            off += (value - slide);
-            if((off & 0xfc000000) != 0 &&
-               (off & 0xfc000000) != 0xfc000000) {
-                die("BR24 relocation out of range");
-            }
-            uint32_t cond = ins >> 28;
-            if(value & 1) {
-                if(cond != 0xe && cond != 0xf) die("can't convert BL with condition to BLX (which must be unconditional)");
-                ins = (ins & 0x0effffff) | 0xf0000000 | ((off & 2) << 24);
-            } else if(cond == 0xf) {
-                ins = (ins & 0x0fffffff) | 0xe0000000;
-            }
-
-            ins = (ins & 0xff000000) | ((off >> 2) & 0x00ffffff);
-            *p = ins;
+            add_fixup(b, p, things[i].r_extern ? RELOC_FIXUP_BR24 : RELOC_FIXUP_BR24_SLIDE, 4, value, 1, 4);
             break;
-        }
         default:
             die("unknown relocation type %d", things[i].r_type);
         }
-
     }
 }
 
-static void go_indirect(struct binary *load, uint32_t offset, uint32_t size, uint32_t flags, uint32_t reserved1, uint32_t reserved2, enum reloc_mode mode, lookupsym_t lookup_sym, void *context, addr_t slide) {
-    uint8_t type = flags & SECTION_TYPE;
+static void go_indirect(struct plan_builder *b, const struct data_section *sect) {
+    const struct binary *load = b->load;
+    enum reloc_mode mode = b->mode;
+    uint8_t type = sect->flags & SECTION_TYPE;
     uint8_t pointer_size = b_pointer_size(load);
+    uint32_t offset = (uint32_t) sect->file_range.start, size = (uint32_t) sect->vm_range.size;
     switch(type) {
     case S_NON_LAZY_SYMBOL_POINTERS:
     case S_LAZY_SYMBOL_POINTERS: {
-        uint32_t indirect_table_offset = reserved1;
+        uint32_t indirect_table_offset = sect->reserved1;
         const struct dysymtab_command *dysymtab = load->mach->dysymtab;
         
 
-        uint32_t stride = type == S_SYMBOL_STUBS ? reserved2 : pointer_size;
+        uint32_t stride = type == S_SYMBOL_STUBS ? sect->reserved2 : pointer_size;
         uint32_t num_syms = size / stride;
 
         if(stride < pointer_size ||
@@ -117,32 +380,31 @@ static void go_indirect(struct binary *load, uint32_t offset, uint32_t size, uin
            die("bad indirect section");
         }
         
-        uint32_t *indirect_syms = rangeconv_off((range_t) {load, (addr_t) dysymtab->indirectsymoff + indirect_table_offset * sizeof(uint32_t), num_syms * sizeof(uint32_t)}, MUST_FIND).start;
-        void *addrs = rangeconv_off((range_t) {load, offset, size}, MUST_FIND).start;
+        const uint32_t *indirect_syms = rangeconv_off((range_t) {load, (addr_t) dysymtab->indirectsymoff + indirect_table_offset * sizeof(uint32_t), num_syms * sizeof(uint32_t)}, MUST_FIND).start;
+        const void *addrs = rangeconv_off((range_t) {load, offset, size}, MUST_FIND).start;
         for(uint32_t i = 0; i < num_syms; i++, indirect_syms++, addrs += stride) {
-            addr_t addr, found_addr;
+            addr_t found_addr;
 
             switch(*indirect_syms) {
             case INDIRECT_SYMBOL_LOCAL:
                 if(mode == RELOC_EXTERN_ONLY || mode == RELOC_USERLAND) continue;
-                addr = read_pointer(addrs, pointer_size) + slide;
+                add_fixup(b, addrs, RELOC_FIXUP_REBASE, pointer_size, 0, 1, pointer_size);
                 break;
             case INDIRECT_SYMBOL_ABS:
                 continue;
             default:
                 if(mode == RELOC_LOCAL_ONLY) continue;
-                found_addr = lookup_nth_symbol(load, *indirect_syms, lookup_sym, context, mode == RELOC_USERLAND);
+                found_addr = lookup_nth_symbol(load, *indirect_syms, b->r, mode == RELOC_USERLAND);
                 if(!found_addr && mode == RELOC_USERLAND) {
                     // don't set to ABS! 
                     continue;
                 }
 
-                addr = found_addr;
+                add_fixup(b, addrs, RELOC_FIXUP_SET, pointer_size, found_addr, 1, pointer_size);
                 break;
             }
 
-            write_pointer(addrs, addr, pointer_size);
-            *indirect_syms = INDIRECT_SYMBOL_ABS;
+            add_mark(b, indirect_syms, sizeof(uint32_t), RELOC_MARK_INDIRECT);
         }
         break;
     }
@@ -163,32 +425,26 @@ static void go_indirect(struct binary *load, uint32_t offset, uint32_t size, uin
     
 }
 
-static void relocate_with_symtab(struct binary *load, enum reloc_mode mode, lookupsym_t lookup_sym, void *context, addr_t slide) {
+static void relocate_with_symtab(struct plan_builder *b) {
+    const struct binary *load = b->load;
+    enum reloc_mode mode = b->mode;
     if(mode != RELOC_EXTERN_ONLY && mode != RELOC_USERLAND) {
-        relocate_area(load, load->mach->dysymtab->locreloff, load->mach->dysymtab->nlocrel, mode, lookup_sym, context, slide);
+        relocate_area(b, load->mach->dysymtab->locreloff, load->mach->dysymtab->nlocrel);
     }
     if(mode != RELOC_LOCAL_ONLY) {
-        relocate_area(load, load->mach->dysymtab->extreloff, load->mach->dysymtab->nextrel, mode, lookup_sym, context, slide);
-    }
-
-    CMD_ITERATE(b_mach_hdr(load), cmd) {
-        MACHO_SPECIALIZE(
-            if(cmd->cmd == LC_SEGMENT_X) {
-                segment_command_x *seg = (void *) cmd;
-                //printf("%.16s %08x\n", seg->segname, seg->vmaddr);
-                section_x *sect = (void *) (seg + 1);
-                for(uint32_t i = 0; i < seg->nsects; i++, sect++) {
-                    //printf("   %.16s\n", sect->sectname);
-                    go_indirect(load, sect->offset, sect->size, sect->flags, sect->reserved1, sect->reserved2, mode, lookup_sym, context, slide);
-                    relocate_area(load, sect->reloff, sect->nreloc, mode, lookup_sym, context, slide);
-                }
-            }
-        )
+        relocate_area(b, load->mach->dysymtab->extreloff, load->mach->dysymtab->nextrel);
+    }
+
+    for(uint32_t i = 0; i < load->mach->nsections; i++) {
+        const struct data_section *sect = &load->mach->sections[i];
+        go_indirect(b, sect);
+        relocate_area(b, sect->reloff, sect->nreloc);
     }
 
 }
 
-static void do_bind_section(prange_t opcodes, struct binary *load, bool weak, bool userland, lookupsym_t lookup_sym, void *context) {
+static void do_bind_section(struct plan_builder *b, prange_t opcodes, bool weak, bool userland) {
+    const struct binary *load = b->load;
     uint8_t pointer_size = b_pointer_size(load);
 
     uint8_t symbol_flags;
@@ -260,10 +516,11 @@ static void do_bind_section(prange_t opcodes, struct binary *load, bool weak, bo
         bind: {
             if(!sym || !segment.start) die("improper bind");
             bool _64b;
+            uint8_t kind = RELOC_FIXUP_SET;
             addr_t value;
 
 
-            value = lookup_symbol_or_do_stuff(lookup_sym, context, sym, weak, userland);
+            value = lookup_symbol_or_do_stuff(sym, resolve(b->r, sym), weak, userland);
             if(!value) {
                 offset += stride * count;
                 break;
@@ -279,6 +536,7 @@ static void do_bind_section(prange_t opcodes, struct binary *load, bool weak, bo
             case BIND_TYPE_TEXT_PCREL32:
                 _64b = false;
                 value = -value + (segaddr + offset + 4);
+                kind = RELOC_FIXUP_SET_PCREL32;
                 break;
             default:
                 die("bad bind type %d", (int) type);
@@ -290,18 +548,10 @@ static void do_bind_section(prange_t opcodes, struct binary *load, bool weak, bo
                die("bad address while binding");
             }
 
-            while(count--) {
-                if(_64b) {
-                    *((uint64_t *) (segment.start + offset)) = value;
-                } else {
-                    *((uint32_t *) (segment.start + offset)) = value;
-                }
-
-                offset += stride;
-                if(type == BIND_TYPE_TEXT_PCREL32) value += stride;
-            }
+            add_fixup(b, segment.start + offset, kind, _64b ? 8 : 4, value, count, stride);
+            offset += stride * count;
 
-            memset(orig_ptr, BIND_OPCODE_SET_TYPE_IMM, ptr - orig_ptr);
+            add_mark(b, orig_ptr, ptr - orig_ptr, RELOC_MARK_BIND);
             type = BIND_TYPE_POINTER;
             break;    
         }
@@ -311,7 +561,8 @@ static void do_bind_section(prange_t opcodes, struct binary *load, bool weak, bo
     }
 }
 
-static void do_rebase(struct binary *load, prange_t opcodes, addr_t slide) {
+static void do_rebase(struct plan_builder *b, prange_t opcodes) {
+    const struct binary *load = b->load;
     uint8_t pointer_size = b_pointer_size(load);
     uint8_t type = REBASE_TYPE_POINTER;
     addr_t offset = 0;
@@ -379,20 +630,8 @@ static void do_rebase(struct binary *load, prange_t opcodes, addr_t slide) {
                die("bad address while rebasing");
             }
 
-            while(count--) {
-                if(_64b) {
-                    *((uint64_t *) (segment.start + offset)) += slide;
-                } else {
-                    uint32_t *ptr = segment.start + offset;
-                    *ptr += slide;
-                    if(type == REBASE_TYPE_TEXT_PCREL32) {
-                        // WTF!?  This is actually what dyld does.
-                        *ptr = -*ptr;
-                    }
-                }
-
-                offset += stride;
-            }
+            add_fixup(b, segment.start + offset, type == REBASE_TYPE_TEXT_PCREL32 ? RELOC_FIXUP_REBASE_PCREL32 : RELOC_FIXUP_REBASE, _64b ? 8 : 4, 0, count, stride);
+            offset += stride * count;
             break;
         }
         default:
@@ -401,15 +640,17 @@ static void do_rebase(struct binary *load, prange_t opcodes, addr_t slide) {
     }
 }
 
-static void relocate_with_dyld_info(struct binary *load, enum reloc_mode mode, lookupsym_t lookup_sym, void *context, addr_t slide) {
+static void relocate_with_dyld_info(struct plan_builder *b) {
     // It gets more complicated
+    const struct binary *load = b->load;
+    enum reloc_mode mode = b->mode;
     struct dyld_info_command *dyld_info = load->mach->dyld_info;
     #define fetch(type) prange_t type = dyld_info->type##_off ? rangeconv_off((range_t) {load, dyld_info->type##_off, dyld_info->type##_size}, MUST_FIND) : (prange_t) {NULL, 0};
 
-    if(mode != RELOC_EXTERN_ONLY && slide != 0) {
+    if(mode != RELOC_EXTERN_ONLY) {
         fetch(rebase)
-        do_rebase(load, rebase, slide);
-        dyld_info->rebase_size = 0;
+        do_rebase(b, rebase);
+        add_mark(b, &dyld_info->rebase_size, sizeof(dyld_info->rebase_size), RELOC_MARK_REBASE_SIZE);
     }
 
     if(mode != RELOC_LOCAL_ONLY) {
@@ -417,37 +658,669 @@ static void relocate_with_dyld_info(struct binary *load, enum reloc_mode mode, l
         fetch(weak_bind)
         fetch(lazy_bind)
         bool userland = mode == RELOC_USERLAND;
-        do_bind_section(bind, load, userland, userland, lookup_sym, context);
-        do_bind_section(weak_bind, load, true, userland, lookup_sym, context);
-        do_bind_section(lazy_bind, load, userland, userland, lookup_sym, context);
+        do_bind_section(b, bind, userland, userland);
+        do_bind_section(b, weak_bind, true, userland);
+        do_bind_section(b, lazy_bind, userland, userland);
     }
+    #undef fetch
 }
 
-void b_relocate(struct binary *load, const struct binary *target, enum reloc_mode mode, lookupsym_t lookup_sym, void *context, addr_t slide) {
-    if(mode == RELOC_USERLAND && slide != 0) {
-        die("sliding is not supported in userland mode");
+// LC_DYLD_CHAINED_FIXUPS: every page has a linked list of fixups threaded through the pointers themselves
+
+struct chain_page {
+    const struct dyld_chained_starts_in_segment *starts;
+    uint32_t segment;
+    uint32_t page;
+};
+
+struct chain_walk {
+    const struct binary *load;
+    addr_t base; // what DYLD_CHAINED_PTR_*_OFFSET targets are relative to
+    const struct chain_page *pages;
+    const addr_t (*imports)[2]; // resolved address (0 if missing) and addend
+    uint32_t nimports;
+    const char **segment_data;
+    // per page
+    struct reloc_fixup **fixups;
+    uint32_t *nfixups;
+    const char **errors;
+};
+
+static const char *walk_chain(const struct chain_walk *w, const struct chain_page *cp, addr_t off, struct reloc_fixup **fixups, uint32_t *nfixups, uint32_t *capfixups) {
+    const struct dyld_chained_starts_in_segment *sis = cp->starts;
+    const struct data_segment *seg = &w->load->segments[cp->segment];
+    uint16_t format = sis->pointer_format;
+    bool is32 = format == DYLD_CHAINED_PTR_32;
+    uint8_t size = is32 ? 4 : 8;
+    addr_t stride = (format == DYLD_CHAINED_PTR_ARM64E || format == DYLD_CHAINED_PTR_ARM64E_USERLAND || format == DYLD_CHAINED_PTR_ARM64E_USERLAND24) ? 8 : 4;
+    while(1) {
+        if(off >= seg->file_range.size || seg->file_range.size - off < size) {
+            return "chain runs off the end of the segment";
+        }
+        const char *p = w->segment_data[cp->segment] + off;
+        bool bind;
+        uint32_t ordinal = 0;
+        addr_t value = 0, addend = 0, next;
+        uint8_t kind = RELOC_FIXUP_SET_SLIDE;
+        if(is32) {
+            uint32_t raw;
+            memcpy(&raw, p, 4);
+            bind = raw >> 31;
+            if(bind) {
+                struct dyld_chained_ptr_32_bind b;
+                memcpy(&b, &raw, 4);
+                ordinal = b.ordinal;
+                addend = b.addend;
+                next = b.next;
+            } else {
+                struct dyld_chained_ptr_32_rebase r;
+                memcpy(&r, &raw, 4);
+                value = r.target;
+                next = r.next;
+                if(value > sis->max_valid_pointer) {
+                    // not actually a pointer
+                    value -= (0x04000000 + sis->max_valid_pointer) / 2;
+                    kind = RELOC_FIXUP_SET;
+                }
+            }
+        } else {
+            uint64_t raw;
+            memcpy(&raw, p, 8);
+            switch(format) {
+            case DYLD_CHAINED_PTR_64:
+            case DYLD_CHAINED_PTR_64_OFFSET:
+                bind = raw >> 63;
+                if(bind) {
+                    struct dyld_chained_ptr_64_bind b;
+                    memcpy(&b, &raw, 8);
+                    ordinal = b.ordinal;
+                    addend = b.addend;
+                    next = b.next;
+                } else {
+                    struct dyld_chained_ptr_64_rebase r;
+                    memcpy(&r, &raw, 8);
+                    value = r.target;
+                    if(format == DYLD_CHAINED_PTR_64_OFFSET) value += w->base;
+                    value |= (uint64_t) r.high8 << 56;
+                    next = r.next;
+                }
+                break;
+            case DYLD_CHAINED_PTR_ARM64E:
+            case DYLD_CHAINED_PTR_ARM64E_KERNEL:
+            case DYLD_CHAINED_PTR_ARM64E_USERLAND:
+            case DYLD_CHAINED_PTR_ARM64E_USERLAND24: {
+                // authenticated pointers get written unsigned; that's all we can do
+                bool auth = raw >> 63;
+                bind = (raw >> 62) & 1;
+                next = (raw >> 51) & 0x7ff;
+                if(bind) {
+                    ordinal = format == DYLD_CHAINED_PTR_ARM64E_USERLAND24 ? raw & 0xffffff : raw & 0xffff;
+                    if(!auth) {
+                        // 19-bit signed
+                        addend = (addr_t) ((int64_t) (raw << 13) >> 45);
+                    }
+                } else if(auth) {
+                    struct dyld_chained_ptr_arm64e_auth_rebase r;
+                    memcpy(&r, &raw, 8);
+                    value = w->base + r.target;
+                } else {
+                    struct dyld_chained_ptr_arm64e_rebase r;
+                    memcpy(&r, &raw, 8);
+                    value = r.target;
+                    if(format != DYLD_CHAINED_PTR_ARM64E) value += w->base;
+                    value |= (uint64_t) r.high8 << 56;
+                }
+                break;
+            }
+            default:
+                return "unsupported chained pointer format";
+            }
+        }
+
+        if(bind) {
+            if(ordinal >= w->nimports) {
+                return "bad import ordinal in chain";
+            }
+            value = w->imports[ordinal][0];
+            if(value) value += w->imports[ordinal][1] + addend;
+            kind = RELOC_FIXUP_SET;
+        }
+
+        if(*nfixups == *capfixups) {
+            *capfixups = *capfixups ? *capfixups * 2 : 64;
+            *fixups = realloc(*fixups, *capfixups * sizeof(**fixups));
+        }
+        (*fixups)[(*nfixups)++] = (struct reloc_fixup) {seg->file_range.start + off, value, 1, size, kind, size};
+
+        if(!next) return NULL;
+        off += next * stride;
+    }
+}
+
+static void walk_page(void *context, size_t i) {
+    const struct chain_walk *w = context;
+    const struct chain_page *cp = &w->pages[i];
+    const struct dyld_chained_starts_in_segment *sis = cp->starts;
+    addr_t page_off = (addr_t) cp->page * sis->page_size;
+    uint16_t start = sis->page_start[cp->page];
+    uint32_t capfixups = 0;
+    if(start == DYLD_CHAINED_PTR_START_NONE) return;
+    if(!(start & DYLD_CHAINED_PTR_START_MULTI)) {
+        w->errors[i] = walk_chain(w, cp, page_off + start, &w->fixups[i], &w->nfixups[i], &capfixups);
+        return;
+    }
+    // 32-bit formats can have more than one chain on a page; the list is after page_start
+    size_t nstarts = (sis->size - offsetof(struct dyld_chained_starts_in_segment, page_start)) / sizeof(uint16_t);
+    for(size_t j = start & ~DYLD_CHAINED_PTR_START_MULTI; ; j++) {
+        if(j >= nstarts) {
+            w->errors[i] = "chain start list runs off the end";
+            return;
+        }
+        uint16_t s = sis->page_start[j];
+        if((w->errors[i] = walk_chain(w, cp, page_off + (s & ~DYLD_CHAINED_PTR_START_LAST), &w->fixups[i], &w->nfixups[i], &capfixups))) return;
+        if(s & DYLD_CHAINED_PTR_START_LAST) return;
+    }
+}
+
+static void relocate_with_chained_fixups(struct plan_builder *b) {
+    const struct binary *load = b->load;
+    if(b->mode != RELOC_DEFAULT) {
+        die("chained fixups can only be done all at once (RELOC_DEFAULT)");
+    }
+    uint32_t size;
+    const struct dyld_chained_fixups_header *hdr = chained_header(load, &size);
+
+    // imports first, in order, so missing symbols are reported the same way every time
+    struct chain_walk w;
+    memset(&w, 0, sizeof(w));
+    w.load = load;
+    w.base = load->mach->export_baseaddr;
+    w.nimports = hdr->imports_count;
+    addr_t (*imports)[2] = malloc((w.nimports ? w.nimports : 1) * sizeof(*imports));
+    for(uint32_t i = 0; i < w.nimports; i++) {
+        bool weak;
+        const char *name = chained_import(hdr, size, i, &weak, &imports[i][1]);
+        imports[i][0] = lookup_symbol_or_do_stuff(name, resolve(b->r, name), weak, false);
+    }
+    w.imports = (const addr_t (*)[2]) imports;
+
+    const struct dyld_chained_starts_in_image *sii = (const void *) ((const char *) hdr + hdr->starts_offset);
+    if(sii->seg_count > (size - hdr->starts_offset - sizeof(uint32_t)) / sizeof(uint32_t) || sii->seg_count > load->nsegments) {
+        die("bad chained starts");
+    }
+    w.segment_data = calloc(load->nsegments ? load->nsegments : 1, sizeof(*w.segment_data));
+    struct chain_page *pages = NULL;
+    uint32_t npages = 0, cappages = 0;
+    for(uint32_t s = 0; s < sii->seg_count; s++) {
+        if(!sii->seg_info_offset[s]) continue;
+        uint32_t so = hdr->starts_offset + sii->seg_info_offset[s];
+        const struct dyld_chained_starts_in_segment *sis = (const void *) ((const char *) hdr + so);
+        if(sii->seg_info_offset[s] >= size - hdr->starts_offset ||
+           size - so < offsetof(struct dyld_chained_starts_in_segment, page_start) ||
+           sis->size > size - so ||
+           sis->size < offsetof(struct dyld_chained_starts_in_segment, page_start) + sis->page_count * sizeof(uint16_t) ||
+           !sis->page_size) {
+            die("bad chained starts for segment %u", s);
+        }
+        w.segment_data[s] = rangeconv_off(load->segments[s].file_range, MUST_FIND).start;
+        for(uint32_t pg = 0; pg < sis->page_count; pg++) {
+            if(sis->page_start[pg] == DYLD_CHAINED_PTR_START_NONE) continue;
+            if(npages == cappages) {
+                cappages = cappages ? cappages * 2 : 64;
+                pages = realloc(pages, cappages * sizeof(*pages));
+            }
+            pages[npages++] = (struct chain_page) {sis, s, pg};
+        }
+        add_mark(b, sis->page_start, sis->page_count * sizeof(uint16_t), RELOC_MARK_CHAINED);
+    }
+
+    w.pages = pages;
+    w.fixups = calloc(npages ? npages : 1, sizeof(*w.fixups));
+    w.nfixups = calloc(npages ? npages : 1, sizeof(*w.nfixups));
+    w.errors = calloc(npages ? npages : 1, sizeof(*w.errors));
+    parallel_for(npages, walk_page, &w);
+
+    for(uint32_t i = 0; i < npages; i++) {
+        if(w.errors[i]) {
+            die("%s (segment %u page %u)", w.errors[i], pages[i].segment, pages[i].page);
+        }
+    }
+    for(uint32_t i = 0; i < npages; i++) {
+        push_fixups(b, w.fixups[i], w.nfixups[i]);
+        free(w.fixups[i]);
     }
+    free(w.fixups);
+    free(w.nfixups);
+    free(w.errors);
+    free(w.segment_data);
+    free(pages);
+    free(imports);
+}
+
+// the addresses a VANILLA target can point into and still get slid: what rangeconv((range_t) {load, addr, 0}, 0) accepts
+static void get_mapped_ranges(const struct binary *load, struct reloc_plan *plan) {
+    plan->mapped = malloc((load->nsegments ? load->nsegments : 1) * sizeof(*plan->mapped));
+    plan->nmapped = 0;
+    for(uint32_t i = 0; i < load->nsegments; i++) {
+        const struct data_segment *seg = &load->segments[i];
+        addr_t size = seg->file_range.size;
+        if(!load->_map_range) {
+            if(seg->file_range.start > load->valid_range.size) continue;
+            // a zero-byte range right at the end of the file is still valid
+            addr_t room = load->valid_range.size - seg->file_range.start + 1;
+            if(room && size > room) size = room;
+        }
+        plan->mapped[plan->nmapped][0] = seg->vm_range.start;
+        plan->mapped[plan->nmapped][1] = size;
+        plan->nmapped++;
+    }
+}
+
+struct numbered_fixup {
+    struct reloc_fixup f;
+    uint32_t seq;
+};
+
+static int compare_numbered_fixups(const void *a, const void *b) {
+    const struct numbered_fixup *x = a, *y = b;
+    if(x->f.offset != y->f.offset) return x->f.offset < y->f.offset ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static inline addr_t fixup_span(const struct reloc_fixup *f) {
+    return (addr_t) (f->count - 1) * f->stride + f->size;
+}
+
+// sort by offset so the image gets written a page at a time, unless that would reorder two fixups that might touch the same word; then join adjacent VANILLAs into runs
+static void order_fixups(struct reloc_plan *plan) {
+    uint32_t n = plan->nfixups;
+    if(n < 2) return;
+    struct numbered_fixup *nf = malloc(n * sizeof(*nf));
+    for(uint32_t i = 0; i < n; i++) {
+        nf[i] = (struct numbered_fixup) {plan->fixups[i], i};
+    }
+    qsort(nf, n, sizeof(*nf), compare_numbered_fixups);
+
+    addr_t cluster_end = 0;
+    uint32_t cluster_seq = 0;
+    for(uint32_t i = 0; i < n; i++) {
+        addr_t end = nf[i].f.offset + fixup_span(&nf[i].f);
+        if(i == 0 || nf[i].f.offset >= cluster_end) {
+            cluster_end = end;
+            cluster_seq = nf[i].seq;
+        } else {
+            if(cluster_seq > nf[i].seq) goto done;
+            if(end > cluster_end) cluster_end = end;
+            cluster_seq = nf[i].seq;
+        }
+    }
+
+    uint32_t out = 0;
+    for(uint32_t i = 0; i < n; i++) {
+        struct reloc_fixup *prev = out ? &plan->fixups[out - 1] : NULL, *f = &nf[i].f;
+        if(prev &&
+           (f->kind == RELOC_FIXUP_VANILLA || f->kind == RELOC_FIXUP_VANILLA_SLIDE) &&
+           prev->kind == f->kind &&
+           prev->value == f->value &&
+           f->count == 1 &&
+           f->offset == prev->offset + (addr_t) prev->count * 4 &&
+           prev->count < UINT32_MAX) {
+            prev->count++;
+        } else {
+            plan->fixups[out++] = *f;
+        }
+    }
+    plan->nfixups = out;
+    done:
+    free(nf);
+}
 
+void b_relocation_plan(struct reloc_plan *plan, const struct binary *load, enum reloc_mode mode, lookupsym_t lookup_sym, void *context, int flags) {
+    TRACE_SCOPE("b_relocation_plan");
     if(!load->mach->symtab || !load->mach->dysymtab) {
         die("no LC_SYMTAB/LC_DYSYMTAB");
     }
 
-    // check for overlap
-    if(target) {
-        for(uint32_t i = 0; i < load->nsegments; i++) {
-            struct data_segment *a = &load->segments[i];
-            for(uint32_t j = 0; j < target->nsegments; j++) {
-                struct data_segment *b = &target->segments[j];
-                addr_t diff = b->vm_range.start - (a->vm_range.start + slide);
-                if(diff < a->vm_range.size || -diff < b->vm_range.size) {
-                    die("segments of load and target overlap; load:%x+%zu target:%x+%zu", a->vm_range.start, a->vm_range.size, b->vm_range.start, b->vm_range.size);
+    memset(plan, 0, sizeof(*plan));
+    plan->mode = mode;
+    get_mapped_ranges(load, plan);
+
+    struct resolver r;
+    resolver_init(&r, load, lookup_sym, context);
+    if((flags & RELOC_PARALLEL_LOOKUP) && mode != RELOC_LOCAL_ONLY) {
+        prepass(load, &r);
+    }
+    struct plan_builder b = {load, mode, &r, plan, 0, 0};
+    if(load->mach->chained_fixups) {
+        relocate_with_chained_fixups(&b);
+    } else if(load->mach->dyld_info) {
+        relocate_with_dyld_info(&b);
+    } else {
+        relocate_with_symtab(&b);
+    }
+    resolver_free(&r);
+
+    order_fixups(plan);
+}
+
+void b_free_relocation_plan(struct reloc_plan *plan) {
+    free(plan->fixups);
+    free(plan->marks);
+    free(plan->mapped);
+    memset(plan, 0, sizeof(*plan));
+}
+
+// applying a plan
+
+typedef uint32_t v4u32 __attribute__((vector_size(16)));
+typedef uint64_t v2u64 __attribute__((vector_size(16)));
+
+static void slide_words_32(uint32_t *p, addr_t count, uint32_t slide, bool negate) {
+    v4u32 vs = {slide, slide, slide, slide};
+    addr_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        v4u32 v;
+        memcpy(&v, p + i, sizeof(v));
+        v += vs;
+        if(negate) v = -v;
+        memcpy(p + i, &v, sizeof(v));
+    }
+    for(; i < count; i++) {
+        p[i] += slide;
+        if(negate) p[i] = -p[i];
+    }
+}
+
+static void slide_words_64(uint64_t *p, addr_t count, uint64_t slide) {
+    v2u64 vs = {slide, slide};
+    addr_t i = 0;
+    for(; i + 2 <= count; i += 2) {
+        v2u64 v;
+        memcpy(&v, p + i, sizeof(v));
+        v += vs;
+        memcpy(p + i, &v, sizeof(v));
+    }
+    if(i < count) p[i] += slide;
+}
+
+static inline bool is_mapped(const struct reloc_plan *plan, addr_t addr) {
+    bool in = false;
+    for(uint32_t s = 0; s < plan->nmapped; s++) {
+        in |= addr - plan->mapped[s][0] < plan->mapped[s][1];
+    }
+    return in;
+}
+
+// these return an error message rather than dying, since they run on worker threads
+
+static const char *apply_br24(uint32_t *p, addr_t value, addr_t slide) {
+    uint32_t ins = *p;
+    uint32_t off = ins & 0x00ffffff;
+    if(ins & 0x00800000) off |= 0xff000000;
+    off <<= 2;
+    off += (value - slide);
+    if((off & 0xfc000000) != 0 &&
+       (off & 0xfc000000) != 0xfc000000) {
+        return "BR24 relocation out of range";
+    }
+    uint32_t cond = ins >> 28;
+    if(value & 1) {
+        if(cond != 0xe && cond != 0xf) return "can't convert BL with condition to BLX (which must be unconditional)";
+        ins = (ins & 0x0effffff) | 0xf0000000 | ((off & 2) << 24);
+    } else if(cond == 0xf) {
+        ins = (ins & 0x0fffffff) | 0xe0000000;
+    }
+
+    ins = (ins & 0xff000000) | ((off >> 2) & 0x00ffffff);
+    *p = ins;
+    return NULL;
+}
+
+static const char *apply_fixup(const struct reloc_plan *plan, const struct reloc_fixup *f, void *start, addr_t slide) {
+    switch(f->kind) {
+    case RELOC_FIXUP_REBASE:
+    case RELOC_FIXUP_REBASE_PCREL32: {
+        // WTF!?  This is actually what dyld does.
+        bool negate = f->kind == RELOC_FIXUP_REBASE_PCREL32;
+        if(f->size == 8) {
+            if(f->stride == 8) {
+                slide_words_64(start, f->count, slide);
+            } else {
+                for(uint32_t i = 0; i < f->count; i++) {
+                    *((uint64_t *) (start + (addr_t) i * f->stride)) += slide;
+                }
+            }
+        } else {
+            if(f->stride == 4) {
+                slide_words_32(start, f->count, (uint32_t) slide, negate);
+            } else {
+                for(uint32_t i = 0; i < f->count; i++) {
+                    uint32_t *ptr = start + (addr_t) i * f->stride;
+                    *ptr += slide;
+                    if(negate) *ptr = -*ptr;
                 }
             }
         }
+        break;
     }
-    
-    (load->mach->dyld_info ? relocate_with_dyld_info : relocate_with_symtab)(load, mode, lookup_sym, context, slide);
-    
+    case RELOC_FIXUP_SET:
+    case RELOC_FIXUP_SET_PCREL32: {
+        addr_t value = f->value;
+        for(uint32_t i = 0; i < f->count; i++) {
+            void *ptr = start + (addr_t) i * f->stride;
+            if(f->size == 8) {
+                *((uint64_t *) ptr) = value;
+            } else {
+                *((uint32_t *) ptr) = value;
+            }
+            if(f->kind == RELOC_FIXUP_SET_PCREL32) value += f->stride;
+        }
+        break;
+    }
+    case RELOC_FIXUP_VANILLA:
+    case RELOC_FIXUP_VANILLA_SLIDE: {
+        // when dyld_stub_binding_helper (which would just crash, btw) is present, entries in the indirect section point to it; usually this increments to point to the right dyld_stub_binding_helper, then that's clobbered by the indirect code.  when we do prelinking, the indirect code runs first and we would be relocating the already-correctly-located importee symbol, so we add this check (easier than actually checking that it's not in the indirect section) to make sure we're not relocating nonsense.
+        uint32_t value = f->kind == RELOC_FIXUP_VANILLA ? f->value : slide;
+        uint32_t *p = start;
+        // branch free, so a run of these vectorizes
+        for(uint32_t i = 0; i < f->count; i++) {
+            uint32_t v = p[i];
+            p[i] = v + (is_mapped(plan, v) ? value : 0);
+        }
+        break;
+    }
+    case RELOC_FIXUP_SET_SLIDE:
+        for(uint32_t i = 0; i < f->count; i++) {
+            void *ptr = start + (addr_t) i * f->stride;
+            if(f->size == 8) {
+                *((uint64_t *) ptr) = f->value + slide;
+            } else {
+                *((uint32_t *) ptr) = f->value + slide;
+            }
+        }
+        break;
+    case RELOC_FIXUP_BR24:
+    case RELOC_FIXUP_BR24_SLIDE:
+        return apply_br24(start, f->kind == RELOC_FIXUP_BR24 ? f->value : slide, slide);
+    default:
+        return "bad fixup kind";
+    }
+    return NULL;
+}
+
+static void apply_marks(const struct reloc_plan *plan, struct binary *load, addr_t slide) {
+    for(uint32_t i = 0; i < plan->nmarks; i++) {
+        const struct reloc_mark *m = &plan->marks[i];
+        void *p = rangeconv_off((range_t) {load, m->offset, m->size}, MUST_FIND).start;
+        switch(m->kind) {
+        case RELOC_MARK_RELOC: {
+            if(m->size != sizeof(struct relocation_info)) die("bad mark");
+            struct relocation_info *ri = p;
+            ri->r_address = 0;
+            ri->r_symbolnum = R_ABS;
+            break;
+        }
+        case RELOC_MARK_INDIRECT:
+            if(m->size != sizeof(uint32_t)) die("bad mark");
+            *((uint32_t *) p) = INDIRECT_SYMBOL_ABS;
+            break;
+        case RELOC_MARK_BIND:
+            memset(p, BIND_OPCODE_SET_TYPE_IMM, m->size);
+            break;
+        case RELOC_MARK_REBASE_SIZE:
+            if(m->size != sizeof(uint32_t)) die("bad mark");
+            if(slide != 0) *((uint32_t *) p) = 0;
+            break;
+        case RELOC_MARK_CHAINED:
+            memset(p, 0xff, m->size);
+            break;
+        default:
+            die("bad mark kind %d", (int) m->kind);
+        }
+    }
+}
+
+struct apply_error {
+    const char *message; // NULL if it went fine
+    uint32_t fixup;
+};
+
+struct apply_job {
+    const struct reloc_plan *plan;
+    struct binary *load;
+    addr_t slide;
+    uint32_t *order; // indices into plan->fixups, grouped, each group in plan order
+    uint32_t *group_start;
+    uint32_t ngroups;
+    struct apply_error *errors; // one per group
+};
+
+static void apply_group(void *context, size_t g) {
+    const struct apply_job *job = context;
+    const struct reloc_plan *plan = job->plan;
+    addr_t slide = job->slide;
+    // [win_start, win_start + win_size) is the part of the file we have a pointer to, usually the rest of a page
+    addr_t win_start = 0, win_size = 0;
+    char *win = NULL;
+    for(uint32_t k = job->group_start[g]; k < job->group_start[g + 1]; k++) {
+        uint32_t i = job->order[k];
+        const struct reloc_fixup *f = &plan->fixups[i];
+        // without a slide, rebases don't get done at all (which matters for PCREL32)
+        if(!slide && (f->kind == RELOC_FIXUP_REBASE || f->kind == RELOC_FIXUP_REBASE_PCREL32)) continue;
+        addr_t span = fixup_span(f);
+        if(f->offset < win_start || f->offset - win_start > win_size || win_size - (f->offset - win_start) < span) {
+            prange_t pr = {NULL, 0};
+            addr_t want = ((f->offset | 0xfff) + 1) - f->offset;
+            // offset 0 is special to rangeconv_off (dyld caches), so don't use it as the base of a window
+            if(f->offset && want > span) {
+                pr = rangeconv_off((range_t) {job->load, f->offset, want}, 0);
+            }
+            if(!pr.start) {
+                pr = rangeconv_off((range_t) {job->load, f->offset, span}, 0);
+            }
+            if(!pr.start) {
+                job->errors[g] = (struct apply_error) {"fixup outside the binary", i};
+                return;
+            }
+            win_start = f->offset;
+            win_size = f->offset ? pr.size : 0;
+            win = pr.start;
+        }
+        TRACE_COUNT(TRACE_FIXUPS, f->count);
+        const char *error = apply_fixup(plan, f, win + (f->offset - win_start), slide);
+        if(error) {
+            job->errors[g] = (struct apply_error) {error, i};
+            return;
+        }
+    }
+}
+
+void b_apply_relocation_plan(const struct reloc_plan *plan, struct binary *load, addr_t slide) {
+    TRACE_SCOPE("b_apply_relocation_plan");
+    enum reloc_mode mode = plan->mode;
+    if(mode == RELOC_USERLAND && slide != 0) {
+        die("sliding is not supported in userland mode");
+    }
+
+    // fixups in different segments never touch the same word, so each segment gets its own thread
+    struct apply_job job = {plan, load, slide, NULL, NULL, 0, NULL};
+    uint32_t nsegs = load->nsegments;
+    uint32_t *segment_of = malloc((plan->nfixups ? plan->nfixups : 1) * sizeof(uint32_t));
+    bool by_segment = true;
+    for(uint32_t i = 0; i < nsegs && by_segment; i++) {
+        for(uint32_t j = i + 1; j < nsegs; j++) {
+            range_t a = load->segments[i].file_range, b = load->segments[j].file_range;
+            if(a.size && b.size && (a.start - b.start < b.size || b.start - a.start < a.size)) {
+                by_segment = false;
+                break;
+            }
+        }
+    }
+    uint32_t last = 0;
+    addr_t total = 0;
+    for(uint32_t i = 0; i < plan->nfixups && by_segment; i++) {
+        const struct reloc_fixup *f = &plan->fixups[i];
+        addr_t span = fixup_span(f);
+        total += f->count;
+        if(last < nsegs && f->offset - load->segments[last].file_range.start < load->segments[last].file_range.size) goto found;
+        for(last = 0; last < nsegs; last++) {
+            if(f->offset - load->segments[last].file_range.start < load->segments[last].file_range.size) goto found;
+        }
+        // not in any segment?
+        by_segment = false;
+        break;
+        found:
+        if(load->segments[last].file_range.start + load->segments[last].file_range.size - f->offset < span) {
+            by_segment = false;
+            break;
+        }
+        segment_of[i] = last;
+    }
+    if(!by_segment || total < 16384) {
+        nsegs = 1;
+        memset(segment_of, 0, (plan->nfixups ? plan->nfixups : 1) * sizeof(uint32_t));
+    }
+
+    job.ngroups = nsegs;
+    job.group_start = calloc(nsegs + 1, sizeof(uint32_t));
+    job.order = malloc((plan->nfixups ? plan->nfixups : 1) * sizeof(uint32_t));
+    job.errors = calloc(nsegs, sizeof(*job.errors));
+    for(uint32_t i = 0; i < plan->nfixups; i++) {
+        job.group_start[segment_of[i] + 1]++;
+    }
+    for(uint32_t g = 0; g < nsegs; g++) {
+        job.group_start[g + 1] += job.group_start[g];
+    }
+    uint32_t *fill = malloc((nsegs ? nsegs : 1) * sizeof(uint32_t));
+    memcpy(fill, job.group_start, nsegs * sizeof(uint32_t));
+    for(uint32_t i = 0; i < plan->nfixups; i++) {
+        job.order[fill[segment_of[i]]++] = i;
+    }
+    free(fill);
+    free(segment_of);
+
+    if(nsegs == 1) {
+        apply_group(&job, 0);
+    } else {
+        parallel_for(nsegs, apply_group, &job);
+    }
+
+    // the same error no matter how the threads went
+    const struct apply_error *first = NULL;
+    for(uint32_t g = 0; g < nsegs; g++) {
+        if(job.errors[g].message && (!first || job.errors[g].fixup < first->fixup)) {
+            first = &job.errors[g];
+        }
+    }
+    if(first) {
+        die("%s (fixup %u at offset %llx)", first->message, first->fixup, (unsigned long long) plan->fixups[first->fixup].offset);
+    }
+    free(job.group_start);
+    free(job.order);
+    free(job.errors);
+
+    apply_marks(plan, load, slide);
+
     if(mode != RELOC_EXTERN_ONLY && slide != 0) {
         CMD_ITERATE(b_mach_hdr(load), cmd) {
             MACHO_SPECIALIZE(
@@ -462,5 +1335,104 @@ void b_relocate(struct binary *load, const struct binary *target, enum reloc_mod
             )
         }
     }
+    b_macho_forget_caches(load);
+}
+
+// serialized plans are a header and then the three arrays, in native byte order
+
+struct reloc_plan_header {
+    char magic[8]; // "relplan1"
+    uint32_t mode;
+    uint32_t nfixups, nmarks, nmapped;
+    uint32_t fixup_size, mark_size; // sizeof the structs, as a sanity check
+};
+
+prange_t b_serialize_relocation_plan(const struct reloc_plan *plan) {
+    size_t fs = plan->nfixups * sizeof(*plan->fixups), ms = plan->nmarks * sizeof(*plan->marks), as = plan->nmapped * sizeof(*plan->mapped);
+    struct reloc_plan_header hdr = {"relplan1", plan->mode, plan->nfixups, plan->nmarks, plan->nmapped, sizeof(*plan->fixups), sizeof(*plan->marks)};
+    prange_t pr = {malloc(sizeof(hdr) + fs + ms + as), sizeof(hdr) + fs + ms + as};
+    char *p = pr.start;
+    memcpy(p, &hdr, sizeof(hdr)); p += sizeof(hdr);
+    memcpy(p, plan->fixups, fs); p += fs;
+    memcpy(p, plan->marks, ms); p += ms;
+    memcpy(p, plan->mapped, as);
+    return pr;
 }
 
+void b_deserialize_relocation_plan(struct reloc_plan *plan, prange_t data) {
+    struct reloc_plan_header hdr;
+    if(data.size < sizeof(hdr)) die("truncated relocation plan");
+    memcpy(&hdr, data.start, sizeof(hdr));
+    if(memcmp(hdr.magic, "relplan1", 8) || hdr.fixup_size != sizeof(*plan->fixups) || hdr.mark_size != sizeof(*plan->marks) || hdr.mode > RELOC_USERLAND) {
+        die("not a relocation plan (or one from a different kind of machine)");
+    }
+    uint64_t fs = (uint64_t) hdr.nfixups * sizeof(*plan->fixups), ms = (uint64_t) hdr.nmarks * sizeof(*plan->marks), as = (uint64_t) hdr.nmapped * sizeof(*plan->mapped);
+    if(fs + ms + as != data.size - sizeof(hdr)) die("truncated relocation plan");
+    memset(plan, 0, sizeof(*plan));
+    plan->mode = hdr.mode;
+    plan->nfixups = hdr.nfixups;
+    plan->nmarks = hdr.nmarks;
+    plan->nmapped = hdr.nmapped;
+    char *p = data.start + sizeof(hdr);
+    plan->fixups = malloc(fs ? fs : 1); memcpy(plan->fixups, p, fs); p += fs;
+    plan->marks = malloc(ms ? ms : 1); memcpy(plan->marks, p, ms); p += ms;
+    plan->mapped = malloc(as ? as : 1); memcpy(plan->mapped, p, as);
+    for(uint32_t i = 0; i < plan->nfixups; i++) {
+        const struct reloc_fixup *f = &plan->fixups[i];
+        if(!f->count || (f->size != 4 && f->size != 8) || f->kind > RELOC_FIXUP_SET_SLIDE || f->stride < f->size) {
+            die("bad fixup %u", i);
+        }
+        // these ones write 32-bit words no matter what; VANILLAs are also always contiguous
+        switch(f->kind) {
+        case RELOC_FIXUP_VANILLA:
+        case RELOC_FIXUP_VANILLA_SLIDE:
+            if(f->stride != 4) die("bad fixup %u", i);
+            // fallthrough
+        case RELOC_FIXUP_REBASE_PCREL32:
+        case RELOC_FIXUP_SET_PCREL32:
+        case RELOC_FIXUP_BR24:
+        case RELOC_FIXUP_BR24_SLIDE:
+            if(f->size != 4) die("bad fixup %u", i);
+            break;
+        }
+    }
+}
+
+void b_relocate(struct binary *load, const struct binary *target, enum reloc_mode mode, lookupsym_t lookup_sym, void *context, addr_t slide) {
+    b_relocate_ex(load, target, mode, lookup_sym, context, slide, 0);
+}
+
+void b_relocate_ex(struct binary *load, const struct binary *target, enum reloc_mode mode, lookupsym_t lookup_sym, void *context, addr_t slide, int flags) {
+    TRACE_SCOPE("b_relocate");
+    if(mode == RELOC_USERLAND && slide != 0) {
+        die("sliding is not supported in userland mode");
+    }
+
+    if(!load->mach->symtab || !load->mach->dysymtab) {
+        die("no LC_SYMTAB/LC_DYSYMTAB");
+    }
+
+    // check for overlap
+    if(target) {
+        for(uint32_t i = 0; i < load->nsegments; i++) {
+            struct data_segment *a = &load->segments[i];
+            for(uint32_t j = 0; j < target->nsegments; j++) {
+                struct data_segment *b = &target->segments[j];
+                addr_t diff = b->vm_range.start - (a->vm_range.start + slide);
+                if(diff < a->vm_range.size || -diff < b->vm_range.size) {
+                    die("segments of load and target overlap; load:%x+%zu target:%x+%zu", a->vm_range.start, a->vm_range.size, b->vm_range.start, b->vm_range.size);
+                }
+            }
+        }
+    }
+    
+    if(target && target->mach && (flags & RELOC_PARALLEL_LOOKUP)) {
+        // lookup_sym is usually b_sym on target
+        b_macho_prepare_concurrent_sym(target, 0);
+    }
+
+    struct reloc_plan plan;
+    b_relocation_plan(&plan, load, mode, lookup_sym, context, flags);
+    b_apply_relocation_plan(&plan, load, slide);
+    b_free_relocation_plan(&plan);
+}
@@ -10,8 +10,72 @@ enum reloc_mode {
     RELOC_USERLAND
 };
 
+// what b_relocate would do, worked out ahead of time without touching the binary; see b_relocation_plan
+
+enum reloc_fixup_kind {
+    RELOC_FIXUP_REBASE,         // += slide
+    RELOC_FIXUP_REBASE_PCREL32, // = -(word + slide), like dyld; only when sliding
+    RELOC_FIXUP_SET,            // = value
+    RELOC_FIXUP_SET_PCREL32,    // = value + i * stride, for the ith word
+    RELOC_FIXUP_VANILLA,        // += value, if the word points into the binary
+    RELOC_FIXUP_VANILLA_SLIDE,  // += slide, ditto
+    RELOC_FIXUP_BR24,           // ARM B/BL to value
+    RELOC_FIXUP_BR24_SLIDE,     // ditto, to a local target
+    RELOC_FIXUP_SET_SLIDE,      // = value + slide
+};
+
+struct reloc_fixup {
+    addr_t offset; // file offset of the first word
+    addr_t value;
+    uint32_t count, stride;
+    uint8_t kind;
+    uint8_t size; // 4 or 8
+};
+
+// the bookkeeping b_relocate does so nothing gets relocated twice
+enum reloc_mark_kind {
+    RELOC_MARK_RELOC,       // relocation_info -> R_ABS
+    RELOC_MARK_INDIRECT,    // indirect symbol -> INDIRECT_SYMBOL_ABS
+    RELOC_MARK_BIND,        // bind opcodes -> BIND_OPCODE_SET_TYPE_IMM
+    RELOC_MARK_REBASE_SIZE, // dyld_info rebase_size -> 0, when sliding
+    RELOC_MARK_CHAINED,     // a segment's chained fixup page starts -> DYLD_CHAINED_PTR_START_NONE
+};
+
+struct reloc_mark {
+    addr_t offset;
+    uint32_t size;
+    uint8_t kind;
+};
+
+struct reloc_plan {
+    enum reloc_mode mode;
+    struct reloc_fixup *fixups; // in the order they get applied
+    uint32_t nfixups;
+    struct reloc_mark *marks;
+    uint32_t nmarks;
+    addr_t (*mapped)[2]; // start and size of the segments, for the VANILLA check
+    uint32_t nmapped;
+};
+
 __BEGIN_DECLS
 
 void b_relocate(struct binary *load, const struct binary *target /* can be null to not check for overlap */, enum reloc_mode mode, lookupsym_t lookup_sym, void *context, addr_t slide);
 
+// flags for b_relocate_ex
+#define RELOC_PARALLEL_LOOKUP 1 // lookup_sym is thread safe, so look up every symbol that will be needed up front, in parallel.  b_sym is only thread safe after b_macho_prepare_concurrent_sym, which b_relocate_ex calls on target (for plain exports)
+
+// each symbol is passed to lookup_sym at most once per call
+// binaries with LC_DYLD_CHAINED_FIXUPS can only be done with RELOC_DEFAULT, since the chains get used up
+void b_relocate_ex(struct binary *load, const struct binary *target, enum reloc_mode mode, lookupsym_t lookup_sym, void *context, addr_t slide, int flags);
+
+// everything b_relocate_ex would do to load, for any slide, without changing load (so all the symbol lookups happen here)
+void b_relocation_plan(struct reloc_plan *plan, const struct binary *load, enum reloc_mode mode, lookupsym_t lookup_sym, void *context, int flags);
+// load has to be an unrelocated copy of the binary the plan came from; the result is the same as b_relocate_ex's
+void b_apply_relocation_plan(const struct reloc_plan *plan, struct binary *load, addr_t slide);
+void b_free_relocation_plan(struct reloc_plan *plan);
+
+// native byte order; the result is malloced
+prange_t b_serialize_relocation_plan(const struct reloc_plan *plan);
+void b_deserialize_relocation_plan(struct reloc_plan *plan, prange_t data);
+
 __END_DECLS
@@ -1,12 +1,13 @@
-#ifdef __APPLE__
 #include "running_kernel.h"
 #include "find.h"
 #include "mach-o/link.h"
 #include "mach-o/binary.h"
 #include "mach-o/headers/loader.h"
 #include "mach-o/headers/nlist.h"
-#include <mach/mach.h>
 #include <assert.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
 
 struct proc;
 typedef int32_t sy_call_t(struct proc *, void *, int *);
@@ -28,6 +29,7 @@ struct sysent {     /* system call table */
 
 // end copied
 
+#ifdef __APPLE__
 kern_return_t kr_assert_(kern_return_t kr, const char *name, int line) {
     if(kr) {
         die("result=%08x on line %d:\n%s", kr, line, name);
@@ -43,27 +45,69 @@ mach_port_t get_kernel_task() {
     }
     return kernel_task;
 }
+#endif
+
+static struct kmem *kernel_mem;
+
+void b_running_kernel_use(struct kmem *mem) {
+    kernel_mem = mem;
+}
+
+static struct kmem *get_kernel_mem() {
+    if(!kernel_mem) {
+#ifdef __APPLE__
+        static struct kmem task_mem;
+        kmem_init_task(&task_mem, get_kernel_task());
+        kernel_mem = &task_mem;
+#else
+        die("no kernel memory to use; see b_running_kernel_use");
+#endif
+    }
+    // it's live memory, so don't trust anything from last time
+    kmem_invalidate(kernel_mem);
+    return kernel_mem;
+}
+
+// point syscall 11 at each function in turn and call it
+static void call_via_sysent(struct kmem *mem, uint32_t sysent, const uint32_t *funcs, uint32_t count) {
+    if(!count) return;
+#ifdef __APPLE__
+    // how do I safely dispose of this file?
+    int lockfd = open("/tmp/.syscall-11", O_RDWR | O_CREAT);
+    assert(lockfd > 0);
+    assert(!flock(lockfd, LOCK_EX));
+
+    struct sysent orig_sysent;
+    kmem_read(mem, sysent + 11 * sizeof(struct sysent), &orig_sysent, sizeof(struct sysent));
+
+    for(uint32_t i = 0; i < count; i++) {
+        struct sysent my_sysent = { 1, 0, 0, (void *) (uintptr_t) funcs[i], NULL, NULL, _SYSCALL_RET_INT_T, 0 };
+        printf("--> %08x\n", funcs[i]);
+        kmem_write(mem, sysent + 11 * sizeof(struct sysent), &my_sysent, sizeof(struct sysent));
+        kmem_sync(mem);
+        syscall(11);
+    }
+
+    kmem_write(mem, sysent + 11 * sizeof(struct sysent), &orig_sysent, sizeof(struct sysent));
+    kmem_sync(mem);
+
+    assert(!flock(lockfd, LOCK_UN));
+#else
+    (void) mem; (void) sysent; (void) funcs;
+    die("can't call into the kernel from here");
+#endif
+}
 
 uint32_t b_allocate_from_running_kernel(const struct binary *binary) {
-    mach_port_t kernel_task = get_kernel_task();
+    struct kmem *mem = get_kernel_mem();
     if(b_mach_hdr(binary)->flags & MH_PREBOUND) {
         CMD_ITERATE(b_mach_hdr(binary), cmd) {
             if(cmd->cmd == LC_SEGMENT) {
                 struct segment_command *seg = (void *) cmd;
                 if(seg->vmsize == 0) continue;
-                vm_address_t address = seg->vmaddr;
-                printf("prebound allocate %08x %08x\n", (unsigned int) address, (unsigned int) seg->vmsize);
-                kr_assert(vm_allocate(kernel_task,
-                                      &address,
-                                      seg->vmsize,
-                                      VM_FLAGS_FIXED));
-
-                assert(address == seg->vmaddr);
-                kr_assert(vm_wire(mach_host_self(),
-                                  kernel_task,
-                                  address,
-                                  seg->vmsize,
-                                  VM_PROT_READ));
+                printf("prebound allocate %08x %08x\n", (unsigned int) seg->vmaddr, (unsigned int) seg->vmsize);
+                int err = kmem_allocate(mem, seg->vmaddr, seg->vmsize);
+                if(err) die("couldn't allocate %08x: %d", (unsigned int) seg->vmaddr, err);
             }
         }
         return 0;
@@ -75,19 +119,9 @@ uint32_t b_allocate_from_running_kernel(const struct binary *binary) {
                 if(cmd->cmd == LC_SEGMENT) {
                     struct segment_command *seg = (void *) cmd;
                     if(seg->vmsize == 0) continue;
-                    vm_address_t address = seg->vmaddr + slide;
+                    uint32_t address = seg->vmaddr + slide;
                     printf("allocate %08x %08x for %.16s (slide=%x)\n", (int) address, (int) seg->vmsize, seg->segname, (int) slide);
-                    kern_return_t kr = vm_allocate(kernel_task,
-                                                   &address,
-                                                   seg->vmsize,
-                                                   VM_FLAGS_FIXED);
-                    if(!kr) {
-                        assert(address == seg->vmaddr + slide);
-                        kr_assert(vm_wire(mach_host_self(),
-                                          kernel_task,
-                                          address,
-                                          seg->vmsize,
-                                          VM_PROT_READ));
+                    if(!kmem_allocate(mem, address, seg->vmsize)) {
                         continue;
                     }
                     // Bother, it didn't work.  So we need to increase the slide...
@@ -96,10 +130,9 @@ uint32_t b_allocate_from_running_kernel(const struct binary *binary) {
                         if(cmd2 == cmd) break;
                         if(cmd2->cmd == LC_SEGMENT) {
                             struct segment_command *seg2 = (void *) cmd2;
+                            if(seg2->vmsize == 0) continue;
                             printf("deallocate %08x %08x\n", (int) (seg2->vmaddr + slide), (int) seg2->vmsize);
-                            kr_assert(vm_deallocate(kernel_task,
-                                                    seg2->vmaddr + slide,
-                                                    seg2->vmsize));
+                            kmem_deallocate(mem, seg2->vmaddr + slide, seg2->vmsize);
                         }
                     }
                     goto try_another_slide;
@@ -121,66 +154,27 @@ void b_inject_into_running_kernel(struct binary *to_load, uint32_t sysent) {
     // save sysent so unload can have it
     b_mach_hdr(to_load)->filetype = sysent;
 
-    mach_port_t kernel_task = get_kernel_task();
+    struct kmem *mem = get_kernel_mem();
 
+    // protecting a segment sends its pending write out first, so each segment is written before it's protected and flushed; the protects and flushes wait for kmem_sync, where adjacent segments' ones get merged if the protections match
     CMD_ITERATE(b_mach_hdr(to_load), cmd) {
         if(cmd->cmd == LC_SEGMENT) {
             struct segment_command *seg = (void *) cmd;
             uint32_t fs = seg->filesize;
             if(seg->vmsize < fs) fs = seg->vmsize;
             // if prebound, slide = 0
-            vm_offset_t of = (vm_offset_t) rangeconv_off((range_t) {to_load, seg->fileoff, seg->filesize}, MUST_FIND).start;
-            vm_address_t ad = seg->vmaddr;
-            while(fs > 0) {
-                // complete headbang.
-                //printf("(%.16s) reading %x %08x -> %08x\n", seg->segname, fs, (uint32_t) of, (uint32_t) ad);
-                uint32_t tocopy = 0xfff;
-                if(fs < tocopy) tocopy = fs;
-                kr_assert(vm_write(kernel_task,
-                                   ad,
-                                   of,
-                                   tocopy));
-                fs -= tocopy;
-                of += tocopy;
-                ad += tocopy;
-            }
+            kmem_write(mem, seg->vmaddr, rangeconv_off((range_t) {to_load, seg->fileoff, seg->filesize}, MUST_FIND).start, fs);
             if(seg->vmsize > 0) {
                 // This really depends on nx_disabled...
-                kr_assert(vm_protect(kernel_task,
-                                     seg->vmaddr,
-                                     seg->vmsize,
-                                     true,
-                                     seg->maxprot & ~VM_PROT_EXECUTE));
-                kr_assert(vm_protect(kernel_task,
-                                     seg->vmaddr,
-                                     seg->vmsize,
-                                     false,
-                                     seg->initprot & ~VM_PROT_EXECUTE));
-
-                vm_machine_attribute_val_t val = MATTR_VAL_CACHE_FLUSH;
-                kr_assert(vm_machine_attribute(kernel_task,
-                                               seg->vmaddr,
-                                               seg->vmsize,
-                                               MATTR_CACHE,
-                                               &val));
+                kmem_protect(mem, seg->vmaddr, seg->vmsize, true, seg->maxprot & ~PROT_EXEC);
+                kmem_protect(mem, seg->vmaddr, seg->vmsize, false, seg->initprot & ~PROT_EXEC);
+                kmem_flush_cache(mem, seg->vmaddr, seg->vmsize);
             }
         }
     }
+    kmem_sync(mem);
 
     // okay, now do the fancy syscall stuff
-    // how do I safely dispose of this file?
-    int lockfd = open("/tmp/.syscall-11", O_RDWR | O_CREAT);
-    assert(lockfd > 0);
-    assert(!flock(lockfd, LOCK_EX));
-
-    struct sysent orig_sysent;
-    vm_size_t whatever;
-    kr_assert(vm_read_overwrite(kernel_task,
-                                sysent + 11 * sizeof(struct sysent),
-                                sizeof(struct sysent),
-                                (vm_offset_t) &orig_sysent,
-                                &whatever));
-
     CMD_ITERATE(b_mach_hdr(to_load), cmd) {
         if(cmd->cmd == LC_SEGMENT) {
             struct segment_command *seg = (void *) cmd;
@@ -189,50 +183,29 @@ void b_inject_into_running_kernel(struct binary *to_load, uint32_t sysent) {
                 struct section *sect = &sections[i];
 
                 if((sect->flags & SECTION_TYPE) == S_MOD_INIT_FUNC_POINTERS) {
-                    void **things = rangeconv_off((range_t) {to_load, sect->offset, sect->size}, MUST_FIND).start;
-                    for(uint32_t i = 0; i < sect->size / 4; i++) {
-                        struct sysent my_sysent = { 1, 0, 0, things[i], NULL, NULL, _SYSCALL_RET_INT_T, 0 };
-                        printf("--> %p\n", things[i]);
-                        kr_assert(vm_write(kernel_task,
-                                           (vm_address_t) sysent + 11 * sizeof(struct sysent),
-                                           (vm_offset_t) &my_sysent,
-                                           sizeof(struct sysent)));
-                        syscall(11);
-                    }
+                    const uint32_t *things = rangeconv_off((range_t) {to_load, sect->offset, sect->size}, MUST_FIND).start;
+                    call_via_sysent(mem, sysent, things, sect->size / 4);
                 }
             }
         }
     }
-
-    kr_assert(vm_write(kernel_task,
-                       sysent + 11 * sizeof(struct sysent),
-                       (vm_offset_t) &orig_sysent,
-                       sizeof(struct sysent)));
-
-    assert(!flock(lockfd, LOCK_UN));
 }
 
 void unload_from_running_kernel(uint32_t addr) {
-    mach_port_t kernel_task = get_kernel_task();
+    struct kmem *mem = get_kernel_mem();
 
-    vm_size_t whatever;
-    
-    autofree struct mach_header *hdr = malloc(0x1000);
-    if(vm_read_overwrite(kernel_task,
-                         (vm_address_t) addr,
-                         0x1000,
-                         (vm_offset_t) hdr,
-                         &whatever) == KERN_INVALID_ADDRESS) {
+    if(!kmem_probe(mem, addr)) {
         die("invalid address %08x", addr);
     }
-    kr_assert(vm_read_overwrite(kernel_task,
-                                (vm_address_t) addr,
-                                0xfff,
-                                (vm_offset_t) hdr,
-                                &whatever));
+    char hdr_buf[0xfff];
+    struct mach_header *hdr = (void *) hdr_buf;
+    kmem_read(mem, addr, hdr_buf, sizeof(hdr_buf));
     if(hdr->magic != MH_MAGIC) {
         die("invalid header (wrong address?)");
     }
+    if(hdr->sizeofcmds > sizeof(hdr_buf) - sizeof(*hdr)) {
+        die("sizeofcmds is too big");
+    }
     CMD_ITERATE(hdr, cmd) {
         if(cmd->cmd == LC_SEGMENT) {
             struct segment_command *seg = (void *) cmd;
@@ -243,21 +216,9 @@ void unload_from_running_kernel(uint32_t addr) {
                 if((sect->flags & SECTION_TYPE) == S_MOD_TERM_FUNC_POINTERS) {
                     uint32_t sysent = hdr->filetype; // hurf durf
                     assert(sysent);
-                    autofree void **things = malloc(sect->size);
-                    kr_assert(vm_read_overwrite(kernel_task,
-                                                (vm_address_t) sect->addr,
-                                                sect->size,
-                                                (vm_offset_t) things,
-                                                &whatever));
-                    for(uint32_t i = 0; i < sect->size / 4; i++) {
-                        struct sysent my_sysent = { 1, 0, 0, things[i], NULL, NULL, _SYSCALL_RET_INT_T, 0 };
-                        printf("--> %p\n", things[i]);
-                        kr_assert(vm_write(kernel_task,
-                                           (vm_address_t) sysent + 11 * sizeof(struct sysent),
-                                           (vm_offset_t) &my_sysent,
-                                           sizeof(struct sysent)));
-                        syscall(11);
-                    }
+                    autofree uint32_t *things = malloc(sect->size);
+                    kmem_read(mem, sect->addr, things, sect->size);
+                    call_via_sysent(mem, sysent, things, sect->size / 4);
                 }
             }
         }
@@ -267,40 +228,25 @@ void unload_from_running_kernel(uint32_t addr) {
         if(cmd->cmd == LC_SEGMENT) {
             struct segment_command *seg = (void *) cmd;
             if(seg->vmsize > 0) {
-                kr_assert(vm_deallocate(kernel_task,
-                                        seg->vmaddr,
-                                        seg->vmsize));
+                kmem_deallocate(mem, seg->vmaddr, seg->vmsize);
             }
         }
     }
 }
 
 void b_running_kernel_load_macho(struct binary *binary) {
-    kern_return_t kr;
-
-    mach_port_t kernel_task = get_kernel_task();
+    struct kmem *mem = get_kernel_mem();
 
     char hdr_buf[0xfff];
     struct mach_header *const hdr = (void *) hdr_buf;
     
     addr_t mh_addr;
-    vm_size_t size;
-    for(addr_t hugebase = 0x80000000; hugebase; hugebase += 0x40000000) {
+    for(addr_t hugebase = 0x80000000; hugebase < 0x100000000ull; hugebase += 0x40000000) {
         for(addr_t pagebase = 0x1000; pagebase < 0x10000; pagebase += 0x1000) {
-            mh_addr = (vm_address_t) (hugebase + pagebase);
-            size = 0x1000;
-            // This will return either KERN_PROTECTION_FAILURE if it's a good address, and KERN_INVALID_ADDRESS otherwise.
-            // But if we use a shorter size, it will read if it's a good address, and /crash/ otherwise.
-            // So we do two.
-            kr = vm_read_overwrite(kernel_task, (vm_address_t) mh_addr, size, (vm_address_t) hdr_buf, &size);
-            if(kr == KERN_INVALID_ADDRESS) {
-                continue;
-            } else if(kr && kr != KERN_PROTECTION_FAILURE) {
-                die("unexpected error from vm_read_overwrite: %d", kr);
-            }
+            mh_addr = hugebase + pagebase;
+            if(!kmem_probe(mem, mh_addr)) continue;
             // ok, it's valid, but is it the actual header?
-            size = 0xfff;
-            kr_assert(vm_read_overwrite(kernel_task, (vm_address_t) mh_addr, size, (vm_address_t) hdr_buf, &size));
+            kmem_read(mem, mh_addr, hdr_buf, sizeof(hdr_buf));
             if(hdr->magic == MH_MAGIC) {
                 printf("found running kernel at 0x%08llx\n", (long long) mh_addr);
                 goto ok;
@@ -311,14 +257,11 @@ void b_running_kernel_load_macho(struct binary *binary) {
 
     ok:;
 
-    binary->cputype = b_mach_hdr(binary)->cputype;
-    binary->cpusubtype = b_mach_hdr(binary)->cpusubtype;
-
-    if(b_mach_hdr(binary)->sizeofcmds > size - sizeof(*b_mach_hdr(binary))) {
+    if(hdr->sizeofcmds > sizeof(hdr_buf) - sizeof(*hdr)) {
         die("sizeofcmds is too big");
     }
     addr_t maxoff = 0;
-    CMD_ITERATE(b_mach_hdr(binary), cmd) {
+    CMD_ITERATE(hdr, cmd) {
         if(cmd->cmd == LC_SEGMENT) {
             struct segment_command *scmd = (void *) cmd;
             addr_t newmax = scmd->fileoff + scmd->filesize;
@@ -326,28 +269,14 @@ void b_running_kernel_load_macho(struct binary *binary) {
         }
     }
 
-    char *buf = malloc(maxoff);
+    char *buf = calloc(1, maxoff);
 
-    CMD_ITERATE(b_mach_hdr(binary), cmd) {
+    CMD_ITERATE(hdr, cmd) {
         if(cmd->cmd == LC_SEGMENT) {
             struct segment_command *scmd = (void *) cmd;
-            addr_t off = scmd->fileoff;
-            addr_t addr = scmd->vmaddr;
-            vm_size_t size = scmd->filesize;
-            // Well, uh, this sucks.  But there's some block on reading.  In fact, it's probably a bug that this works.
-            while(size > 0) {
-                vm_size_t this_size = (vm_size_t) size;
-                if(this_size > 0xfff) this_size = 0xfff;
-                kr_assert(vm_read_overwrite(kernel_task, (vm_address_t) addr, this_size, (vm_address_t) (buf + off), &this_size));
-
-                off += (addr_t) this_size;
-                addr += (addr_t) this_size;
-                size -= this_size;
-            }
+            kmem_read(mem, scmd->vmaddr, buf + scmd->fileoff, scmd->filesize);
         }
     }
 
     b_prange_load_macho(binary, (prange_t) {buf, maxoff}, 0, "<running kernel>");    
 }
-
-#endif
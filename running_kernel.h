@@ -1,10 +1,12 @@
 #pragma once
-#ifdef __APPLE__
 #include "common.h"
 #include "binary.h"
+#include "kmem.h"
 
 __BEGIN_DECLS
 
+// by default, the kernel task (on Darwin); anything else, like kmem_init_fd, has to be set up before calling the rest
+void b_running_kernel_use(struct kmem *mem);
 
 uint32_t b_allocate_from_running_kernel(const struct binary *to_load);
 void b_inject_into_running_kernel(struct binary *to_load, uint32_t sysent);
@@ -16,4 +18,3 @@ mach_port_t get_kernel_task();
 void b_prepare_running_kernel(const struct binary *binary);
 
 __END_DECLS
-#endif
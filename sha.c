@@ -0,0 +1,227 @@
+#include "sha.h"
+
+#ifdef __APPLE__
+#include <CommonCrypto/CommonDigest.h>
+
+void sha1(const void *data, size_t size, uint8_t out[SHA1_SIZE]) {
+    CC_SHA1_CTX ctx;
+    CC_SHA1_Init(&ctx);
+    // CC_LONG is 32 bits
+    while(size > 0x40000000) {
+        CC_SHA1_Update(&ctx, data, 0x40000000);
+        data += 0x40000000;
+        size -= 0x40000000;
+    }
+    CC_SHA1_Update(&ctx, data, (CC_LONG) size);
+    CC_SHA1_Final(out, &ctx);
+}
+
+void sha256(const void *data, size_t size, uint8_t out[SHA256_SIZE]) {
+    CC_SHA256_CTX ctx;
+    CC_SHA256_Init(&ctx);
+    while(size > 0x40000000) {
+        CC_SHA256_Update(&ctx, data, 0x40000000);
+        data += 0x40000000;
+        size -= 0x40000000;
+    }
+    CC_SHA256_Update(&ctx, data, (CC_LONG) size);
+    CC_SHA256_Final(out, &ctx);
+}
+
+#else
+
+typedef void (*blocks_func)(uint32_t *state, const uint8_t *data, size_t nblocks);
+
+static inline uint32_t rol(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+static inline uint32_t ror(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+static inline uint32_t load_be32(const uint8_t *p) { return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3]; }
+
+static void sha1_blocks_c(uint32_t *state, const uint8_t *data, size_t nblocks) {
+    while(nblocks--) {
+        uint32_t w[80];
+        for(int i = 0; i < 16; i++) w[i] = load_be32(data + 4 * i);
+        for(int i = 16; i < 80; i++) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+        for(int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if(i < 20) {
+                f = (b & c) | (~b & d); k = 0x5a827999;
+            } else if(i < 40) {
+                f = b ^ c ^ d; k = 0x6ed9eba1;
+            } else if(i < 60) {
+                f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc;
+            } else {
+                f = b ^ c ^ d; k = 0xca62c1d6;
+            }
+            uint32_t t = rol(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = rol(b, 30); b = a; a = t;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e;
+        data += 64;
+    }
+}
+
+static const uint32_t k256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void sha256_blocks_c(uint32_t *state, const uint8_t *data, size_t nblocks) {
+    while(nblocks--) {
+        uint32_t w[64];
+        for(int i = 0; i < 16; i++) w[i] = load_be32(data + 4 * i);
+        for(int i = 16; i < 64; i++) {
+            uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+        for(int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + k256[i] + w[i];
+            uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+        data += 64;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SHA_NI __attribute__((target("sha,sse4.1")))
+
+SHA_NI static void sha1_blocks_ni(uint32_t *state, const uint8_t *data, size_t nblocks) {
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) state), 0x1b);
+    __m128i e0 = _mm_set_epi32((int) state[4], 0, 0, 0), e1;
+    while(nblocks--) {
+        __m128i abcd_save = abcd, e0_save = e0;
+        __m128i msg[4];
+        for(int i = 0; i < 20; i++) {
+            // each group is 4 rounds; e0 and e1 take turns
+            __m128i *e = i & 1 ? &e1 : &e0, *next = i & 1 ? &e0 : &e1;
+            if(i < 4) {
+                msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16 * i)), mask);
+            }
+            if(i == 0) {
+                e0 = _mm_add_epi32(e0, msg[0]);
+            } else {
+                *e = _mm_sha1nexte_epu32(*e, msg[i % 4]);
+            }
+            *next = abcd;
+            if(i >= 3 && i <= 18) {
+                msg[(i + 1) % 4] = _mm_sha1msg2_epu32(msg[(i + 1) % 4], msg[i % 4]);
+            }
+            switch(i / 5) {
+            case 0: abcd = _mm_sha1rnds4_epu32(abcd, *e, 0); break;
+            case 1: abcd = _mm_sha1rnds4_epu32(abcd, *e, 1); break;
+            case 2: abcd = _mm_sha1rnds4_epu32(abcd, *e, 2); break;
+            default: abcd = _mm_sha1rnds4_epu32(abcd, *e, 3); break;
+            }
+            if(i >= 1 && i <= 16) {
+                msg[(i + 3) % 4] = _mm_sha1msg1_epu32(msg[(i + 3) % 4], msg[i % 4]);
+            }
+            if(i >= 2 && i <= 17) {
+                msg[(i + 2) % 4] = _mm_xor_si128(msg[(i + 2) % 4], msg[i % 4]);
+            }
+        }
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+        data += 64;
+    }
+    _mm_storeu_si128((__m128i *) state, _mm_shuffle_epi32(abcd, 0x1b));
+    state[4] = (uint32_t) _mm_extract_epi32(e0, 3);
+}
+
+SHA_NI static void sha256_blocks_ni(uint32_t *state, const uint8_t *data, size_t nblocks) {
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &state[0]), 0xb1); // CDAB
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &state[4]), 0x1b); // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0); // CDGH
+    while(nblocks--) {
+        __m128i abef_save = state0, cdgh_save = state1;
+        __m128i msg[4];
+        for(int i = 0; i < 16; i++) {
+            if(i < 4) {
+                msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16 * i)), mask);
+            }
+            __m128i m = _mm_add_epi32(msg[i % 4], _mm_loadu_si128((const __m128i *) &k256[4 * i]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+            if(i >= 3 && i <= 14) {
+                __m128i t = _mm_alignr_epi8(msg[i % 4], msg[(i + 3) % 4], 4);
+                msg[(i + 1) % 4] = _mm_sha256msg2_epu32(_mm_add_epi32(msg[(i + 1) % 4], t), msg[i % 4]);
+            }
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(m, 0x0e));
+            if(i >= 1 && i <= 12) {
+                msg[(i + 3) % 4] = _mm_sha256msg1_epu32(msg[(i + 3) % 4], msg[i % 4]);
+            }
+        }
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+        data += 64;
+    }
+    tmp = _mm_shuffle_epi32(state0, 0x1b); // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xb1); // DCHG
+    _mm_storeu_si128((__m128i *) &state[0], _mm_blend_epi16(tmp, state1, 0xf0)); // DCBA
+    _mm_storeu_si128((__m128i *) &state[4], _mm_alignr_epi8(state1, tmp, 8)); // HGFE
+}
+
+static bool have_sha_ni() {
+    static int have = -1;
+    if(have == -1) {
+        unsigned int a, b, c, d;
+        // leaf 7 ebx bit 29 is SHA; SSE4.1 is leaf 1 ecx bit 19
+        have = __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1u << 29)) &&
+               __get_cpuid(1, &a, &b, &c, &d) && (c & (1u << 19));
+    }
+    return have;
+}
+#define sha1_blocks (have_sha_ni() ? sha1_blocks_ni : sha1_blocks_c)
+#define sha256_blocks (have_sha_ni() ? sha256_blocks_ni : sha256_blocks_c)
+#else
+#define sha1_blocks sha1_blocks_c
+#define sha256_blocks sha256_blocks_c
+#endif
+
+// the Merkle-Damgard part both of them share
+static void hash(blocks_func blocks, uint32_t *state, int nstate, const void *data, size_t size, uint8_t *out) {
+    size_t full = size / 64;
+    blocks(state, data, full);
+    uint8_t tail[128] = {0};
+    size_t rest = size - full * 64;
+    memcpy(tail, (const uint8_t *) data + full * 64, rest);
+    tail[rest] = 0x80;
+    size_t tail_size = rest < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t) size * 8;
+    for(int i = 0; i < 8; i++) {
+        tail[tail_size - 1 - i] = (uint8_t) (bits >> (8 * i));
+    }
+    blocks(state, tail, tail_size / 64);
+    for(int i = 0; i < nstate; i++) {
+        out[4 * i] = (uint8_t) (state[i] >> 24);
+        out[4 * i + 1] = (uint8_t) (state[i] >> 16);
+        out[4 * i + 2] = (uint8_t) (state[i] >> 8);
+        out[4 * i + 3] = (uint8_t) state[i];
+    }
+}
+
+void sha1(const void *data, size_t size, uint8_t out[SHA1_SIZE]) {
+    uint32_t state[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    hash(sha1_blocks, state, 5, data, size, out);
+}
+
+void sha256(const void *data, size_t size, uint8_t out[SHA256_SIZE]) {
+    uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    hash(sha256_blocks, state, 8, data, size, out);
+}
+
+#endif
@@ -0,0 +1,13 @@
+#pragma once
+#include "common.h"
+
+#define SHA1_SIZE 20
+#define SHA256_SIZE 32
+
+// one-shot hashes; these use CommonCrypto on Darwin and the SHA instructions on x86 when the CPU has them
+__BEGIN_DECLS
+
+void sha1(const void *data, size_t size, uint8_t out[SHA1_SIZE]);
+void sha256(const void *data, size_t size, uint8_t out[SHA256_SIZE]);
+
+__END_DECLS
@@ -0,0 +1,69 @@
+#include "strhash.h"
+
+uint32_t strhash_hash(const char *key, size_t len) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    while(len--) {
+        hash ^= (uint8_t) *key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void strhash_init(struct strhash *h, uint32_t expected) {
+    uint32_t size = 16;
+    while(size / 2 < expected) {
+        if(size >= 0x80000000u) die("too many entries (%u)", expected);
+        size *= 2;
+    }
+    h->entries = calloc(size, sizeof(*h->entries));
+    h->mask = size - 1;
+    h->count = 0;
+}
+
+void strhash_free(struct strhash *h) {
+    free(h->entries);
+    memset(h, 0, sizeof(*h));
+}
+
+static struct strhash_entry *find_slot(const struct strhash *h, const char *key, uint32_t len, uint32_t hash) {
+    for(uint32_t i = hash & h->mask; ; i = (i + 1) & h->mask) {
+        struct strhash_entry *e = &h->entries[i];
+        if(!e->key || (e->hash == hash && e->len == len && !memcmp(e->key, key, len))) {
+            return e;
+        }
+    }
+}
+
+static void grow(struct strhash *h) {
+    struct strhash_entry *old = h->entries;
+    uint32_t old_size = h->mask + 1;
+    if(old_size >= 0x80000000u) die("table is full");
+    h->entries = calloc(old_size * 2, sizeof(*h->entries));
+    h->mask = old_size * 2 - 1;
+    for(uint32_t i = 0; i < old_size; i++) {
+        if(old[i].key) {
+            *find_slot(h, old[i].key, old[i].len, old[i].hash) = old[i];
+        }
+    }
+    free(old);
+}
+
+bool strhash_insert(struct strhash *h, const char *key, size_t len, uint64_t value) {
+    if(len > UINT32_MAX) die("key too long");
+    if((h->count + 1) * 2 > h->mask + 1) {
+        grow(h);
+    }
+    uint32_t hash = strhash_hash(key, len);
+    struct strhash_entry *e = find_slot(h, key, (uint32_t) len, hash);
+    if(e->key) return false;
+    *e = (struct strhash_entry) {key, (uint32_t) len, hash, value};
+    h->count++;
+    return true;
+}
+
+const struct strhash_entry *strhash_lookup(const struct strhash *h, const char *key, size_t len) {
+    if(!h->entries || len > UINT32_MAX) return NULL;
+    const struct strhash_entry *e = find_slot(h, key, (uint32_t) len, strhash_hash(key, len));
+    return e->key ? e : NULL;
+}
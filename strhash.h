@@ -0,0 +1,34 @@
+#pragma once
+#include "common.h"
+
+// a dumb open-addressing hash table from (not necessarily NUL-terminated) strings to 64-bit values.  keys are not copied, so they have to outlive the table; they usually point into a string table or the load commands.
+
+struct strhash_entry {
+    const char *key;
+    uint32_t len;
+    uint32_t hash;
+    uint64_t value;
+};
+
+struct strhash {
+    struct strhash_entry *entries;
+    uint32_t mask;
+    uint32_t count;
+};
+
+__BEGIN_DECLS
+
+__attribute__((pure)) uint32_t strhash_hash(const char *key, size_t len);
+
+void strhash_init(struct strhash *h, uint32_t expected);
+void strhash_free(struct strhash *h);
+
+// returns false (and leaves the old value alone) if the key was already there
+bool strhash_insert(struct strhash *h, const char *key, size_t len, uint64_t value);
+const struct strhash_entry *strhash_lookup(const struct strhash *h, const char *key, size_t len);
+
+static inline const struct strhash_entry *strhash_get(const struct strhash *h, const char *key) {
+    return strhash_lookup(h, key, strlen(key));
+}
+
+__END_DECLS
@@ -0,0 +1,83 @@
+#include "strpool.h"
+
+void strpool_init(struct strpool *pool, uint32_t expected) {
+    strhash_init(&pool->index, expected);
+    pool->capstrs = expected ? expected : 16;
+    pool->strs = malloc(pool->capstrs * sizeof(*pool->strs));
+    pool->nstrs = 0;
+    pool->size = 0;
+}
+
+void strpool_free(struct strpool *pool) {
+    strhash_free(&pool->index);
+    free(pool->strs);
+    memset(pool, 0, sizeof(*pool));
+}
+
+void strpool_add(struct strpool *pool, const char *str) {
+    size_t len = strlen(str);
+    if(!strhash_insert(&pool->index, str, len, pool->nstrs)) return;
+    if(pool->nstrs == pool->capstrs) {
+        pool->capstrs *= 2;
+        pool->strs = realloc(pool->strs, pool->capstrs * sizeof(*pool->strs));
+    }
+    pool->strs[pool->nstrs++] = (struct strpool_str) {str, (uint32_t) len, 0};
+}
+
+// compares the strings backwards, so that a string sorts right before everything it is the tail of
+static int compare_reversed(const void *a_, const void *b_) {
+    const struct strpool_str *a = *(const struct strpool_str **) a_, *b = *(const struct strpool_str **) b_;
+    uint32_t i = a->len, j = b->len;
+    while(i && j) {
+        uint8_t ca = a->str[--i], cb = b->str[--j];
+        if(ca != cb) return ca < cb ? -1 : 1;
+    }
+    return (i != 0) - (j != 0);
+}
+
+uint32_t strpool_layout(struct strpool *pool, uint32_t align) {
+    struct strpool_str **sorted = malloc((pool->nstrs ? pool->nstrs : 1) * sizeof(*sorted));
+    for(uint32_t i = 0; i < pool->nstrs; i++) {
+        sorted[i] = &pool->strs[i];
+    }
+    qsort(sorted, pool->nstrs, sizeof(*sorted), compare_reversed);
+
+    uint64_t size = 2;
+    const struct strpool_str *prev = NULL;
+    // longest first, so the tails have somewhere to go
+    for(uint32_t i = pool->nstrs; i-- > 0; ) {
+        struct strpool_str *s = sorted[i];
+        if(!s->len) {
+            s->offset = 1;
+        } else if(prev && prev->len >= s->len && !memcmp(prev->str + prev->len - s->len, s->str, s->len)) {
+            s->offset = prev->offset + prev->len - s->len;
+        } else {
+            s->offset = (uint32_t) size;
+            size += s->len + 1;
+            if(size > UINT32_MAX) die("string table too big");
+        }
+        if(s->len) prev = s;
+    }
+    free(sorted);
+
+    if(align > 1) size = (size + align - 1) & ~(uint64_t) (align - 1);
+    if(size > UINT32_MAX) die("string table too big");
+    return pool->size = (uint32_t) size;
+}
+
+uint32_t strpool_offset(const struct strpool *pool, const char *str) {
+    const struct strhash_entry *e = strhash_get(&pool->index, str);
+    if(!e) die("%s isn't in the pool", str);
+    return pool->strs[e->value].offset;
+}
+
+void strpool_write(const struct strpool *pool, void *out) {
+    char *p = out;
+    memset(p, 0, pool->size);
+    p[0] = ' ';
+    for(uint32_t i = 0; i < pool->nstrs; i++) {
+        const struct strpool_str *s = &pool->strs[i];
+        // tails get written over their own spot in the longer string, which is harmless
+        memcpy(p + s->offset, s->str, s->len);
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "strhash.h"
+
+// builds a Mach-O string table the way ld64 does: each distinct string is stored once, and a string that is the tail of a longer one (like "_foo" and "__foo") points into it instead of getting its own copy.  strings are not copied, so they have to outlive the pool.
+
+struct strpool {
+    struct strhash index; // string -> index into strs
+    struct strpool_str {
+        const char *str;
+        uint32_t len;
+        uint32_t offset; // valid after strpool_layout
+    } *strs;
+    uint32_t nstrs, capstrs;
+    uint32_t size;
+};
+
+__BEGIN_DECLS
+
+void strpool_init(struct strpool *pool, uint32_t expected);
+void strpool_free(struct strpool *pool);
+
+void strpool_add(struct strpool *pool, const char *str);
+// decides where everything goes; returns the size of the table, which starts with " \0" like ld64's and is padded to align
+uint32_t strpool_layout(struct strpool *pool, uint32_t align);
+// only for strings that were added
+uint32_t strpool_offset(const struct strpool *pool, const char *str);
+void strpool_write(const struct strpool *pool, void *out);
+
+__END_DECLS
@@ -0,0 +1,170 @@
+#include "trace.h"
+
+#ifdef PROFILING
+#include "strhash.h"
+#include <pthread.h>
+#include <time.h>
+
+static const char *const counter_names[TRACE_NCOUNTERS] = {
+    [TRACE_FIND_BMH_BYTES] = "find_bmh_bytes",
+    [TRACE_FIND_INT32_BYTES] = "find_int32_bytes",
+    [TRACE_FINDMANY_BYTES] = "findmany_bytes",
+    [TRACE_FIND_BL_BYTES] = "find_bl_bytes",
+    [TRACE_RANGECONV] = "rangeconv",
+    [TRACE_RANGECONV_MISS] = "rangeconv_miss",
+    [TRACE_RANGECONV_OFF] = "rangeconv_off",
+    [TRACE_SYM_NLIST] = "sym_nlist",
+    [TRACE_SYM_TRIE_WALK] = "sym_trie_walk",
+    [TRACE_SYM_TRIE_BATCH] = "sym_trie_batch",
+    [TRACE_SYM_EXPORT_TABLE] = "sym_export_table",
+    [TRACE_SYM_REEXPORT] = "sym_reexport",
+    [TRACE_SYM_PRIVATE] = "sym_private",
+    [TRACE_SYM_IMPORTED] = "sym_imported",
+    [TRACE_FIXUPS] = "fixups",
+};
+
+__thread struct trace_thread *_trace_self;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_thread *trace_threads;
+static uint32_t trace_nthreads;
+static uint64_t trace_epoch;
+
+uint64_t _trace_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static void trace_exit() {
+    const char *path;
+    if((path = getenv("DATA_TRACE"))) trace_write_chrome(path);
+    if((path = getenv("DATA_TRACE_SUMMARY"))) trace_write_summary(path);
+}
+
+// threads never give theirs back, so parallel_for workers still count after they're gone
+struct trace_thread *_trace_thread_init() {
+    struct trace_thread *t = calloc(1, sizeof(*t));
+    pthread_mutex_lock(&trace_lock);
+    if(!trace_threads) {
+        trace_epoch = _trace_now();
+        atexit(trace_exit);
+    }
+    t->tid = trace_nthreads++;
+    t->next = trace_threads;
+    trace_threads = t;
+    pthread_mutex_unlock(&trace_lock);
+    _trace_self = t;
+    return t;
+}
+
+void _trace_end(struct trace_scope *scope) {
+    uint64_t end = _trace_now();
+    struct trace_thread *t = _trace_thread();
+    if(t->nevents == t->events_capacity) {
+        t->events_capacity = t->events_capacity ? t->events_capacity * 2 : 256;
+        t->events = realloc(t->events, t->events_capacity * sizeof(*t->events));
+    }
+    t->events[t->nevents++] = (struct trace_event) {scope->name, scope->start, end - scope->start};
+}
+
+static FILE *open_output(const char *path) {
+    if(!strcmp(path, "-")) return stderr;
+    FILE *fp = fopen(path, "w");
+    if(!fp) {
+        fprintf(stderr, "trace: could not open %s: %s\n", path, strerror(errno));
+    }
+    return fp;
+}
+
+static void close_output(FILE *fp) {
+    if(fp != stderr) fclose(fp);
+}
+
+static void write_counters(FILE *fp) {
+    uint64_t totals[TRACE_NCOUNTERS] = {0};
+    for(struct trace_thread *t = trace_threads; t; t = t->next) {
+        for(int c = 0; c < TRACE_NCOUNTERS; c++) {
+            totals[c] += t->counters[c];
+        }
+    }
+    fprintf(fp, "{");
+    for(int c = 0; c < TRACE_NCOUNTERS; c++) {
+        fprintf(fp, "%s\"%s\": %llu", c ? ", " : "", counter_names[c], (unsigned long long) totals[c]);
+    }
+    fprintf(fp, "}");
+}
+
+void trace_write_chrome(const char *path) {
+    FILE *fp = open_output(path);
+    if(!fp) return;
+    pthread_mutex_lock(&trace_lock);
+    int pid = (int) getpid();
+    uint64_t last = trace_epoch;
+    bool first = true;
+    fprintf(fp, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    for(struct trace_thread *t = trace_threads; t; t = t->next) {
+        fprintf(fp, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %u, \"args\": {\"name\": \"thread %u\"}}", first ? "" : ",\n", pid, t->tid, t->tid);
+        first = false;
+        for(size_t i = 0; i < t->nevents; i++) {
+            const struct trace_event *e = &t->events[i];
+            fprintf(fp, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}", e->name, pid, t->tid, (e->start - trace_epoch) / 1000.0, e->duration / 1000.0);
+            if(e->start + e->duration > last) last = e->start + e->duration;
+        }
+    }
+    if(!first) {
+        fprintf(fp, ",\n{\"name\": \"counters\", \"ph\": \"C\", \"pid\": %d, \"tid\": 0, \"ts\": %.3f, \"args\": ", pid, (last - trace_epoch) / 1000.0);
+        write_counters(fp);
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n]}\n");
+    pthread_mutex_unlock(&trace_lock);
+    close_output(fp);
+}
+
+struct scope_total {
+    const char *name;
+    uint64_t count, total, max;
+};
+
+void trace_write_summary(const char *path) {
+    FILE *fp = open_output(path);
+    if(!fp) return;
+    pthread_mutex_lock(&trace_lock);
+    // nested scopes with the same name (recursion) count twice
+    struct strhash index;
+    strhash_init(&index, 64);
+    struct scope_total *totals = NULL;
+    uint32_t ntotals = 0;
+    for(struct trace_thread *t = trace_threads; t; t = t->next) {
+        for(size_t i = 0; i < t->nevents; i++) {
+            const struct trace_event *e = &t->events[i];
+            if(strhash_insert(&index, e->name, strlen(e->name), ntotals)) {
+                totals = realloc(totals, (ntotals + 1) * sizeof(*totals));
+                totals[ntotals++] = (struct scope_total) {e->name, 0, 0, 0};
+            }
+            struct scope_total *st = &totals[strhash_get(&index, e->name)->value];
+            st->count++;
+            st->total += e->duration;
+            if(e->duration > st->max) st->max = e->duration;
+        }
+    }
+    fprintf(fp, "{\"wall_ns\": %llu, \"threads\": %u, \"scopes\": {", (unsigned long long) (trace_threads ? _trace_now() - trace_epoch : 0), trace_nthreads);
+    for(uint32_t i = 0; i < ntotals; i++) {
+        fprintf(fp, "%s\n  \"%s\": {\"count\": %llu, \"total_ns\": %llu, \"max_ns\": %llu}", i ? "," : "", totals[i].name,
+                (unsigned long long) totals[i].count, (unsigned long long) totals[i].total, (unsigned long long) totals[i].max);
+    }
+    fprintf(fp, "%s}, \"counters\": ", ntotals ? "\n" : "");
+    write_counters(fp);
+    fprintf(fp, "}\n");
+    free(totals);
+    strhash_free(&index);
+    pthread_mutex_unlock(&trace_lock);
+    close_output(fp);
+}
+
+#else
+
+void trace_write_chrome(__unused const char *path) {}
+void trace_write_summary(__unused const char *path) {}
+
+#endif
@@ -0,0 +1,77 @@
+#pragma once
+#include "common.h"
+
+// opt-in instrumentation for the load/unpack/find/relocate pipeline.  unless PROFILING is defined (see common.h), TRACE_SCOPE and TRACE_COUNT compile to nothing.
+// with it, every thread keeps its own counters and list of timed scopes, and at exit:
+//   DATA_TRACE=path writes them as a Chrome trace (chrome://tracing or Perfetto),
+//   DATA_TRACE_SUMMARY=path (- for stderr) writes per-scope totals and the summed counters as JSON.
+
+enum trace_counter {
+    TRACE_FIND_BMH_BYTES,       // scanned by find_data, find_string, find_bytes
+    TRACE_FIND_INT32_BYTES,     // scanned by find_int32
+    TRACE_FINDMANY_BYTES,       // scanned by the findmany DFA
+    TRACE_FIND_BL_BYTES,        // scanned by find_bl
+    TRACE_RANGECONV,            // address or offset -> segment lookups
+    TRACE_RANGECONV_MISS,       // ... that weren't in the segment the last one found
+    TRACE_RANGECONV_OFF,        // rangeconv_off calls
+    TRACE_SYM_NLIST,            // symbol lookups by binary search of the symbol table
+    TRACE_SYM_TRIE_WALK,        // ... by walking the export trie
+    TRACE_SYM_TRIE_BATCH,       // ... by one trie walk for a sorted batch (b_sym_many)
+    TRACE_SYM_EXPORT_TABLE,     // ... in the flattened export trie
+    TRACE_SYM_REEXPORT,         // ... in the reexported libraries
+    TRACE_SYM_PRIVATE,          // ... of private symbols
+    TRACE_SYM_IMPORTED,         // ... of imported symbols
+    TRACE_FIXUPS,               // words written by relocation
+    TRACE_NCOUNTERS
+};
+
+struct trace_event {
+    const char *name;
+    uint64_t start, duration; // ns
+};
+
+struct trace_thread {
+    uint64_t counters[TRACE_NCOUNTERS];
+    struct trace_event *events;
+    size_t nevents, events_capacity;
+    uint32_t tid;
+    struct trace_thread *next;
+};
+
+struct trace_scope {
+    const char *name;
+    uint64_t start;
+};
+
+__BEGIN_DECLS
+
+// these work (and do nothing) without PROFILING too.  call them when no other thread is tracing.
+void trace_write_chrome(const char *path);
+void trace_write_summary(const char *path);
+
+#ifdef PROFILING
+extern __thread struct trace_thread *_trace_self;
+struct trace_thread *_trace_thread_init();
+uint64_t _trace_now();
+void _trace_end(struct trace_scope *scope);
+
+static inline struct trace_thread *_trace_thread() {
+    return _trace_self ? _trace_self : _trace_thread_init();
+}
+static inline struct trace_scope _trace_begin(const char *name) {
+    // register first, so nothing starts before the trace's epoch
+    _trace_thread();
+    return (struct trace_scope) {name, _trace_now()};
+}
+
+#define _TRACE_SCOPE_VAR(line) _trace_scope_##line
+#define _TRACE_SCOPE(name, line) __attribute__((cleanup(_trace_end), unused)) struct trace_scope _TRACE_SCOPE_VAR(line) = _trace_begin(name)
+// times the rest of the enclosing block
+#define TRACE_SCOPE(name) _TRACE_SCOPE(name, __LINE__)
+#define TRACE_COUNT(counter, n) ((void) (_trace_thread()->counters[counter] += (n)))
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_COUNT(counter, n) ((void) 0)
+#endif
+
+__END_DECLS